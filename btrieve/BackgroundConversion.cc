@@ -0,0 +1,142 @@
+#include "BackgroundConversion.h"
+
+#include <algorithm>
+
+namespace btrieve {
+
+BackgroundConversion::~BackgroundConversion() {
+  cancelled = true;
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+RecordCursor BackgroundConversion::prepareCursor(BtrieveDatabase &database) {
+  database.setDecodeThreads(1);
+  database.setReadAhead(false);
+  return database.openCursor();
+}
+
+bool BackgroundConversion::isDone() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return done;
+}
+
+void BackgroundConversion::wait() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return done; });
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+uint64_t BackgroundConversion::getConvertedPosition(uint64_t position) const {
+  return position - static_cast<uint64_t>(
+                        std::upper_bound(skippedRecords.begin(),
+                                         skippedRecords.end(), position) -
+                        skippedRecords.begin());
+}
+
+bool BackgroundConversion::seek(uint64_t position) {
+  if (position == 0 || (lastPosition > 0 && position > lastPosition)) {
+    return false;
+  }
+
+  // once the cursor has looked past the last page it no longer holds the last
+  // record either
+  if (position < cursorPosition ||
+      (position == cursorPosition && cursor->getRecord().empty())) {
+    // start over from the page holding the record
+    const auto page =
+        std::upper_bound(pages.begin(), pages.end(), position,
+                         [](uint64_t position, const PageStart &page) {
+                           return position < page.position;
+                         }) -
+        1;
+    cursor.emplace(database.openCursor(page->logicalPage));
+    cursorPosition = page->position - 1;
+    cursorExhausted = false;
+  }
+
+  while (cursorPosition < position) {
+    if (cursorExhausted) {
+      return false;
+    }
+
+    if (cursor->nextInPage()) {
+      ++cursorPosition;
+      if (pages.empty() ||
+          cursor->getLogicalPage() > pages.back().logicalPage) {
+        pages.push_back(PageStart{cursor->getLogicalPage(), cursorPosition});
+      }
+    } else if (cursorPosition >= database.getRecordCount() ||
+               !cursor->nextPage()) {
+      // like the conversion, stop at the end of the page that brings the
+      // count up to the record count
+      cursorExhausted = true;
+      lastPosition = cursorPosition;
+    }
+  }
+
+  return true;
+}
+
+BtrieveError BackgroundConversion::stepFirst() {
+  if (!seek(1)) {
+    return BtrieveError::EndOfFile;
+  }
+
+  position = 1;
+  return BtrieveError::Success;
+}
+
+BtrieveError BackgroundConversion::stepLast() {
+  seek(UINT64_MAX);
+  if (lastPosition == 0) {
+    return BtrieveError::EndOfFile;
+  }
+
+  position = lastPosition;
+  return BtrieveError::Success;
+}
+
+BtrieveError BackgroundConversion::stepNext() {
+  if (!seek(position + 1)) {
+    return BtrieveError::EndOfFile;
+  }
+
+  ++position;
+  return BtrieveError::Success;
+}
+
+BtrieveError BackgroundConversion::stepPrevious() {
+  if (position <= 1) {
+    return BtrieveError::EndOfFile;
+  }
+
+  // a position past the last record steps back to the last one
+  uint64_t previous = position - 1;
+  if (!seek(previous)) {
+    previous = lastPosition;
+  }
+  if (previous == 0) {
+    return BtrieveError::EndOfFile;
+  }
+
+  position = previous;
+  return BtrieveError::Success;
+}
+
+std::pair<bool, Record> BackgroundConversion::getRecord(uint64_t position) {
+  this->position = position;
+
+  if (!seek(position)) {
+    return std::pair<bool, Record>(false, Record());
+  }
+
+  return std::pair<bool, Record>(true, Record(position, cursor->getRecord()));
+}
+}  // namespace btrieve
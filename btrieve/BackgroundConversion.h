@@ -0,0 +1,158 @@
+#ifndef __BACKGROUND_CONVERSION_H_
+#define __BACKGROUND_CONVERSION_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "BtrieveDatabase.h"
+#include "ConversionStats.h"
+#include "ErrorCode.h"
+#include "Record.h"
+#include "RecordCursor.h"
+
+namespace btrieve {
+
+// Converts a DAT file on a background thread, and meanwhile serves the
+// physical step operations and direct record reads on it straight from the
+// DAT file's pages, reading them with a cursor of its own as far as they
+// need. Only the cursor's current record is held in memory, along with where
+// each page read so far starts, so earlier records are read again from their
+// page.
+//
+// Records are numbered from 1 in physical order, which are the positions the
+// conversion gives them as long as it stores records in the same order. The
+// conversion reports the records it fails to store, so the positions handed
+// out meanwhile can be carried over, see getConvertedPosition.
+class BackgroundConversion {
+ public:
+  // Starts convert on a new thread, as convert(stats, skippedRecords,
+  // cancelled). convert should fill in stats, add the position of every
+  // record it doesn't store to skippedRecords in order, and throw once
+  // cancelled is set, leaving nothing half converted behind. database is the
+  // opened DAT file being converted, which is copied, so records are read
+  // from it independently of convert.
+  template <typename Convert>
+  BackgroundConversion(const BtrieveDatabase &database_, Convert &&convert)
+      : database(database_),
+        cursor(prepareCursor(database)),
+        cursorPosition(0),
+        cursorExhausted(false),
+        lastPosition(0),
+        position(0),
+        cancelled(false),
+        done(false) {
+    thread = std::thread(
+        [this, convert = std::forward<Convert>(convert)]() mutable {
+          try {
+            convert(stats, skippedRecords, cancelled);
+          } catch (...) {
+            error = std::current_exception();
+          }
+
+          std::lock_guard<std::mutex> lock(mutex);
+          done = true;
+          finished.notify_all();
+        });
+  }
+
+  BackgroundConversion(const BackgroundConversion &) = delete;
+  BackgroundConversion &operator=(const BackgroundConversion &) = delete;
+
+  // Cancels the conversion if it's still running and waits for it to stop.
+  ~BackgroundConversion();
+
+  // Returns whether the conversion has finished, successfully or not.
+  bool isDone() const;
+
+  // Returns whether the conversion finished by throwing.
+  bool isFailed() const { return isDone() && error; }
+
+  // Waits for the conversion to finish, then rethrows whatever it threw.
+  void wait();
+
+  // Returns where the time went during the conversion. Only complete once it
+  // has finished.
+  const ConversionStats &getStats() const { return stats; }
+
+  // Return the metadata in the DAT file's header.
+  unsigned int getRecordCount() const { return database.getRecordCount(); }
+
+  unsigned int getRecordLength() const { return database.getRecordLength(); }
+
+  bool isVariableLengthRecords() const {
+    return database.isVariableLengthRecords();
+  }
+
+  const std::vector<Key> &getKeys() const { return database.getKeys(); }
+
+  uint64_t getPosition() const { return position; }
+
+  // Returns the position the conversion gave the record at position, which
+  // is one less for every record before it the conversion skipped. A skipped
+  // record maps to the record stored before it, or to 0. Only valid once the
+  // conversion has finished.
+  uint64_t getConvertedPosition(uint64_t position) const;
+
+  void setPosition(uint64_t position_) { position = position_; }
+
+  // Moves to the first, last, next or previous record in physical order,
+  // like SqlDatabase's methods of the same names.
+  BtrieveError stepFirst();
+  BtrieveError stepLast();
+  BtrieveError stepNext();
+  BtrieveError stepPrevious();
+
+  // Returns the record at position, moving there like SqlDatabase::getRecord.
+  std::pair<bool, Record> getRecord(uint64_t position);
+
+ private:
+  // Returns a serial cursor over database, which is switched to reading one
+  // page at a time since it only advances as far as it's asked to.
+  static RecordCursor prepareCursor(BtrieveDatabase &database);
+
+  // Moves cursor to the record at position, going back to the start of its
+  // page if it's behind the cursor. Returns false if there's no such record.
+  bool seek(uint64_t position);
+
+  // A data page read so far, and the position of its first record.
+  struct PageStart {
+    unsigned int logicalPage;
+    uint64_t position;
+  };
+
+  BtrieveDatabase database;
+  // holds the cursor, which is opened again to go back to an earlier page
+  std::optional<RecordCursor> cursor;
+  // the position of the cursor's current record, 0 if it has none
+  uint64_t cursorPosition;
+  // whether cursor has read every record the conversion reads
+  bool cursorExhausted;
+  // in the order they were read, each starting with a later record
+  std::vector<PageStart> pages;
+  // the position of the last record, once a cursor has been exhausted
+  uint64_t lastPosition;
+  uint64_t position;
+
+  ConversionStats stats;
+  // the positions of the records the conversion didn't store, in order
+  std::vector<uint64_t> skippedRecords;
+  std::atomic<bool> cancelled;
+  mutable std::mutex mutex;
+  std::condition_variable finished;
+  bool done;
+  // set once done if the conversion threw
+  std::exception_ptr error;
+  // started last, once everything it uses is set up
+  std::thread thread;
+};
+}  // namespace btrieve
+
+#endif
@@ -0,0 +1,195 @@
+#include "BackgroundConversion.h"
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BtrieveException.h"
+#include "TestBase.h"
+#include "Text.h"
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+TEST(BackgroundConversion, ServesRecordsWhileConverting) {
+  for (auto asset : {"assets/WCCACMS2.DAT", "assets/VARIABLE.DAT"}) {
+    BtrieveDatabase database;
+    ASSERT_EQ(database.open(toWideString(asset).c_str()),
+              BtrieveError::Success);
+    const auto expected = readAllRecords(database);
+
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    BackgroundConversion conversion(
+        database, [released](ConversionStats &stats,
+                             std::vector<uint64_t> &skippedRecords,
+                             const std::atomic<bool> &cancelled) {
+          released.wait();
+          stats.recordsStored = 1;
+        });
+    // the conversion has its own copy
+    database.close();
+
+    EXPECT_FALSE(conversion.isDone());
+    EXPECT_EQ(conversion.getRecordCount(), expected.size());
+
+    ASSERT_EQ(conversion.stepFirst(), BtrieveError::Success);
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQ(conversion.getPosition(), i + 1);
+      auto record = conversion.getRecord(conversion.getPosition());
+      ASSERT_TRUE(record.first);
+      EXPECT_EQ(record.second.getPosition(), i + 1);
+      ASSERT_EQ(record.second.getData(), expected[i]);
+
+      ASSERT_EQ(conversion.stepNext(), i + 1 < expected.size()
+                                           ? BtrieveError::Success
+                                           : BtrieveError::EndOfFile);
+    }
+    EXPECT_EQ(conversion.getPosition(), expected.size());
+
+    ASSERT_EQ(conversion.stepPrevious(), BtrieveError::Success);
+    EXPECT_EQ(conversion.getPosition(), expected.size() - 1);
+    ASSERT_EQ(conversion.stepLast(), BtrieveError::Success);
+    EXPECT_EQ(conversion.getPosition(), expected.size());
+    ASSERT_EQ(conversion.stepFirst(), BtrieveError::Success);
+    EXPECT_EQ(conversion.stepPrevious(), BtrieveError::EndOfFile);
+    EXPECT_EQ(conversion.getPosition(), 1u);
+
+    EXPECT_FALSE(conversion.getRecord(0).first);
+    EXPECT_FALSE(conversion.getRecord(expected.size() + 1).first);
+    // stepping back from past the end lands on the last record
+    EXPECT_EQ(conversion.stepPrevious(), BtrieveError::Success);
+    EXPECT_EQ(conversion.getPosition(), expected.size());
+
+    EXPECT_FALSE(conversion.isDone());
+    release.set_value();
+    conversion.wait();
+    EXPECT_TRUE(conversion.isDone());
+    EXPECT_FALSE(conversion.isFailed());
+    EXPECT_EQ(conversion.getStats().recordsStored, 1u);
+  }
+}
+
+TEST(BackgroundConversion, ReadsOnlyAsFarAsAsked) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/WCCACMS2.DAT")), BtrieveError::Success);
+  const auto expected = readAllRecords(database);
+
+  BackgroundConversion conversion(
+      database,
+      [](ConversionStats &stats, std::vector<uint64_t> &skippedRecords,
+         const std::atomic<bool> &cancelled) {});
+
+  // jumping straight to a record reads up to it
+  auto record = conversion.getRecord(1000);
+  ASSERT_TRUE(record.first);
+  EXPECT_EQ(record.second.getData(), expected[999]);
+  EXPECT_EQ(conversion.getPosition(), 1000u);
+  ASSERT_EQ(conversion.stepNext(), BtrieveError::Success);
+  EXPECT_EQ(conversion.getRecord(conversion.getPosition()).second.getData(),
+            expected[1000]);
+  ASSERT_EQ(conversion.stepPrevious(), BtrieveError::Success);
+  ASSERT_EQ(conversion.stepPrevious(), BtrieveError::Success);
+  EXPECT_EQ(conversion.getRecord(conversion.getPosition()).second.getData(),
+            expected[998]);
+
+  conversion.wait();
+}
+
+TEST(BackgroundConversion, StepsBackThroughEveryRecord) {
+  for (auto asset : {"assets/WCCACMS2.DAT", "assets/VARIABLE.DAT"}) {
+    BtrieveDatabase database;
+    ASSERT_EQ(database.open(toWideString(asset).c_str()),
+              BtrieveError::Success);
+    const auto expected = readAllRecords(database);
+
+    BackgroundConversion conversion(
+        database,
+        [](ConversionStats &stats, std::vector<uint64_t> &skippedRecords,
+           const std::atomic<bool> &cancelled) {});
+
+    // every step back goes behind the cursor, so reads the record again
+    ASSERT_EQ(conversion.stepLast(), BtrieveError::Success);
+    for (size_t i = expected.size(); i > 0; --i) {
+      ASSERT_EQ(conversion.getPosition(), i);
+      auto record = conversion.getRecord(conversion.getPosition());
+      ASSERT_TRUE(record.first);
+      ASSERT_EQ(record.second.getData(), expected[i - 1]);
+
+      ASSERT_EQ(conversion.stepPrevious(), i > 1 ? BtrieveError::Success
+                                                 : BtrieveError::EndOfFile);
+    }
+    EXPECT_EQ(conversion.getPosition(), 1u);
+
+    conversion.wait();
+  }
+}
+
+TEST(BackgroundConversion, MapsPositionsPastSkippedRecords) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/MBBSEMU.DAT")), BtrieveError::Success);
+
+  BackgroundConversion conversion(
+      database, [](ConversionStats &stats,
+                   std::vector<uint64_t> &skippedRecords,
+                   const std::atomic<bool> &cancelled) {
+        skippedRecords = {2, 5};
+      });
+  conversion.wait();
+
+  EXPECT_EQ(conversion.getConvertedPosition(0), 0u);
+  EXPECT_EQ(conversion.getConvertedPosition(1), 1u);
+  EXPECT_EQ(conversion.getConvertedPosition(2), 1u);
+  EXPECT_EQ(conversion.getConvertedPosition(3), 2u);
+  EXPECT_EQ(conversion.getConvertedPosition(4), 3u);
+  EXPECT_EQ(conversion.getConvertedPosition(5), 3u);
+  EXPECT_EQ(conversion.getConvertedPosition(6), 4u);
+}
+
+TEST(BackgroundConversion, RethrowsConversionErrors) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/MBBSEMU.DAT")), BtrieveError::Success);
+
+  BackgroundConversion conversion(
+      database, [](ConversionStats &stats,
+                   std::vector<uint64_t> &skippedRecords,
+                   const std::atomic<bool> &cancelled) {
+        throw BtrieveException(BtrieveError::IOError, "Failed");
+      });
+
+  EXPECT_THROW(conversion.wait(), BtrieveException);
+  EXPECT_TRUE(conversion.isDone());
+  EXPECT_TRUE(conversion.isFailed());
+  // and again, for every caller waiting on it
+  EXPECT_THROW(conversion.wait(), BtrieveException);
+
+  // records are still served from the DAT file
+  EXPECT_EQ(conversion.stepFirst(), BtrieveError::Success);
+}
+
+TEST(BackgroundConversion, CancelsWhenDestroyed) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/MBBSEMU.DAT")), BtrieveError::Success);
+
+  std::promise<void> started;
+  bool cancelledSeen = false;
+  {
+    BackgroundConversion conversion(
+        database, [&started, &cancelledSeen](
+                      ConversionStats &stats,
+                      std::vector<uint64_t> &skippedRecords,
+                      const std::atomic<bool> &cancelled) {
+          started.set_value();
+          while (!cancelled) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+          cancelledSeen = true;
+          throw BtrieveException(BtrieveError::CloseError, "Cancelled");
+        });
+    started.get_future().wait();
+  }
+
+  EXPECT_TRUE(cancelledSeen);
+}
@@ -1,32 +1,19 @@
 #include "BtrieveDatabase.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
 #include "BtrieveException.h"
+#include "ByteScan.h"
+#include "Hash.h"
+#include "PageSource.h"
 #include "Text.h"
 
 namespace btrieve {
 
-static size_t fread_s(void* ptr, size_t bytes, FILE* stream) {
-  size_t numRead = fread(ptr, 1, bytes, stream);
-  if (numRead != bytes) {
-    throw BtrieveException(
-        BtrieveError::IOError,
-        "Failed to read all bytes, got %d, wanted %d, errno=%d", numRead, bytes,
-        errno);
-  }
-  return numRead;
-}
-
-static int fseek_s(FILE* stream, long offset, int whence) {
-  int ret = fseek(stream, offset, whence);
-  if (ret != 0) {
-    throw BtrieveException(
-        BtrieveError::IOError,
-        "Failed to seek in file to position [%d|%d], errno=%d", offset, whence,
-        errno);
-  }
-  return ret;
-}
-
 static inline uint16_t toUint16(const void* ptr) {
   auto p = reinterpret_cast<const uint8_t*>(ptr);
   return p[0] | p[1] << 8;
@@ -43,21 +30,8 @@ static inline uint32_t getRecordPointer(std::basic_string_view<uint8_t> data) {
          static_cast<uint32_t>(toUint16(data.data() + 2));
 }
 
-static uint32_t getRecordPointer(FILE* f, uint32_t offset) {
-  uint8_t data[4];
-  fseek_s(f, offset, SEEK_SET);
-  fread_s(data, sizeof(data), f);
-  return getRecordPointer(std::basic_string_view<uint8_t>(data, sizeof(data)));
-}
-
-// Fills set with all record pointers reachable from first.
-static void getRecordPointerList(FILE* f, uint32_t first,
-                                 std::unordered_set<uint32_t>& set) {
-  while (first != 0xFFFFFFFF) {
-    set.insert(first);
-
-    first = getRecordPointer(f, first);
-  }
+static uint32_t getRecordPointer(const PageSource& source, uint32_t offset) {
+  return getRecordPointer(source.read(offset, sizeof(uint32_t)));
 }
 
 static inline uint32_t getPageFromVariableLengthRecordPointer(
@@ -75,7 +49,7 @@ static void append(std::vector<uint8_t>& vector,
 }
 
 BtrieveDatabase::FCRDATA BtrieveDatabase::validateDatabase(
-    FILE* f, const uint8_t* firstPage) {
+    const PageSource& source, const uint8_t* firstPage) {
   const uint8_t* fcr = firstPage;
   FCRDATA fcrData;
 
@@ -98,25 +72,22 @@ BtrieveDatabase::FCRDATA BtrieveDatabase::validateDatabase(
 
   // find the valid FCR in v6
   if (v6) {
-    uint8_t* wholePage = reinterpret_cast<uint8_t*>(alloca(pageLength));
-    fseek_s(f, pageLength, SEEK_SET);
-    fread_s(wholePage, pageLength, f);
+    const uint8_t* secondPage = source.read(pageLength, pageLength).data();
 
     // check the usage count to find the active FCR
     uint32_t usageCount1 = toUint32(fcr + 4);
-    uint32_t usageCount2 = toUint32(wholePage + 4);
-
-    fcr = wholePage;
+    uint32_t usageCount2 = toUint32(secondPage + 4);
 
-    // get the FCR based on usage counts, if first page we need to read in the
+    // get the FCR based on usage counts, if first page we need to view the
     // entire thing since pageLength might not equal 512 which we read initially
     if (usageCount1 > usageCount2) {
       fcrData.fcrOffset = 0;
 
-      fseek_s(f, 0, SEEK_SET);
-      fread_s(wholePage, pageLength, f);
+      fcr = source.read(0, pageLength).data();
     } else {
       fcrData.fcrOffset = pageLength;
+
+      fcr = secondPage;
     }
   } else {  // for v5 databases
     uint16_t versionCode = fcr[6] << 16 | fcr[7];
@@ -179,9 +150,7 @@ BtrieveDatabase::FCRDATA BtrieveDatabase::validateDatabase(
                            "Key count and KAT key count differ!");
   }
 
-  fseek_s(f, 0, SEEK_END);
-
-  fileLength = ftell(f);
+  fileLength = source.getLength();
 
   pageCount = toUint16(fcr + 0x26) << 16 | toUint16(fcr + 0x28);
 
@@ -202,17 +171,17 @@ BtrieveDatabase::FCRDATA BtrieveDatabase::validateDatabase(
   return fcrData;
 }
 
-bool BtrieveDatabase::isUnusedRecord(std::basic_string_view<uint8_t> data) {
-  if (v6) {
+template <bool V6>
+bool BtrieveDatabase::isUnusedRecord(
+    std::basic_string_view<uint8_t> data) const {
+  if constexpr (V6) {
     if (data.size() < 2) {  // will probably never happen, but yolo
       return true;
     }
     // first two bytes are usage count, which will be non-zero if used
     uint16_t usageCount = data[0] << 8 | data[1];
     return usageCount == 0;
-  } else if (data.size() >= 4 &&
-             data.substr(4).find_first_not_of(static_cast<uint8_t>(0)) ==
-                 std::string_view::npos) {
+  } else if (data.size() >= 4 && isAllBytesEqual(data.substr(4), 0)) {
     // additional validation, to ensure the record pointer is valid
     uint32_t offset = getRecordPointer(data);
     // sanity check to ensure the data is valid
@@ -224,91 +193,293 @@ bool BtrieveDatabase::isUnusedRecord(std::basic_string_view<uint8_t> data) {
   return false;
 }
 
-void BtrieveDatabase::loadRecords(
-    FILE* f,
-    std::function<LoadRecordResult(const std::basic_string_view<uint8_t>)>
-        onRecordLoaded) {
-  unsigned int recordsLoaded = 0;
-  uint8_t* const data = reinterpret_cast<uint8_t*>(alloca(pageLength));
-  const unsigned int recordsInPage = ((pageLength - 6) / physicalRecordLength);
-  unsigned int pageOffset = v6 ? pageLength : 0;
-
-  fseek_s(f, pageLength, SEEK_SET);
-  // Starting at 1, since the first page is the header
-  for (unsigned int i = v6 ? 1 : 0; i < pageCount;
-       i++, pageOffset += pageLength) {
-    // For v6, skip pages that are not active data pages ('D') or variable
-    // data pages ('V') according to the PAT. Shadow copies and index/alloc
-    // pages have type 0x00, 0x80, 'A', etc. and must not be imported.
-    // lookupPATEntry() returns both the PAT type byte and the physical offset
-    // in a single PAT read, avoiding the double-read that would occur if
-    // logicalPagePATType() and logicalPageToPhysicalOffset() were called
-    // separately.
-    uint8_t patType = 'D';
-    int32_t physicalOffset = lookupPATEntry(f, i, patType);
-    if (v6 && patType != 'D' && patType != 'V') {
-      continue;
-    }
-    if (physicalOffset < 0) {
-      continue;
-    }
+const uint8_t* BtrieveDatabase::getDataPage(const PageSource& source,
+                                            unsigned int logicalPage) const {
+  // For v6, skip pages that are not active data pages ('D') or variable
+  // data pages ('V') according to the PAT. Shadow copies and index/alloc
+  // pages have type 0x00, 0x80, 'A', etc. and must not be imported.
+  // lookupPATEntry() returns both the PAT type byte and the physical offset
+  // from the resident page map built by loadPAT.
+  uint8_t patType = 'D';
+  int64_t physicalOffset = lookupPATEntry(logicalPage, patType);
+  if (v6 && patType != 'D' && patType != 'V') {
+    return nullptr;
+  }
+  if (physicalOffset < 0) {
+    return nullptr;
+  }
 
-    // read in the entire page
-    fseek_s(f, physicalOffset, SEEK_SET);
-    fread_s(data, pageLength, f);
-    // Verify Data Page, high bit set on byte 5 (usage count)
-    if ((data[0x5] & 0x80) == 0) {
-      continue;
+  // view the entire page
+  const uint8_t* const data = source.read(physicalOffset, pageLength).data();
+  // Verify Data Page, high bit set on byte 5 (usage count)
+  if ((data[0x5] & 0x80) == 0) {
+    return nullptr;
+  }
+
+  return data;
+}
+
+template <bool V6, RecordType TYPE>
+bool BtrieveDatabase::nextRecordInPageAs(
+    const PageSource& source, unsigned int logicalPage, const uint8_t* data,
+    unsigned int& slot, std::vector<uint8_t>& scratch,
+    FragmentPageTracker& fragmentPages,
+    std::basic_string_view<uint8_t>& record) const {
+  constexpr bool VARIABLE = TYPE == RecordType::Variable ||
+                            TYPE == RecordType::VariableTruncated;
+  // v6 records are prefixed by a 2 byte usage count
+  constexpr unsigned int USAGE_COUNT_LENGTH = V6 ? 2 : 0;
+  const unsigned int recordsInPage = getRecordsInPage();
+
+  for (; slot < recordsInPage; ++slot) {
+    // Marked for deletion? Skip. Only v5 has a deleted record chain.
+    if constexpr (!V6) {
+      if (isDeletedRecordSlot(logicalPage, slot)) {
+        continue;
+      }
     }
 
     // page data starts 6 bytes in
-    unsigned int recordOffset = 6;
-    for (unsigned int j = 0; j < recordsInPage;
-         j++, recordOffset += physicalRecordLength) {
-      // Marked for deletion? Skip
-      if (deletedRecordOffsets.count(pageOffset + recordOffset) > 0) {
+    const uint8_t* recordData = data + 6 + slot * physicalRecordLength;
+
+    if (isUnusedRecord<V6>(
+            std::basic_string_view<uint8_t>(recordData, recordLength))) {
+      // v5: unused records only appear at end-of-page (packed sequential),
+      // so the page is done. v6: deleted records leave holes anywhere on
+      // the page; live records can follow a deleted slot, so keep going.
+      if constexpr (V6) {
         continue;
+      } else {
+        slot = recordsInPage;
+        return false;
       }
+    }
 
-      std::basic_string_view<uint8_t> record =
-          std::basic_string_view<uint8_t>(data + recordOffset, recordLength);
-      if (isUnusedRecord(record)) {
-        // v5: unused records only appear at end-of-page (packed sequential),
-        // so break is correct. v6: deleted records leave holes anywhere on
-        // the page; live records can follow a deleted slot, so use continue.
-        if (v6) {
-          continue;
-        }
-        break;
-      }
+    record = std::basic_string_view<uint8_t>(recordData + USAGE_COUNT_LENGTH,
+                                             recordLength);
 
-      if (v6) {
-        record = std::basic_string_view<uint8_t>(data + recordOffset + 2,
-                                                 recordLength);
-      }
+    if constexpr (VARIABLE) {
+      std::basic_string_view<uint8_t> physicalRecord =
+          std::basic_string_view<uint8_t>(
+              recordData + USAGE_COUNT_LENGTH,
+              physicalRecordLength - USAGE_COUNT_LENGTH);
 
-      LoadRecordResult loadRecordResult;
+      scratch.assign(record.begin(), record.end());
 
-      if (isVariableLengthRecords()) {
-        std::basic_string_view<uint8_t> physicalRecord =
-            std::basic_string_view<uint8_t>(
-                data + recordOffset + (v6 ? 2 : 0),
-                physicalRecordLength - (v6 ? 2 : 0));
+      getVariableLengthData<V6, TYPE == RecordType::VariableTruncated>(
+          source, physicalRecord, scratch, fragmentPages);
 
-        std::vector<uint8_t> stream(record.size());
-        memcpy(stream.data(), record.data(), record.size());
+      record = std::basic_string_view<uint8_t>(scratch.data(), scratch.size());
+    }
 
-        getVariableLengthData(f, physicalRecord, stream);
+    ++slot;
+    return true;
+  }
 
-        loadRecordResult = onRecordLoaded(
-            std::basic_string_view<uint8_t>(stream.data(), stream.size()));
-      } else {
-        loadRecordResult = onRecordLoaded(record);
+  return false;
+}
+
+BtrieveError BtrieveDatabase::open(const wchar_t* fileName) {
+  std::unique_ptr<PageSource> pageSource = PageSource::open(fileName);
+  if (!pageSource) {
+    fprintf(stderr, "Couldn't open %s: %d\n", toStdString(fileName).c_str(),
+            errno);
+    return BtrieveError::FileNotFound;
+  }
+
+  source = std::move(pageSource);
+  fingerprint.clear();
+
+  from(*source, /* metadataOnly= */ false);
+
+  return BtrieveError::Success;
+}
+
+// Returns the part of a fingerprint that doesn't need the file to be hashed:
+// its length and the usage counts in the first two pages, which v6 bumps in
+// the active FCR on every write. Terminated by a colon.
+static std::string getFingerprintPrefix(const PageSource& source) {
+  const uint64_t length = source.getLength();
+  uint32_t usageCount1 = 0;
+  uint32_t usageCount2 = 0;
+  if (length >= 10) {
+    usageCount1 = toUint32(source.read(4, 4).data());
+    const uint16_t pageLength = toUint16(source.read(8, 2).data());
+    if (pageLength > 0 && length >= pageLength + 8u) {
+      usageCount2 = toUint32(source.read(pageLength + 4, 4).data());
+    }
+  }
+
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "%llu:%08x:%08x:",
+           static_cast<unsigned long long>(length), usageCount1, usageCount2);
+  return prefix;
+}
+
+// Hashes every byte of source a word at a time rather than a byte at a time so
+// it keeps up with reading the file.
+static uint64_t hashContents(const PageSource& source) {
+  static const size_t CHUNK_LENGTH = 1 << 20;
+
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (uint64_t offset = 0; offset < source.getLength();) {
+    const size_t chunkLength = static_cast<size_t>(
+        std::min<uint64_t>(CHUNK_LENGTH, source.getLength() - offset));
+    const auto chunk = source.read(offset, chunkLength);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= chunk.size(); i += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, chunk.data() + i, sizeof(word));
+      hash = hashWord(hash, word);
+    }
+    for (; i < chunk.size(); ++i) {
+      hash = hashWord(hash, chunk[i]);
+    }
+    offset += chunk.size();
+  }
+  return hash;
+}
+
+static std::string getFingerprint(const PageSource& source,
+                                  const std::string& prefix) {
+  char hash[32];
+  snprintf(hash, sizeof(hash), "%016llx",
+           static_cast<unsigned long long>(hashContents(source)));
+  return prefix + hash;
+}
+
+const std::string& BtrieveDatabase::getFingerprint() const {
+  if (source && fingerprint.empty()) {
+    fingerprint =
+        btrieve::getFingerprint(*source, getFingerprintPrefix(*source));
+  }
+  return fingerprint;
+}
+
+std::string BtrieveDatabase::computeFingerprint(const wchar_t* fileName,
+                                                const std::string& previous) {
+  std::unique_ptr<PageSource> source = PageSource::open(fileName);
+  if (!source) {
+    return std::string();
+  }
+
+  std::string prefix = getFingerprintPrefix(*source);
+  if (!previous.empty() && previous.compare(0, prefix.size(), prefix) != 0) {
+    return prefix;
+  }
+  return btrieve::getFingerprint(*source, prefix);
+}
+
+BtrieveError BtrieveDatabase::probe(const wchar_t* fileName) {
+  source.reset();
+
+  std::unique_ptr<PageSource> pageSource = PageSource::open(fileName);
+  if (!pageSource) {
+    fprintf(stderr, "Couldn't open %s: %d\n", toStdString(fileName).c_str(),
+            errno);
+    return BtrieveError::FileNotFound;
+  }
+
+  from(*pageSource, /* metadataOnly= */ true);
+
+  return BtrieveError::Success;
+}
+
+RecordCursor BtrieveDatabase::openCursor(unsigned int firstPage) const {
+  if (!source) {
+    throw BtrieveException(BtrieveError::FileNotOpen,
+                           "Can't read records before opening the database");
+  }
+
+  unsigned int threads = decodeThreads;
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  return RecordCursor(*this, source, std::max(firstPage, v6 ? 1u : 0u),
+                      pageCount, threads, readAhead);
+}
+
+// Folds record into checksum, see getPageChecksum.
+static uint64_t addToPageChecksum(uint64_t checksum,
+                                  std::basic_string_view<uint8_t> record) {
+  checksum = fnv1a(checksum, record.size());
+  return fnv1a(checksum, record.data(), record.size());
+}
+
+uint64_t BtrieveDatabase::getPageChecksum(
+    std::span<const std::basic_string_view<uint8_t>> records) {
+  uint64_t checksum = FNV_OFFSET_BASIS;
+  for (const auto& record : records) {
+    checksum = addToPageChecksum(checksum, record);
+  }
+  return checksum;
+}
+
+BtrieveDatabase::PageSummary BtrieveDatabase::summarizePage(
+    unsigned int logicalPage) const {
+  // the cursor only stops on data pages, which always have an offset. The
+  // data page flag aside, the usage count is bumped on every write.
+  return {logicalPage,
+          static_cast<uint64_t>(logicalPageToPhysicalOffset(logicalPage)),
+          static_cast<uint16_t>(
+              toUint16(getDataPage(*source, logicalPage) + 4) & 0x7FFF),
+          0, FNV_OFFSET_BASIS};
+}
+
+void BtrieveDatabase::readRecordBatches(
+    std::function<void(std::span<const std::basic_string_view<uint8_t>>,
+                       std::span<LoadRecordResult>)>
+        onRecordsLoaded,
+    size_t maxBatchSize, ConversionStats* stats,
+    std::vector<PageSummary>* pages) const {
+  std::vector<std::basic_string_view<uint8_t>> batch;
+  std::vector<LoadRecordResult> results;
+  // Variable length records are reassembled in the cursor's scratch buffer,
+  // so they're copied out to survive the next advance. batch is pointed at
+  // them once the batch is complete, since storage may move while it grows.
+  const bool variableLength = isVariableLengthRecords();
+  std::vector<uint8_t> storage;
+  std::vector<size_t> storageOffsets;
+  unsigned int recordsLoaded = 0;
+  // when the time spent reading since the last batch was delivered started
+  auto readStart = std::chrono::steady_clock::now();
+
+  maxBatchSize = std::max(maxBatchSize, static_cast<size_t>(1));
+  batch.reserve(maxBatchSize);
+
+  // Delivers the pending batch, returning false if enumeration was cancelled.
+  const auto flush = [&]() {
+    if (batch.empty()) {
+      return true;
+    }
+
+    if (variableLength) {
+      for (size_t i = 0; i < batch.size(); ++i) {
+        batch[i] = std::basic_string_view<uint8_t>(
+            storage.data() + storageOffsets[i], batch[i].size());
       }
+    }
+
+    results.assign(batch.size(), LoadRecordResult::SKIP_COUNT);
+    if (stats != nullptr) {
+      const auto now = std::chrono::steady_clock::now();
+      stats->readTime += now - readStart;
+      stats->recordsRead += batch.size();
+      onRecordsLoaded(batch, results);
+      readStart = std::chrono::steady_clock::now();
+    } else {
+      onRecordsLoaded(batch, results);
+    }
 
-      switch (loadRecordResult) {
+    batch.clear();
+    storage.clear();
+    storageOffsets.clear();
+
+    for (auto result : results) {
+      switch (result) {
         case LoadRecordResult::CANCEL_ENUMERATION:
-          return;
+          return false;
         case LoadRecordResult::COUNT:
           ++recordsLoaded;
           break;
@@ -317,16 +488,143 @@ void BtrieveDatabase::loadRecords(
           break;
       }
     }
+    return true;
+  };
+
+  RecordCursor cursor = openCursor();
+  // Delivers every record, returning whether the file ran out of pages before
+  // recordCount of them were counted.
+  const auto readBatches = [&]() {
+    while (cursor.nextPage()) {
+      PageSummary page;
+      if (pages != nullptr) {
+        page = summarizePage(cursor.getLogicalPage());
+      }
 
-    if (recordsLoaded == recordCount) {
-      goto finished_loaded;
+      while (cursor.nextInPage()) {
+        std::basic_string_view<uint8_t> record = cursor.getRecord();
+        if (variableLength) {
+          storageOffsets.push_back(storage.size());
+          storage.insert(storage.end(), record.begin(), record.end());
+        }
+        batch.push_back(record);
+        if (pages != nullptr) {
+          ++page.records;
+          page.checksum = addToPageChecksum(page.checksum, record);
+        }
+
+        if (batch.size() >= maxBatchSize && !flush()) {
+          return false;
+        }
+      }
+
+      if (pages != nullptr && page.records > 0) {
+        pages->push_back(page);
+      }
+
+      // Like readRecords, stop at the end of the page that brings the count
+      // to recordCount. Batches span pages, so only deliver early when the
+      // pending records could get there.
+      if (recordsLoaded + batch.size() >= recordCount) {
+        if (!flush()) {
+          return false;
+        }
+
+        if (recordsLoaded == recordCount) {
+          return false;
+        }
+      }
     }
+
+    return flush();
+  };
+
+  const bool missingRecords = readBatches();
+
+  if (stats != nullptr) {
+    stats->readTime += std::chrono::steady_clock::now() - readStart;
+    stats->pagesRead += cursor.getPagesRead();
+    stats->fragmentPagesRead += cursor.getFragmentPagesRead();
+    stats->fragmentPageVisits += cursor.getFragmentPageVisits();
+    stats->bytesRead +=
+        (cursor.getPagesRead() + cursor.getFragmentPagesRead()) * pageLength;
   }
 
-finished_loaded:
-  if (recordsLoaded != recordCount) {
-    fprintf(stderr, "Database contains %d records but read %d!\n", recordCount,
-            recordsLoaded);
+  if (missingRecords) {
+    fprintf(stderr, "Database contains %d records but read %d!\n",
+            recordCount, recordsLoaded);
+  }
+}
+
+void BtrieveDatabase::readPages(
+    std::function<void(unsigned int, uint64_t, uint16_t,
+                       std::span<const std::basic_string_view<uint8_t>>,
+                       std::span<LoadRecordResult>)>
+        onPageLoaded,
+    std::function<std::optional<unsigned int>(unsigned int, uint64_t,
+                                              uint16_t)>
+        skipPage) const {
+  std::vector<std::basic_string_view<uint8_t>> records;
+  std::vector<LoadRecordResult> results;
+  // variable length records are copied out like in readRecordBatches
+  const bool variableLength = isVariableLengthRecords();
+  std::vector<uint8_t> storage;
+  std::vector<size_t> storageOffsets;
+  unsigned int recordsLoaded = 0;
+
+  RecordCursor cursor = openCursor();
+  while (cursor.nextPage()) {
+    const PageSummary page = summarizePage(cursor.getLogicalPage());
+
+    std::optional<unsigned int> skippedRecords;
+    if (skipPage) {
+      skippedRecords =
+          skipPage(page.logicalPage, page.physicalOffset, page.usageCount);
+    }
+
+    if (skippedRecords) {
+      recordsLoaded += *skippedRecords;
+    } else {
+      records.clear();
+      storage.clear();
+      storageOffsets.clear();
+
+      while (cursor.nextInPage()) {
+        std::basic_string_view<uint8_t> record = cursor.getRecord();
+        if (variableLength) {
+          storageOffsets.push_back(storage.size());
+          storage.insert(storage.end(), record.begin(), record.end());
+        }
+        records.push_back(record);
+      }
+
+      if (!records.empty()) {
+        if (variableLength) {
+          for (size_t i = 0; i < records.size(); ++i) {
+            records[i] = std::basic_string_view<uint8_t>(
+                storage.data() + storageOffsets[i], records[i].size());
+          }
+        }
+
+        results.assign(records.size(), LoadRecordResult::SKIP_COUNT);
+        onPageLoaded(page.logicalPage, page.physicalOffset, page.usageCount,
+                     records, results);
+        for (auto result : results) {
+          if (result == LoadRecordResult::CANCEL_ENUMERATION) {
+            return;
+          }
+          if (result == LoadRecordResult::COUNT) {
+            ++recordsLoaded;
+          }
+        }
+      }
+    }
+
+    // like readRecordBatches, stop at the end of the page that brings the
+    // count to recordCount
+    if (recordsLoaded == recordCount) {
+      return;
+    }
   }
 }
 
@@ -335,32 +633,68 @@ BtrieveError BtrieveDatabase::parseDatabase(
     std::function<LoadRecordResult(const std::basic_string_view<uint8_t>)>
         onRecordLoaded,
     std::function<void()> onRecordsComplete) {
-  FILE* f = fopen(toStdString(fileName).c_str(), "rb");
-  if (f == nullptr) {
-    fprintf(stderr, "Couldn't open %s: %d\n", toStdString(fileName).c_str(),
-            errno);
-    return BtrieveError::FileNotFound;
+  BtrieveError error = open(fileName);
+  if (error != BtrieveError::Success) {
+    return error;
   }
 
-  from(f);
-
   if (onMetadataLoaded() && getRecordCount() > 0) {
-    loadRecords(f, onRecordLoaded);
+    readRecords(onRecordLoaded);
   }
 
   onRecordsComplete();
 
-  fclose(f);
+  close();
+
   return BtrieveError::Success;
 }
 
-bool BtrieveDatabase::loadPAT(FILE* f, std::string& acsName,
-                              std::vector<char>& acs) {
-  uint8_t* pat1 = reinterpret_cast<uint8_t*>(alloca(pageLength * 2));
-  uint8_t* pat2 = pat1 + pageLength;  // pat2 is sequentially after pat1
+void BtrieveDatabase::loadDeletedRecords(const PageSource& source,
+                                         uint32_t first) {
+  if (physicalRecordLength == 0) {
+    return;
+  }
+
+  const unsigned int recordsInPage = getRecordsInPage();
+  // every entry of a well formed chain is a distinct record, so a longer chain
+  // has to loop back on itself somewhere
+  uint64_t remaining = fileLength / sizeof(uint32_t);
+
+  while (first != 0xFFFFFFFF && remaining-- > 0) {
+    const unsigned int page = first / pageLength;
+    const unsigned int pageOffset = first % pageLength;
+
+    // Only pointers to the start of a record slot can ever match a record, so
+    // the rest are followed but not recorded.
+    if (pageOffset >= 6 && (pageOffset - 6) % physicalRecordLength == 0 &&
+        (pageOffset - 6) / physicalRecordLength < recordsInPage) {
+      const uint64_t index = static_cast<uint64_t>(page) * recordsInPage +
+                             (pageOffset - 6) / physicalRecordLength;
+      const size_t word = static_cast<size_t>(index >> 6);
+      const uint64_t bit = 1ull << (index & 63);
+
+      if (word >= deletedRecordSlots.size()) {
+        deletedRecordSlots.resize(word + 1);
+      }
 
-  fseek_s(f, pageLength * 2, SEEK_SET);  // starts on third page
-  fread_s(pat1, pageLength * 2, f);
+      if (deletedRecordSlots[word] & bit) {
+        fprintf(stderr, "Deleted record chain loops back to %u, ignoring\n",
+                first);
+        return;
+      }
+
+      deletedRecordSlots[word] |= bit;
+    }
+
+    first = getRecordPointer(source, first);
+  }
+}
+
+bool BtrieveDatabase::loadPAT(const PageSource& source, std::string& acsName,
+                              std::vector<char>& acs) {
+  // starts on third page
+  const uint8_t* pat1 = source.read(pageLength * 2, pageLength * 2).data();
+  const uint8_t* pat2 = pat1 + pageLength;  // pat2 is sequentially after pat1
 
   if (pat1[0] != 'P' || pat1[1] != 'P') {
     throw BtrieveException(BtrieveError::NotBtrieveFile,
@@ -375,12 +709,12 @@ bool BtrieveDatabase::loadPAT(FILE* f, std::string& acsName,
   uint16_t usageCount1 = toUint16(pat1 + 4);
   uint16_t usageCount2 = toUint16(pat2 + 4);
   // scan page type code to find ACS/Index/etc pages
-  uint8_t* activePat = (usageCount1 > usageCount2) ? pat1 : pat2;
+  const uint8_t* activePat = (usageCount1 > usageCount2) ? pat1 : pat2;
 
   // enumerate all pages
   for (int i = 8; i < pageLength; i += 4) {
     uint8_t type = activePat[i + 1];
-    int pageNumber =
+    uint32_t pageNumber =
         activePat[i] << 16 | activePat[i + 2] | activePat[i + 3] << 8;
     // codes are 'A' for ACS, D for fixed-length data pages, E for extra pages
     // and V for variable length pages index have high bit set
@@ -389,7 +723,8 @@ bool BtrieveDatabase::loadPAT(FILE* f, std::string& acsName,
     }
 
     if (type == 'A') {
-      loadACSAtPhysicalOffset(f, acsName, acs, pageNumber * pageLength);
+      loadACSAtPhysicalOffset(source, acsName, acs,
+                              static_cast<uint64_t>(pageNumber) * pageLength);
     }
 
     if (type != 0 && type != 'A' && type != 'D' && type != 'E' && type != 'V') {
@@ -400,27 +735,127 @@ bool BtrieveDatabase::loadPAT(FILE* f, std::string& acsName,
   return true;
 }
 
-bool BtrieveDatabase::loadACS(FILE* f, std::string& acsName,
+// PAT entry layout: [pageNumHigh][typeCode][pageNumLow][pageNumMid]
+static inline int64_t decodePATEntry(const uint8_t* entry, uint16_t pageLength,
+                                     uint8_t& outType) {
+  int64_t physicalPage = (entry[0] << 16) | (entry[3] << 8) | entry[2];
+
+  outType = entry[1];
+  return physicalPage == 0xFFFFFFL ? -1 : physicalPage * pageLength;
+}
+
+bool BtrieveDatabase::readActivePAT(const PageSource& source, uint32_t patPage,
+                                    const uint8_t*& activePat) const {
+  const uint64_t physicalOffset = static_cast<uint64_t>(patPage) * pageLength;
+  if (physicalOffset + pageLength * 2 >= fileLength) {
+    return false;
+  }
+
+  // view two pages worth, for pat1 and pat2 sequentially stored
+  const uint8_t* pat1 = source.read(physicalOffset, pageLength * 2).data();
+  const uint8_t* pat2 = pat1 + pageLength;
+
+  // Reject only when neither copy has a valid header.
+  if ((pat1[0] != 'P' || pat1[1] != 'P') &&
+      (pat2[0] != 'P' || pat2[1] != 'P')) {
+    activePat = nullptr;
+    return true;
+  }
+
+  uint32_t usageCount1 = toUint32(pat1 + 4);
+  uint32_t usageCount2 = toUint32(pat2 + 4);
+  activePat = (usageCount1 > usageCount2) ? pat1 : pat2;
+  return true;
+}
+
+int64_t BtrieveDatabase::readPATEntry(const PageSource& source,
+                                      uint32_t logicalPage,
+                                      uint8_t& outType) const {
+  if (!v6) {
+    outType = 'D';
+    return static_cast<int64_t>(logicalPage) * pageLength;
+  }
+
+  // the first PAT holds one entry more than the rest, see buildPageMap
+  const uint32_t pagesPerPAT = (pageLength / 4u) - 2u;
+  const uint32_t pair = logicalPage == 0 ? 0 : (logicalPage - 1) / pagesPerPAT;
+  const uint32_t entryIndex = logicalPage - pair * pagesPerPAT;
+
+  const uint8_t* activePat;
+  if (logicalPage >= pageCount ||
+      !readActivePAT(source, 2 + pair * (pageLength / 4u), activePat) ||
+      activePat == nullptr) {
+    outType = 0xFF;
+    return -1;
+  }
+
+  return decodePATEntry(activePat + (entryIndex * 4) + 4, pageLength, outType);
+}
+
+void BtrieveDatabase::buildPageMap(const PageSource& source) {
+  const uint32_t pagesPerPAT = (pageLength / 4u) - 2u;
+
+  patPhysicalOffsets.clear();
+  patTypes.clear();
+
+  // Logical pages are laid out across PAT pairs, each pair holding pagesPerPAT
+  // entries and sitting pageLength / 4 pages after the previous pair. Walk them
+  // in order, resolving the active PAT of each pair only once.
+  uint32_t patPage = 2;
+  uint32_t entryIndex = 0;
+  const uint8_t* activePat = nullptr;
+  for (uint32_t logicalPage = 0; logicalPage < pageCount;
+       ++logicalPage, ++entryIndex) {
+    if (entryIndex > pagesPerPAT) {
+      entryIndex -= pagesPerPAT;
+      patPage += (pageLength / 4u);
+      activePat = nullptr;
+    }
+
+    if (activePat == nullptr) {
+      if (!readActivePAT(source, patPage, activePat)) {
+        // we overflowed, this and every later PAT is junk
+        break;
+      }
+
+      if (activePat == nullptr) {
+        patPhysicalOffsets.push_back(-1);
+        patTypes.push_back(0xFF);
+        continue;
+      }
+    }
+
+    uint8_t type;
+    patPhysicalOffsets.push_back(decodePATEntry(
+        activePat + (entryIndex * 4) + 4, pageLength, type));
+    patTypes.push_back(type);
+  }
+}
+
+bool BtrieveDatabase::loadACS(const PageSource& source, std::string& acsName,
                               std::vector<char>& acs, uint32_t logicalPage) {
-  int32_t physicalOffset = logicalPageToPhysicalOffset(f, logicalPage);
+  // without the page map, as when probing, go to the PAT itself
+  uint8_t unused;
+  int64_t physicalOffset = patPhysicalOffsets.empty()
+                               ? readPATEntry(source, logicalPage, unused)
+                               : logicalPageToPhysicalOffset(logicalPage);
   if (physicalOffset < 0) {
     throw BtrieveException(BtrieveError::InvalidACS,
                            "Can't map logical page %d to physical page",
                            logicalPage);
   }
 
-  return loadACSAtPhysicalOffset(f, acsName, acs, physicalOffset);
+  return loadACSAtPhysicalOffset(source, acsName, acs, physicalOffset);
 }
 
-bool BtrieveDatabase::loadACSAtPhysicalOffset(FILE* f, std::string& acsName,
+bool BtrieveDatabase::loadACSAtPhysicalOffset(const PageSource& source,
+                                              std::string& acsName,
                                               std::vector<char>& acs,
-                                              uint32_t physicalOffset) {
+                                              uint64_t physicalOffset) {
   static const uint8_t ACS_PAGE_HEADER[] = {0, 0, 1, 0, 0, 0, 0xAC};
 
-  char* acsPage = reinterpret_cast<char*>(alloca(pageLength));
-
-  fseek_s(f, physicalOffset, SEEK_SET);
-  fread_s(acsPage, pageLength, f);
+  const char* acsPage = reinterpret_cast<const char*>(
+      source.read(physicalOffset, pageLength).data());
 
   if (v6) {
     if (acsPage[1] != 'A' && acsPage[6] != 0xAC) {
@@ -455,13 +890,13 @@ bool BtrieveDatabase::loadACSAtPhysicalOffset(FILE* f, std::string& acsName,
   return true;
 }
 
-void BtrieveDatabase::loadKeyDefinitions(FILE* f, const uint8_t* firstPage,
+void BtrieveDatabase::loadKeyDefinitions(const PageSource& source,
                                          const FCRDATA& fcrData,
                                          const std::string& acsName,
                                          const std::vector<char>& acs) {
   const auto keyDefinitionLength = 0x1E;
 
-  uint8_t data[512];
+  const uint8_t* data;
   size_t totalKeys = keys.size();
   unsigned int currentKeyNumber = 0;
   std::vector<uint32_t> keyOffsets;
@@ -473,9 +908,10 @@ void BtrieveDatabase::loadKeyDefinitions(FILE* f, const uint8_t* firstPage,
   keyOffsets.resize(totalKeys + 1);
 
   if (v6) {
-    uint8_t* ptr = data;
-    fseek_s(f, fcrData.keyAttributeTableOffset, SEEK_SET);
-    fread_s(data, sizeof(uint16_t) * totalKeys, f);
+    const uint8_t* ptr =
+        source
+            .read(fcrData.keyAttributeTableOffset, sizeof(uint16_t) * totalKeys)
+            .data();
 
     for (size_t i = 0; i < totalKeys; ++i, ptr += 2) {
       keyOffsets[i] = ptr[0] | ptr[1] << 8;
@@ -491,8 +927,8 @@ void BtrieveDatabase::loadKeyDefinitions(FILE* f, const uint8_t* firstPage,
   uint32_t keyOffset = keyOffsets[currentKeyNumber];
 
   while (currentKeyNumber < totalKeys) {
-    fseek_s(f, keyOffset + fcrData.fcrOffset, SEEK_SET);
-    fread_s(data, keyDefinitionLength, f);
+    data = source.read(keyOffset + fcrData.fcrOffset, keyDefinitionLength)
+               .data();
 
     KeyDataType dataType;
 
@@ -506,7 +942,7 @@ void BtrieveDatabase::loadKeyDefinitions(FILE* f, const uint8_t* firstPage,
 
     if (attributes & MultipleACS) {
       uint32_t acsLogicalPage = data[0x19] << 16 | toUint16(data + 0x1A);
-      if (!loadACS(f, multiAcsName, multiAcs, acsLogicalPage)) {
+      if (!loadACS(source, multiAcsName, multiAcs, acsLogicalPage)) {
         throw BtrieveException(BtrieveError::InvalidACS, "Can't load ACS");
       }
 
@@ -547,28 +983,36 @@ void BtrieveDatabase::loadKeyDefinitions(FILE* f, const uint8_t* firstPage,
   }
 }
 
-void BtrieveDatabase::from(FILE* f) {
-  uint8_t firstPage[512];
+void BtrieveDatabase::from(const PageSource& source, bool metadataOnly) {
   std::string acsName;
   std::vector<char> acs;
 
-  fseek_s(f, 0, SEEK_END);
-  fileLength = ftell(f);
-  fseek_s(f, 0, SEEK_SET);
+  keys.clear();
+  deletedRecordSlots.clear();
+  patPhysicalOffsets.clear();
+  patTypes.clear();
+  fileLength = source.getLength();
 
-  fread_s(firstPage, sizeof(firstPage), f);
+  const uint8_t* firstPage = source.read(0, 512).data();
 
-  FCRDATA fcrData = validateDatabase(f, firstPage);
+  FCRDATA fcrData = validateDatabase(source, firstPage);
+  selectRecordScanner();
 
+  // the page map and deleted records only matter once records are read
   if (v6) {
-    loadPAT(f, acsName, acs);
+    loadPAT(source, acsName, acs);
+    if (!metadataOnly) {
+      buildPageMap(source);
+    }
   } else {
-    getRecordPointerList(f, fcrData.deletedRecordPointer, deletedRecordOffsets);
+    if (!metadataOnly) {
+      loadDeletedRecords(source, fcrData.deletedRecordPointer);
+    }
 
-    loadACS(f, acsName, acs, 1);  // acs always on first page
+    loadACS(source, acsName, acs, 1);  // acs always on first page
   }
 
-  loadKeyDefinitions(f, firstPage, fcrData, acsName, acs);
+  loadKeyDefinitions(source, fcrData, acsName, acs);
 }
 
 #pragma pack(push, 1)
@@ -586,18 +1030,18 @@ static inline int32_t getVRecordPage(VRECPTR* x) {
                               (x->mid << 8) | x->low);
 }
 
+template <bool V6, bool TRUNCATED>
 void BtrieveDatabase::getVariableLengthData(
-    FILE* f, std::basic_string_view<uint8_t> recordData,
-    std::vector<uint8_t>& stream) {
-  uint8_t* const data = reinterpret_cast<uint8_t*>(alloca(pageLength));
-  const unsigned int filePosition = ftell(f);
+    const PageSource& source, std::basic_string_view<uint8_t> recordData,
+    std::vector<uint8_t>& stream, FragmentPageTracker& fragmentPages) const {
   VRECPTR Vrec =
       *reinterpret_cast<const VRECPTR*>(recordData.data() + recordLength);
   const uint16_t truncatedBytes =
       toUint16(recordData.data() + recordLength + 2);
-  const uint16_t* fragpp = reinterpret_cast<uint16_t*>(data);
+  const uint8_t* data;
+  const uint16_t* fragpp;
   uint8_t fragmentNumber;
-  int32_t fragmentPhysicalOffset;
+  int64_t fragmentPhysicalOffset;
   int16_t fragmentIndex;
   int16_t fragmentOffset;
   int16_t fragmentLength;
@@ -608,14 +1052,15 @@ void BtrieveDatabase::getVariableLengthData(
       break;
     }
 
-    fragmentPhysicalOffset =
-        logicalPageToPhysicalOffset(f, getVRecordPage(&Vrec));
+    const int32_t fragmentPage = getVRecordPage(&Vrec);
+    fragmentPhysicalOffset = logicalPageToPhysicalOffset(fragmentPage);
     if (fragmentPhysicalOffset < 0) {
       break;
     }
 
-    fseek_s(f, fragmentPhysicalOffset, SEEK_SET);  // read page into buffer
-    fread_s(data, pageLength, f);
+    data = source.read(fragmentPhysicalOffset, pageLength).data();
+    fragmentPages.visit(fragmentPage);
+    fragpp = reinterpret_cast<const uint16_t*>(data);
 
     fragmentIndex = ((pageLength - 1) >> 1) - fragmentNumber;
     fragmentOffset = fragpp[fragmentIndex] & 0x7FFF;
@@ -632,8 +1077,19 @@ void BtrieveDatabase::getVariableLengthData(
     }
     fragmentLength = (fragpp[fragmentIndex - lofs] & 0x7FFF) - fragmentOffset;
 
-    if (v6 || fragpp[fragmentIndex] & 0x8000) {
-      Vrec = *reinterpret_cast<VRECPTR*>(data + fragmentOffset);
+    // the fragment is read straight out of the page, so a corrupt fragment
+    // table mustn't send it past the end
+    const bool hasNextPointer = V6 || fragpp[fragmentIndex] & 0x8000;
+    const int minimumLength =
+        hasNextPointer ? static_cast<int>(sizeof(VRECPTR)) : 0;
+    if (fragmentOffset < 0 || fragmentLength < minimumLength ||
+        fragmentOffset + fragmentLength > pageLength) {
+      throw BtrieveException(BtrieveError::NotBtrieveFile,
+                             "Variable-length fragment lies outside its page");
+    }
+
+    if (hasNextPointer) {
+      Vrec = *reinterpret_cast<const VRECPTR*>(data + fragmentOffset);
       fragmentOffset += sizeof(VRECPTR);
       fragmentLength -= sizeof(VRECPTR);
     } else {
@@ -644,25 +1100,22 @@ void BtrieveDatabase::getVariableLengthData(
                                                    fragmentLength));
   }
 
-  if (recordType == RecordType::VariableTruncated) {
+  if constexpr (TRUNCATED) {
     for (uint16_t i = 0; i < truncatedBytes; ++i) {
       stream.push_back(' ');
     }
   }
-
-  fseek_s(f, filePosition, SEEK_SET);
 }
 
-int32_t BtrieveDatabase::logicalPageToPhysicalOffset(FILE* f,
-                                                     int32_t logicalPage) {
+int64_t BtrieveDatabase::logicalPageToPhysicalOffset(
+    int32_t logicalPage) const {
   uint8_t unused;
-  return lookupPATEntry(f, logicalPage, unused);
+  return lookupPATEntry(logicalPage, unused);
 }
 
-// Reads the PAT once for the given logical page and returns both the physical
-// byte offset and the PAT type byte via outType.  Combining these avoids the
-// double PAT read that would occur if logicalPageToPhysicalOffset() and
-// logicalPagePATType() were called separately for the same page.
+// Returns both the physical byte offset and the PAT type byte via outType for
+// the given logical page. For v6 databases this is a lookup in the page map
+// built once by loadPAT, rather than a read of the PAT pages themselves.
 //
 // outType receives:
 //   'D' (0x44) — active data page
@@ -674,68 +1127,47 @@ int32_t BtrieveDatabase::logicalPageToPhysicalOffset(FILE* f,
 //   0xFF        — logical page out of range or PAT unreadable
 //
 // Returns: physical byte offset into the file, or -1 on failure.
-int32_t BtrieveDatabase::lookupPATEntry(FILE* f, int32_t logicalPage,
-                                        uint8_t& outType) {
+int64_t BtrieveDatabase::lookupPATEntry(int32_t logicalPage,
+                                        uint8_t& outType) const {
   if (!v6) {
     outType = 'D';
-    return logicalPage * pageLength;
+    return static_cast<int64_t>(logicalPage) * pageLength;
   }
 
-  // go through the PAT
-  uint32_t ret = 2;
-  const int32_t pagesPerPAT = (pageLength / 4u) - 2u;
-
-  // logical page can never be higher than max physical pages
-  if (static_cast<uint32_t>(logicalPage) >= pageCount) {
+  // logical page can never be higher than max physical pages, and pages past
+  // the end of the map live in PATs that don't fit in the file
+  if (logicalPage < 0 ||
+      static_cast<size_t>(logicalPage) >= patPhysicalOffsets.size()) {
     outType = 0xFF;
     return -1;
   }
 
-  // not on the current page? if so page up
-  while (logicalPage > pagesPerPAT) {
-    logicalPage -= pagesPerPAT;
-    ret += (pageLength / 4u);
-  }
-
-  uint8_t* pat1 = reinterpret_cast<uint8_t*>(alloca(pageLength * 2));
-  uint8_t* pat2 = pat1 + pageLength;
-
-  const uint32_t physicalOffset = ret * pageLength;
-  if (physicalOffset >= (fileLength - pageLength * 2)) {
-    // we overflowed, this is junk
-    outType = 0xFF;
-    return -1;
-  }
-
-  // read two pages worth, for pat1 and pat2 sequentially stored
-  fseek_s(f, physicalOffset, SEEK_SET);
-  fread_s(pat1, pageLength * 2, f);
-
-  // A valid PAT page starts with the two-byte sequence 'P', 'P'.
-  // Reject only when neither copy has a valid header — i.e. both are corrupt.
-  // Use || within each page's check so a single bad byte doesn't mask the
-  // other page's validity (matches the logic in loadPAT()).
-  if ((pat1[0] != 'P' || pat1[1] != 'P') &&
-      (pat2[0] != 'P' || pat2[1] != 'P')) {
-    outType = 0xFF;
-    return -1;
-  }
-
-  uint32_t usageCount1 = toUint32(pat1 + 4);
-  uint32_t usageCount2 = toUint32(pat2 + 4);
-  uint8_t* activePat = (usageCount1 > usageCount2) ? pat1 : pat2;
-
-  // PAT entry layout (4 bytes): [pageNumHigh][typeCode][pageNumLow][pageNumMid]
-  uint8_t* entry = activePat + (logicalPage * 4) + 4;
-  outType = entry[1];  // type byte is at position 1 in the 4-byte entry
-
-  int64_t physicalPage = (entry[0] << 16) | (entry[3] << 8) | entry[2];
+  outType = patTypes[logicalPage];
+  return patPhysicalOffsets[logicalPage];
+}
 
-  if (physicalPage == 0xFFFFFFL || physicalPage < 0) {
-    return -1;
+void BtrieveDatabase::selectRecordScanner() {
+  switch (recordType) {
+    case RecordType::Variable:
+      recordScanner =
+          v6 ? &BtrieveDatabase::nextRecordInPageAs<true, RecordType::Variable>
+             : &BtrieveDatabase::nextRecordInPageAs<false,
+                                                    RecordType::Variable>;
+      break;
+    case RecordType::VariableTruncated:
+      recordScanner =
+          v6 ? &BtrieveDatabase::nextRecordInPageAs<
+                   true, RecordType::VariableTruncated>
+             : &BtrieveDatabase::nextRecordInPageAs<
+                   false, RecordType::VariableTruncated>;
+      break;
+    default:
+      // everything else is read as fixed length records
+      recordScanner =
+          v6 ? &BtrieveDatabase::nextRecordInPageAs<true, RecordType::Fixed>
+             : &BtrieveDatabase::nextRecordInPageAs<false, RecordType::Fixed>;
+      break;
   }
-
-  return static_cast<int32_t>(physicalPage * pageLength);
 }
 
 }  // namespace btrieve
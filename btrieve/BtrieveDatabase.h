@@ -1,17 +1,26 @@
 #ifndef __RECORD_LOADER_H_
 #define __RECORD_LOADER_H_
 
+#include <cstdint>
+#include <cstdio>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
+#include "ConversionStats.h"
 #include "ErrorCode.h"
+#include "FragmentPageTracker.h"
 #include "Key.h"
+#include "RecordCursor.h"
 #include "Text.h"
 
 namespace btrieve {
 
+class PageSource;
+
 enum RecordType {
   Fixed = 0,
   Variable = 1,
@@ -26,19 +35,27 @@ class BtrieveDatabase {
   // Constructs an empty BtrieveDatabase.
   // Afterwards, call parseDatabase.
   BtrieveDatabase()
-      : deletedRecordOffsets(0),
-        pageLength(0),
+      : pageLength(0),
         pageCount(0),
         recordLength(0),
         physicalRecordLength(0),
         recordCount(0),
         fileLength(0),
         recordType(RecordType::Fixed),
-        v6(false) {}
+        v6(false),
+        recordScanner(nullptr),
+        decodeThreads(1),
+        readAhead(false) {
+    selectRecordScanner();
+  }
 
   BtrieveDatabase(const BtrieveDatabase &database)
-      : keys(database.keys),
-        deletedRecordOffsets(database.deletedRecordOffsets),
+      : source(database.source),
+        fingerprint(database.fingerprint),
+        keys(database.keys),
+        deletedRecordSlots(database.deletedRecordSlots),
+        patPhysicalOffsets(database.patPhysicalOffsets),
+        patTypes(database.patTypes),
         pageLength(database.pageLength),
         pageCount(database.pageCount),
         recordLength(database.recordLength),
@@ -46,11 +63,18 @@ class BtrieveDatabase {
         recordCount(database.recordCount),
         fileLength(database.fileLength),
         recordType(database.recordType),
-        v6(database.v6) {}
+        v6(database.v6),
+        recordScanner(database.recordScanner),
+        decodeThreads(database.decodeThreads),
+        readAhead(database.readAhead) {}
 
   BtrieveDatabase(BtrieveDatabase &&database)
-      : keys(std::move(database.keys)),
-        deletedRecordOffsets(std::move(database.deletedRecordOffsets)),
+      : source(std::move(database.source)),
+        fingerprint(std::move(database.fingerprint)),
+        keys(std::move(database.keys)),
+        deletedRecordSlots(std::move(database.deletedRecordSlots)),
+        patPhysicalOffsets(std::move(database.patPhysicalOffsets)),
+        patTypes(std::move(database.patTypes)),
         pageLength(database.pageLength),
         pageCount(database.pageCount),
         recordLength(database.recordLength),
@@ -58,12 +82,15 @@ class BtrieveDatabase {
         recordCount(database.recordCount),
         fileLength(database.fileLength),
         recordType(database.recordType),
-        v6(database.v6) {}
+        v6(database.v6),
+        recordScanner(database.recordScanner),
+        decodeThreads(database.decodeThreads),
+        readAhead(database.readAhead) {}
 
   BtrieveDatabase(const std::vector<Key> &keys_, uint16_t pageLength_,
                   unsigned int pageCount_, unsigned int recordLength_,
                   unsigned int physicalRecordLength_, unsigned int recordCount_,
-                  unsigned int fileLength_, RecordType recordType_, bool v6_,
+                  uint64_t fileLength_, RecordType recordType_, bool v6_,
                   uint16_t fcrKeyAttributeTableOffset_)
       : keys(keys_),
         pageLength(pageLength_),
@@ -73,7 +100,12 @@ class BtrieveDatabase {
         recordCount(recordCount_),
         fileLength(fileLength_),
         recordType(recordType_),
-        v6(v6_) {}
+        v6(v6_),
+        recordScanner(nullptr),
+        decodeThreads(1),
+        readAhead(false) {
+    selectRecordScanner();
+  }
 
   // Returns the set of keys contained in this Btrieve database.
   const std::vector<Key> &getKeys() const { return keys; }
@@ -92,6 +124,9 @@ class BtrieveDatabase {
   // Returns the total number of pages in this Btrieve database.
   unsigned int getPageCount() const { return pageCount; }
 
+  // Returns the length in bytes of the Btrieve database file.
+  uint64_t getFileLength() const { return fileLength; }
+
   // Returns the total number of records contained in this Btrieve database.
   unsigned int getRecordCount() const { return recordCount; }
 
@@ -101,12 +136,154 @@ class BtrieveDatabase {
            recordType == RecordType::VariableTruncated;
   }
 
+  // Returns whether the file is in the v6 format, rather than v5.
+  bool isV6() const { return v6; }
+
+  // Sets the number of threads used to decode data pages while loading
+  // records. 1, the default, decodes on the calling thread. 0 uses one thread
+  // per hardware core. Records are always delivered to onRecordLoaded on the
+  // calling thread, in physical page order.
+  void setDecodeThreads(unsigned int threads) { decodeThreads = threads; }
+
+  // Sets whether cursors prefetch upcoming data pages on a background thread,
+  // in PAT order, so reading the file overlaps with decoding its records.
+  // Worth it when the file isn't already in the OS page cache. Off by default.
+  void setReadAhead(bool readAhead_) { readAhead = readAhead_; }
+
+  // The default number of records handed over at a time by readRecordBatches.
+  static const size_t DEFAULT_RECORD_BATCH_SIZE = 256;
+
   enum LoadRecordResult {
     CANCEL_ENUMERATION,
     COUNT,
     SKIP_COUNT,
   };
 
+  // A data page read by readRecordBatches.
+  struct PageSummary {
+    unsigned int logicalPage;
+    // the offset in the file the page was read from
+    uint64_t physicalOffset;
+    // the usage count in the page's header, bumped on every write
+    uint16_t usageCount;
+    // the number of records read from the page
+    unsigned int records;
+    // getPageChecksum of those records
+    uint64_t checksum;
+  };
+
+  // Returns a checksum of records, the records of one data page, as 64-bit
+  // FNV-1a over each record's length and bytes.
+  static uint64_t getPageChecksum(
+      std::span<const std::basic_string_view<uint8_t>> records);
+
+  // Opens the Btrieve DAT database and reads its metadata, after which getter
+  // methods on this instance can be safely accessed and records can be read
+  // with openCursor or readRecords. The file stays open until close is called
+  // or another database is opened. Throws BtrieveException when a critical
+  // error is encountered.
+  BtrieveError open(const wchar_t *fileName);
+
+  // Reads only the metadata of the Btrieve DAT database: the FCR, the key
+  // definitions and the ACS pages they use. No data pages are touched, and
+  // neither the page map nor the deleted record chain is loaded, so this takes
+  // about as long regardless of the file's size. Afterwards getter methods can
+  // be accessed but records can't be read, and no file is kept open. Throws
+  // BtrieveException when the metadata is invalid.
+  BtrieveError probe(const wchar_t *fileName);
+
+  // Returns a fingerprint of the contents of the DAT database opened by open:
+  // its length, the usage counts of its FCR pages and a hash of every byte.
+  // Empty if no database is open. The file is only hashed on the first call
+  // after open, so calls mustn't be made from several threads at once.
+  const std::string &getFingerprint() const;
+
+  // Returns the fingerprint of the DAT file fileName, see getFingerprint, or
+  // an empty string if it can't be opened. If the file's length or usage
+  // counts already differ from those in previous, the file isn't hashed and
+  // only the part of the fingerprint holding them is returned, which is
+  // enough to tell it doesn't match previous.
+  static std::string computeFingerprint(const wchar_t *fileName,
+                                        const std::string &previous = "");
+
+  // Releases the DAT database opened by open. Cursors already opened keep
+  // their own reference to the file.
+  void close() {
+    source.reset();
+    fingerprint.clear();
+  }
+
+  // Returns a cursor over every record in the database opened by open, in
+  // physical order, starting with the records of logical page firstPage.
+  // Throws BtrieveException if no database is open.
+  RecordCursor openCursor(unsigned int firstPage = 0) const;
+
+  // Reads every record of the database opened by open and calls
+  // onRecordLoaded with each, stopping as parseDatabase does. onRecordLoaded
+  // can be any callable taking a std::basic_string_view<uint8_t> and returning
+  // a LoadRecordResult.
+  template <typename OnRecordLoaded>
+  void readRecords(OnRecordLoaded &&onRecordLoaded) const {
+    unsigned int recordsLoaded = 0;
+    RecordCursor cursor = openCursor();
+
+    while (cursor.nextPage()) {
+      while (cursor.nextInPage()) {
+        switch (onRecordLoaded(cursor.getRecord())) {
+          case LoadRecordResult::CANCEL_ENUMERATION:
+            return;
+          case LoadRecordResult::COUNT:
+            ++recordsLoaded;
+            break;
+          case LoadRecordResult::SKIP_COUNT:
+          default:
+            break;
+        }
+      }
+
+      if (recordsLoaded == recordCount) {
+        return;
+      }
+    }
+
+    fprintf(stderr, "Database contains %d records but read %d!\n", recordCount,
+            recordsLoaded);
+  }
+
+  // Like readRecords, but hands records to onRecordsLoaded in batches of up to
+  // maxBatchSize consecutive records. onRecordsLoaded stores the result for
+  // each record in the matching entry of results, which start out as
+  // SKIP_COUNT, and records after the first CANCEL_ENUMERATION are ignored.
+  // The records are only valid until onRecordsLoaded returns. If stats is
+  // set, the time spent reading records outside of onRecordsLoaded and the
+  // pages and records read are added to it. If pages is set, every data page
+  // whose records were all read is summarized in it, in the order read,
+  // skipping pages without records.
+  void readRecordBatches(
+      std::function<void(std::span<const std::basic_string_view<uint8_t>>,
+                         std::span<LoadRecordResult>)>
+          onRecordsLoaded,
+      size_t maxBatchSize = DEFAULT_RECORD_BATCH_SIZE,
+      ConversionStats *stats = nullptr,
+      std::vector<PageSummary> *pages = nullptr) const;
+
+  // Like readRecordBatches, but hands onPageLoaded the records of one data
+  // page at a time along with its logical page number, the offset in the file
+  // it was read from and the usage count in its header, skipping pages
+  // without records. Stops at the same page readRecordBatches would given the
+  // same results. If skipPage is set, it's first called with each page's
+  // logical page number, offset and usage count, and when it returns a number
+  // of records, the page is counted as holding that many without being read.
+  // The records are only valid until onPageLoaded returns.
+  void readPages(
+      std::function<void(unsigned int, uint64_t, uint16_t,
+                         std::span<const std::basic_string_view<uint8_t>>,
+                         std::span<LoadRecordResult>)>
+          onPageLoaded,
+      std::function<std::optional<unsigned int>(unsigned int, uint64_t,
+                                                uint16_t)>
+          skipPage = nullptr) const;
+
   // Reads and parses the entire Btrieve DAT database.
   // Calls onMetadataLoaded when the header is read and getter methods on this
   // instance can be safely accessed. Return false to prevent reading any
@@ -120,67 +297,155 @@ class BtrieveDatabase {
       std::function<void()> onRecordsComplete = []() {});
 
  private:
+  friend class RecordCursor;
+
   typedef struct _tagFCRDATA {
     uint16_t fcrOffset;
     uint32_t keyAttributeTableOffset;
     uint32_t deletedRecordPointer;
   } FCRDATA;
 
-  // Reads and validates the metadata from the Btrieve database identified by f.
-  void from(FILE *f);
+  // Reads and validates the metadata from the Btrieve database held by source.
+  // Unless metadataOnly, also loads what's needed to read its records.
+  void from(const PageSource &source, bool metadataOnly);
 
   // Validates the Btrieve database header to ensure values are
   // expected/consistent.
-  FCRDATA validateDatabase(FILE *f, const uint8_t *firstPage);
+  FCRDATA validateDatabase(const PageSource &source, const uint8_t *firstPage);
+
+  // Walks the v5 deleted record chain starting at first and marks every slot
+  // on it in deletedRecordSlots.
+  void loadDeletedRecords(const PageSource &source, uint32_t first);
+
+  // Returns whether slot on logicalPage is on the deleted record chain.
+  bool isDeletedRecordSlot(unsigned int logicalPage, unsigned int slot) const {
+    const uint64_t index =
+        static_cast<uint64_t>(logicalPage) * getRecordsInPage() + slot;
+    return (index >> 6) < deletedRecordSlots.size() &&
+           (deletedRecordSlots[index >> 6] & (1ull << (index & 63))) != 0;
+  }
+
+  // Loads the first PAT and validates each of its entries, loading the ACS
+  // from the page it lists.
+  bool loadPAT(const PageSource &source, std::string &acsName,
+               std::vector<char> &acs);
+
+  // Walks every PAT page pair once and fills patPhysicalOffsets/patTypes, the
+  // resident logical->physical page map used by lookupPATEntry.
+  void buildPageMap(const PageSource &source);
+
+  // Finds the active copy of the PAT pair on physical page patPage. Returns
+  // false if the pair doesn't fit in the file, otherwise sets activePat to the
+  // active copy, or nullptr if neither copy has a valid header.
+  bool readActivePAT(const PageSource &source, uint32_t patPage,
+                     const uint8_t *&activePat) const;
 
-  // Loads the PAT and validates each page
-  bool loadPAT(FILE *f, std::string &acsName, std::vector<char> &acs);
+  // Like lookupPATEntry, but reads the entry from the PAT in source instead of
+  // the page map, for when the map isn't built.
+  int64_t readPATEntry(const PageSource &source, uint32_t logicalPage,
+                       uint8_t &outType) const;
 
   // Loads the ACS, if present, into acs, which is expected to be at least 256
   // bytes in size. If no ACS, acsName and acs are emptied.
-  bool loadACS(FILE *f, std::string &acsName, std::vector<char> &acs,
-               uint32_t logicalPage);
+  bool loadACS(const PageSource &source, std::string &acsName,
+               std::vector<char> &acs, uint32_t logicalPage);
 
   // Loads the ACS, if present, into acs, which is expected to be at least 256
   // bytes in size. If no ACS, acsName and acs are emptied.
-  bool loadACSAtPhysicalOffset(FILE *f, std::string &acsName,
-                               std::vector<char> &acs, uint32_t physicalOffset);
+  bool loadACSAtPhysicalOffset(const PageSource &source, std::string &acsName,
+                               std::vector<char> &acs, uint64_t physicalOffset);
 
   // Loads the key definitions into the keys member variables, given the acs
   // loaded previously from loadACS. acsName and acs could both be empty.
-  void loadKeyDefinitions(FILE *f, const uint8_t *firstPage,
-                          const FCRDATA &fcrData, const std::string &acsName,
+  void loadKeyDefinitions(const PageSource &source, const FCRDATA &fcrData,
+                          const std::string &acsName,
                           const std::vector<char> &acs);
 
-  // Enumerates all records and calls onRecordLoaded for each one.
-  void loadRecords(
-      FILE *f,
-      std::function<LoadRecordResult(const std::basic_string_view<uint8_t>)>
-          onRecordLoaded);
+  // Returns the number of record slots in each data page.
+  unsigned int getRecordsInPage() const {
+    return (pageLength - 6) / physicalRecordLength;
+  }
+
+  // Returns the contents of logicalPage if it's a data page that can hold
+  // records, otherwise nullptr.
+  const uint8_t *getDataPage(const PageSource &source,
+                             unsigned int logicalPage) const;
+
+  // Finds the first record at or after record slot number slot of the data
+  // page returned by getDataPage, and sets record to its data and slot to the
+  // slot following it. Returns false if there are no more records on the page.
+  // Variable length records are reassembled into scratch, so record is only
+  // valid until scratch is reused, and the fragment pages they visit are
+  // noted in fragmentPages. Safe to call from multiple threads as long as each
+  // uses its own scratch and fragmentPages.
+  bool nextRecordInPage(const PageSource &source, unsigned int logicalPage,
+                        const uint8_t *data, unsigned int &slot,
+                        std::vector<uint8_t> &scratch,
+                        FragmentPageTracker &fragmentPages,
+                        std::basic_string_view<uint8_t> &record) const {
+    return (this->*recordScanner)(source, logicalPage, data, slot, scratch,
+                                  fragmentPages, record);
+  }
+
+  // nextRecordInPage specialized for a file version and record type, so the
+  // per record checks for either compile away.
+  template <bool V6, RecordType TYPE>
+  bool nextRecordInPageAs(const PageSource &source, unsigned int logicalPage,
+                          const uint8_t *data, unsigned int &slot,
+                          std::vector<uint8_t> &scratch,
+                          FragmentPageTracker &fragmentPages,
+                          std::basic_string_view<uint8_t> &record) const;
+
+  typedef bool (BtrieveDatabase::*RecordScanner)(
+      const PageSource &source, unsigned int logicalPage, const uint8_t *data,
+      unsigned int &slot, std::vector<uint8_t> &scratch,
+      FragmentPageTracker &fragmentPages,
+      std::basic_string_view<uint8_t> &record) const;
+
+  // Picks the nextRecordInPageAs specialization matching v6 and recordType.
+  void selectRecordScanner();
 
   // Determines whether the data contained in fixedRecordData is unused.
   // Unused records have a 4-byte record pointer pointing to the next available
   // record, and the rest of the bytes are all 0.
-  bool isUnusedRecord(std::basic_string_view<uint8_t> fixedRecordData);
+  template <bool V6>
+  bool isUnusedRecord(std::basic_string_view<uint8_t> fixedRecordData) const;
 
   // Reads the entirety of a variable length record from the initial recordData
-  // (up to physicalRecordLength). Stores all the data inside stream.
-  void getVariableLengthData(FILE *f,
+  // (up to physicalRecordLength). Stores all the data inside stream. Notes
+  // each fragment page visited in fragmentPages.
+  template <bool V6, bool TRUNCATED>
+  void getVariableLengthData(const PageSource &source,
                              std::basic_string_view<uint8_t> recordData,
-                             std::vector<uint8_t> &stream);
-
-  int32_t logicalPageToPhysicalOffset(FILE *f, int32_t logicalPage);
-  // Reads the PAT once for the given logical page and returns both the physical
-  // byte offset and the PAT type byte via outType, avoiding the double PAT read
-  // that would occur if logicalPageToPhysicalOffset() and a separate type
-  // lookup were called for the same page.
-  int32_t lookupPATEntry(FILE *f, int32_t logicalPage, uint8_t &outType);
+                             std::vector<uint8_t> &stream,
+                             FragmentPageTracker &fragmentPages) const;
+
+  int64_t logicalPageToPhysicalOffset(int32_t logicalPage) const;
+  // Returns the summary of data page logicalPage before any of its records
+  // are read.
+  PageSummary summarizePage(unsigned int logicalPage) const;
+  // Returns both the physical byte offset and the PAT type byte via outType for
+  // the given logical page, from the page map built by loadPAT.
+  int64_t lookupPATEntry(int32_t logicalPage, uint8_t &outType) const;
+
+  // The DAT file opened by open, or nullptr.
+  std::shared_ptr<const PageSource> source;
+  // source's fingerprint once getFingerprint has computed it, otherwise empty.
+  mutable std::string fingerprint;
 
   // The list of keys defined in the Btrieve database.
   std::vector<Key> keys;
-  // The list of deleted record pointers inside the Btrieve database.
-  // Data that exists on these record pointers will be skipped.
-  std::unordered_set<uint32_t> deletedRecordOffsets;
+  // v5 only. A bitmap of the record slots on the deleted record chain, indexed
+  // by logicalPage * getRecordsInPage() + slot. Records in these slots will be
+  // skipped. Only as long as needed to hold the highest deleted slot.
+  std::vector<uint64_t> deletedRecordSlots;
+  // v6 only. Physical byte offset of each logical page, or -1 if unmapped,
+  // indexed by logical page. Logical pages past the end are unmapped. PAT
+  // entries hold 24-bit page numbers, so offsets can go well past 4 GB.
+  std::vector<int64_t> patPhysicalOffsets;
+  // v6 only. PAT type byte of each logical page, parallel to
+  // patPhysicalOffsets.
+  std::vector<uint8_t> patTypes;
 
   // The page length of the Btrieve database. Will be a multiple of 512.
   uint16_t pageLength;
@@ -197,13 +462,22 @@ class BtrieveDatabase {
   unsigned int recordCount;
 
   // The total size in bytes of this Btrieve database.
-  unsigned int fileLength;
+  uint64_t fileLength;
 
   // The type of records contained in this Btrieve database.
   RecordType recordType;
 
   // Whether the database is version 6.0. Otherwise it's 5.0
   bool v6;
+
+  // The nextRecordInPageAs specialization for v6 and recordType.
+  RecordScanner recordScanner;
+
+  // The number of threads used to decode data pages, see setDecodeThreads.
+  unsigned int decodeThreads;
+
+  // Whether cursors prefetch data pages, see setReadAhead.
+  bool readAhead;
 };
 
 }  // namespace btrieve
@@ -1,9 +1,23 @@
 #include "BtrieveDatabase.h"
 
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winioctl.h>
+#endif
+
+#include "BtrieveException.h"
+#include "TestBase.h"
 #include "gtest/gtest.h"
 
 using namespace btrieve;
 
+class BtrieveDatabaseTest : public TestBase {};
+
 TEST(BtrieveDatabase, LoadsMBBSEmuDat) {
   unsigned int recordCount = 0;
   BtrieveDatabase database;
@@ -227,3 +241,508 @@ TEST(BtrieveDatabase, LoadsMultiAcsDatV6) {
   ASSERT_STREQ(database.getKeys().at(0).getACSName(), "ALLCAPS");
   ASSERT_STREQ(database.getKeys().at(2).getACSName(), "LOWER");
 }
+
+TEST(BtrieveDatabase, ProbeMatchesOpen) {
+  for (const wchar_t *fileName :
+       {_TEXT("assets/MBBSEMU.DAT"), _TEXT("assets/VARIABLE.DAT"),
+        _TEXT("assets/WCCACMS2.DAT"), _TEXT("assets/WGSMENU2.DAT"),
+        _TEXT("assets/GALTELA.DAT"), _TEXT("assets/MULTIACS.DAT")}) {
+    BtrieveDatabase opened;
+    ASSERT_EQ(opened.open(fileName), BtrieveError::Success);
+    BtrieveDatabase probed;
+    ASSERT_EQ(probed.probe(fileName), BtrieveError::Success);
+
+    EXPECT_EQ(probed.getRecordLength(), opened.getRecordLength());
+    EXPECT_EQ(probed.getPhysicalRecordLength(),
+              opened.getPhysicalRecordLength());
+    EXPECT_EQ(probed.getPageLength(), opened.getPageLength());
+    EXPECT_EQ(probed.getPageCount(), opened.getPageCount());
+    EXPECT_EQ(probed.getRecordCount(), opened.getRecordCount());
+    EXPECT_EQ(probed.isVariableLengthRecords(),
+              opened.isVariableLengthRecords());
+
+    ASSERT_EQ(probed.getKeys().size(), opened.getKeys().size())
+        << toStdString(fileName);
+    for (size_t i = 0; i < probed.getKeys().size(); ++i) {
+      EXPECT_TRUE(probed.getKeys()[i].getSegments() ==
+                  opened.getKeys()[i].getSegments())
+          << toStdString(fileName) << " key " << i;
+    }
+  }
+}
+
+TEST(BtrieveDatabase, ProbeResolvesMultipleAcs) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.probe(_TEXT("assets/MULTIACS.DAT")),
+            BtrieveError::Success);
+
+  ASSERT_EQ(database.getKeys().size(), 3u);
+  EXPECT_STREQ(database.getKeys().at(0).getACSName(), "ALLCAPS");
+  EXPECT_STREQ(database.getKeys().at(2).getACSName(), "LOWER");
+}
+
+TEST(BtrieveDatabase, ProbeDoesNotOpenRecords) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.probe(_TEXT("assets/MBBSEMU.DAT")),
+            BtrieveError::Success);
+  EXPECT_EQ(database.getRecordCount(), 4u);
+
+  EXPECT_THROW(database.openCursor(), BtrieveException);
+  EXPECT_EQ(database.probe(_TEXT("assets/DOESNOTEXIST.DAT")),
+            BtrieveError::FileNotFound);
+}
+
+TEST(BtrieveDatabase, ParallelDecodeMatchesSerialOrder) {
+  for (const wchar_t *fileName :
+       {_TEXT("assets/VARIABLE.DAT"), _TEXT("assets/WCCACMS2.DAT"),
+        _TEXT("assets/WGSMENU2.DAT"), _TEXT("assets/GALTELA.DAT")}) {
+    auto serial = readAllRecords(fileName, 1);
+    ASSERT_FALSE(serial.empty());
+    BtrieveDatabase database;
+    ASSERT_EQ(database.probe(fileName), BtrieveError::Success);
+    EXPECT_EQ(serial.size(), database.getRecordCount());
+
+    for (unsigned int threads : {2u, 7u, 0u}) {
+      auto parallel = readAllRecords(fileName, threads);
+      EXPECT_TRUE(parallel == serial) << toStdString(fileName) << " with "
+                                      << threads << " threads";
+    }
+  }
+}
+
+TEST(BtrieveDatabase, ParallelDecodeCancelsEnumeration) {
+  unsigned int recordCount = 0;
+  BtrieveDatabase database;
+  database.setDecodeThreads(4);
+
+  database.parseDatabase(
+      _TEXT("assets/WCCACMS2.DAT"), []() { return true; },
+      [&recordCount](std::basic_string_view<uint8_t> record) {
+        return ++recordCount == 1000
+                   ? BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION
+                   : BtrieveDatabase::LoadRecordResult::COUNT;
+      });
+
+  EXPECT_EQ(recordCount, 1000u);
+}
+
+TEST(BtrieveDatabase, ReadRecordBatchesMatchesReadRecords) {
+  for (const wchar_t *fileName :
+       {_TEXT("assets/MBBSEMU.DAT"), _TEXT("assets/VARIABLE.DAT"),
+        _TEXT("assets/WCCACMS2.DAT"), _TEXT("assets/WGSMENU2.DAT")}) {
+    auto expected = readAllRecords(fileName, 1);
+
+    for (size_t batchSize : {1u, 7u, 256u, 100000u}) {
+      BtrieveDatabase database;
+      ASSERT_EQ(database.open(fileName), BtrieveError::Success);
+
+      std::vector<std::vector<uint8_t>> records;
+      database.readRecordBatches(
+          [&records, batchSize](
+              std::span<const std::basic_string_view<uint8_t>> batch,
+              std::span<BtrieveDatabase::LoadRecordResult> results) {
+            EXPECT_LE(batch.size(), batchSize);
+            ASSERT_EQ(batch.size(), results.size());
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+              records.emplace_back(batch[i].begin(), batch[i].end());
+              results[i] = BtrieveDatabase::LoadRecordResult::COUNT;
+            }
+          },
+          batchSize);
+
+      EXPECT_TRUE(records == expected)
+          << toStdString(fileName) << " in batches of " << batchSize;
+    }
+  }
+}
+
+TEST(BtrieveDatabase, ReadRecordBatchesCancelsEnumeration) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/WCCACMS2.DAT")),
+            BtrieveError::Success);
+
+  unsigned int batches = 0;
+  database.readRecordBatches(
+      [&batches](std::span<const std::basic_string_view<uint8_t>> batch,
+                 std::span<BtrieveDatabase::LoadRecordResult> results) {
+        ++batches;
+        results[0] = BtrieveDatabase::LoadRecordResult::COUNT;
+        results[1] = BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION;
+      },
+      16);
+
+  EXPECT_EQ(batches, 1u);
+}
+
+TEST(BtrieveDatabase, Fingerprint) {
+  BtrieveDatabase database;
+  EXPECT_EQ(database.getFingerprint(), "");
+
+  ASSERT_EQ(database.open(_TEXT("assets/WCCACMS2.DAT")),
+            BtrieveError::Success);
+  const std::string fingerprint = database.getFingerprint();
+  EXPECT_EQ(
+      BtrieveDatabase::computeFingerprint(_TEXT("assets/WCCACMS2.DAT")),
+      fingerprint);
+  EXPECT_EQ(BtrieveDatabase::computeFingerprint(_TEXT("assets/WCCACMS2.DAT"),
+                                                fingerprint),
+            fingerprint);
+  EXPECT_NE(
+      BtrieveDatabase::computeFingerprint(_TEXT("assets/VARIABLE.DAT")),
+      fingerprint);
+
+  // a file whose length doesn't match isn't hashed
+  const std::string other =
+      BtrieveDatabase::computeFingerprint(_TEXT("assets/GALTELA.DAT"));
+  const std::string unhashed = BtrieveDatabase::computeFingerprint(
+      _TEXT("assets/GALTELA.DAT"), fingerprint);
+  EXPECT_NE(unhashed, fingerprint);
+  EXPECT_LT(unhashed.size(), other.size());
+  EXPECT_EQ(other.compare(0, unhashed.size(), unhashed), 0);
+
+  EXPECT_EQ(BtrieveDatabase::computeFingerprint(_TEXT("assets/MISSING.DAT")),
+            "");
+}
+
+TEST_F(BtrieveDatabaseTest, FingerprintSeesHighBitChanges) {
+  auto dat = tempPath->copyToTempPath("assets/MBMGEPLT.DAT");
+  const std::string original = BtrieveDatabase::computeFingerprint(dat.c_str());
+
+  // flips the top bit of two 64-bit words of the same file, which cancel out
+  // when words are simply XORed into an FNV-1a hash
+  FILE *f = fopen(toStdString(dat.c_str()).c_str(), "r+b");
+  ASSERT_NE(f, nullptr);
+  for (const long offset : {4095, 8191}) {
+    uint8_t b;
+    fseek(f, offset, SEEK_SET);
+    ASSERT_EQ(fread(&b, 1, 1, f), 1u);
+    b ^= 0x80;
+    fseek(f, offset, SEEK_SET);
+    fwrite(&b, 1, 1, f);
+  }
+  fclose(f);
+
+  EXPECT_NE(BtrieveDatabase::computeFingerprint(dat.c_str()), original);
+}
+
+TEST(BtrieveDatabase, ReadRecordBatchesKeepsReadingPastSkippedRecords) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/GALTELA.DAT")), BtrieveError::Success);
+
+  unsigned int recordCount = 0;
+  database.readRecordBatches(
+      [&recordCount](std::span<const std::basic_string_view<uint8_t>> batch,
+                     std::span<BtrieveDatabase::LoadRecordResult> results) {
+        // results default to SKIP_COUNT, so leaving them alone never stops
+        // the enumeration early
+        recordCount += static_cast<unsigned int>(batch.size());
+      },
+      4);
+
+  EXPECT_EQ(recordCount, 73u);
+}
+
+TEST(BtrieveDatabase, ReadPagesStopsWhereReadRecordBatchesDoes) {
+  for (auto asset : {"assets/MBBSEMU.DAT", "assets/GALTELA.DAT",
+                     "assets/VARIABLE.DAT", "assets/WCCACMS2.DAT"}) {
+    SCOPED_TRACE(asset);
+    BtrieveDatabase database;
+    ASSERT_EQ(database.open(toWideString(asset).c_str()),
+              BtrieveError::Success);
+
+    // every third record isn't counted, so both read past the record count
+    std::vector<std::vector<uint8_t>> batchRecords;
+    database.readRecordBatches(
+        [&batchRecords](std::span<const std::basic_string_view<uint8_t>> batch,
+                        std::span<BtrieveDatabase::LoadRecordResult> results) {
+          for (size_t i = 0; i < batch.size(); ++i) {
+            if (batchRecords.size() % 3 != 0) {
+              results[i] = BtrieveDatabase::LoadRecordResult::COUNT;
+            }
+            batchRecords.emplace_back(batch[i].begin(), batch[i].end());
+          }
+        },
+        7);
+
+    std::vector<std::vector<uint8_t>> pageRecords;
+    database.readPages(
+        [&pageRecords](unsigned int logicalPage, uint64_t physicalOffset,
+                       uint16_t usageCount,
+                       std::span<const std::basic_string_view<uint8_t>> records,
+                       std::span<BtrieveDatabase::LoadRecordResult> results) {
+          for (size_t i = 0; i < records.size(); ++i) {
+            if (pageRecords.size() % 3 != 0) {
+              results[i] = BtrieveDatabase::LoadRecordResult::COUNT;
+            }
+            pageRecords.emplace_back(records[i].begin(), records[i].end());
+          }
+        });
+
+    EXPECT_EQ(pageRecords, batchRecords);
+  }
+}
+
+TEST(BtrieveDatabase, ReadPagesCountsSkippedPages) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/WCCACMS2.DAT")), BtrieveError::Success);
+
+  struct Page {
+    unsigned int logicalPage;
+    uint64_t physicalOffset;
+    uint16_t usageCount;
+    unsigned int records;
+
+    bool operator==(const Page &page) const {
+      return logicalPage == page.logicalPage &&
+             physicalOffset == page.physicalOffset &&
+             usageCount == page.usageCount && records == page.records;
+    }
+  };
+  std::vector<Page> pages;
+  database.readPages(
+      [&pages](unsigned int logicalPage, uint64_t physicalOffset,
+               uint16_t usageCount,
+               std::span<const std::basic_string_view<uint8_t>> records,
+               std::span<BtrieveDatabase::LoadRecordResult> results) {
+        pages.push_back({logicalPage, physicalOffset, usageCount,
+                         static_cast<unsigned int>(records.size())});
+        std::fill(results.begin(), results.end(),
+                  BtrieveDatabase::LoadRecordResult::COUNT);
+      });
+  ASSERT_GT(pages.size(), 2u);
+
+  // every page but the first is skipped, counted as holding the records it
+  // does, so reading stops at the same page
+  std::vector<Page> skippedPages;
+  unsigned int pagesRead = 0;
+  database.readPages(
+      [&pagesRead](unsigned int logicalPage, uint64_t physicalOffset,
+                   uint16_t usageCount,
+                   std::span<const std::basic_string_view<uint8_t>> records,
+                   std::span<BtrieveDatabase::LoadRecordResult> results) {
+        ++pagesRead;
+        std::fill(results.begin(), results.end(),
+                  BtrieveDatabase::LoadRecordResult::COUNT);
+      },
+      [&skippedPages, &pages](
+          unsigned int logicalPage, uint64_t physicalOffset,
+          uint16_t usageCount) -> std::optional<unsigned int> {
+        auto page = std::find_if(pages.begin() + 1, pages.end(),
+                                 [logicalPage](const Page &page) {
+                                   return page.logicalPage == logicalPage;
+                                 });
+        if (page == pages.end()) {
+          return std::nullopt;
+        }
+        skippedPages.push_back(
+            {logicalPage, physicalOffset, usageCount, page->records});
+        return page->records;
+      });
+
+  EXPECT_EQ(pagesRead, 1u);
+  EXPECT_TRUE(skippedPages ==
+              std::vector<Page>(pages.begin() + 1, pages.end()));
+}
+
+TEST(BtrieveDatabase, ReadRecordBatchesSummarizesPages) {
+  for (const auto *fileName :
+       {_TEXT("assets/WCCACMS2.DAT"), _TEXT("assets/VARIABLE.DAT")}) {
+    BtrieveDatabase database;
+    ASSERT_EQ(database.open(fileName), BtrieveError::Success);
+
+    std::vector<BtrieveDatabase::PageSummary> expected;
+    database.readPages(
+        [&expected](unsigned int logicalPage, uint64_t physicalOffset,
+                    uint16_t usageCount,
+                    std::span<const std::basic_string_view<uint8_t>> records,
+                    std::span<BtrieveDatabase::LoadRecordResult> results) {
+          expected.push_back({logicalPage, physicalOffset, usageCount,
+                              static_cast<unsigned int>(records.size()),
+                              BtrieveDatabase::getPageChecksum(records)});
+          std::fill(results.begin(), results.end(),
+                    BtrieveDatabase::LoadRecordResult::COUNT);
+        });
+    ASSERT_GT(expected.size(), 1u);
+
+    // batches span pages, and pages are summarized as they're read
+    std::vector<BtrieveDatabase::PageSummary> pages;
+    database.readRecordBatches(
+        [](std::span<const std::basic_string_view<uint8_t>> batch,
+           std::span<BtrieveDatabase::LoadRecordResult> results) {
+          std::fill(results.begin(), results.end(),
+                    BtrieveDatabase::LoadRecordResult::COUNT);
+        },
+        7, /* stats= */ nullptr, &pages);
+
+    ASSERT_EQ(pages.size(), expected.size());
+    for (size_t i = 0; i < pages.size(); ++i) {
+      EXPECT_EQ(pages[i].logicalPage, expected[i].logicalPage);
+      EXPECT_EQ(pages[i].physicalOffset, expected[i].physicalOffset);
+      EXPECT_EQ(pages[i].usageCount, expected[i].usageCount);
+      EXPECT_EQ(pages[i].records, expected[i].records);
+      EXPECT_EQ(pages[i].checksum, expected[i].checksum);
+    }
+  }
+}
+
+// Points the FCR's deleted record pointer of a copy of MBBSEMU.DAT at its
+// second record, which in turn points at nextPointer.
+static std::basic_string<wchar_t> writeDeletedRecordChain(
+    TempPath *tempPath, uint32_t nextPointer) {
+  // the records live on page 5, 6 bytes in, 90 bytes apart
+  const uint32_t secondRecord = 5 * 512 + 6 + 90;
+  auto dat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+
+  FILE *f = fopen(toStdString(dat.c_str()).c_str(), "r+b");
+  EXPECT_NE(f, nullptr);
+
+  // record pointers are stored high word first, each word little endian
+  const auto writePointer = [f](long offset, uint32_t pointer) {
+    const uint8_t data[] = {static_cast<uint8_t>(pointer >> 16),
+                            static_cast<uint8_t>(pointer >> 24),
+                            static_cast<uint8_t>(pointer),
+                            static_cast<uint8_t>(pointer >> 8)};
+    fseek(f, offset, SEEK_SET);
+    fwrite(data, 1, sizeof(data), f);
+  };
+
+  writePointer(0x10, secondRecord);
+  writePointer(secondRecord, nextPointer);
+  fclose(f);
+
+  return dat;
+}
+
+static std::vector<uint32_t> loadMBBSEmuIds(const wchar_t *fileName) {
+  std::vector<uint32_t> ids;
+  BtrieveDatabase database;
+
+  database.parseDatabase(
+      fileName, []() { return true; },
+      [&ids](std::basic_string_view<uint8_t> record) {
+        // key 1 is a 4 byte integer at offset 34
+        ids.push_back(*reinterpret_cast<const uint32_t *>(record.data() + 34));
+        return BtrieveDatabase::LoadRecordResult::COUNT;
+      });
+
+  return ids;
+}
+
+TEST_F(BtrieveDatabaseTest, SkipsDeletedRecords) {
+  auto expected = loadMBBSEmuIds(_TEXT("assets/MBBSEMU.DAT"));
+  ASSERT_EQ(expected.size(), 4u);
+  expected.erase(expected.begin() + 1);
+
+  auto dat = writeDeletedRecordChain(tempPath, 0xFFFFFFFF);
+
+  EXPECT_EQ(loadMBBSEmuIds(dat.c_str()), expected);
+}
+
+// Moves logical page 5 of a copy of GALTELA.DAT, its first data page, to
+// physical page newPage by rewriting its entry in the active PAT. The file is
+// extended to fit, sparsely where the file system allows it.
+static std::basic_string<wchar_t> writeRelocatedDataPage(TempPath *tempPath,
+                                                         uint32_t newPage) {
+  // 4096 byte pages, the second PAT copy on page 3 is the active one and maps
+  // logical page 5 to physical page 12
+  const uint64_t pageLength = 4096;
+  const uint64_t activePat = 3 * pageLength;
+  const uint64_t oldPage = 12;
+  auto dat = tempPath->copyToTempPath("assets/GALTELA.DAT");
+
+#ifdef _WIN32
+  HANDLE file = CreateFileW(dat.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  EXPECT_NE(file, INVALID_HANDLE_VALUE);
+  DWORD unused;
+  DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &unused,
+                  nullptr);
+  CloseHandle(file);
+#endif
+
+  FILE *f = fopen(toStdString(dat.c_str()).c_str(), "r+b");
+  EXPECT_NE(f, nullptr);
+
+  const auto seek = [f](uint64_t offset) {
+#ifdef _WIN32
+    _fseeki64(f, static_cast<int64_t>(offset), SEEK_SET);
+#else
+    fseeko(f, static_cast<off_t>(offset), SEEK_SET);
+#endif
+  };
+
+  std::vector<uint8_t> page(pageLength);
+  seek(oldPage * pageLength);
+  EXPECT_EQ(fread(page.data(), 1, page.size(), f), page.size());
+  seek(newPage * pageLength);
+  fwrite(page.data(), 1, page.size(), f);
+
+  // so the records can only come from the new page
+  std::vector<uint8_t> zeroes(pageLength);
+  seek(oldPage * pageLength);
+  fwrite(zeroes.data(), 1, zeroes.size(), f);
+
+  // PAT entries are [pageNumHigh][typeCode][pageNumLow][pageNumMid]
+  const uint8_t entry[] = {static_cast<uint8_t>(newPage >> 16), 'D',
+                           static_cast<uint8_t>(newPage),
+                           static_cast<uint8_t>(newPage >> 8)};
+  seek(activePat + 5 * 4 + 4);
+  fwrite(entry, 1, sizeof(entry), f);
+  fclose(f);
+
+  return dat;
+}
+
+TEST_F(BtrieveDatabaseTest, LoadsDataPagePast4GB) {
+  if (sizeof(void *) < 8) {
+    GTEST_SKIP() << "A file this big can't be mapped";
+  }
+
+  auto expected = readAllRecords(_TEXT("assets/GALTELA.DAT"), 1);
+  ASSERT_EQ(expected.size(), 73u);
+
+  // 0x120000 * 4096 is about 4.5 GB in
+  auto dat = writeRelocatedDataPage(tempPath, 0x120000);
+
+  EXPECT_TRUE(readAllRecords(dat.c_str(), 1) == expected);
+  EXPECT_TRUE(readAllRecords(dat.c_str(), 3) == expected);
+}
+
+TEST_F(BtrieveDatabaseTest, DeletedRecordChainWithLoopTerminates) {
+  auto expected = loadMBBSEmuIds(_TEXT("assets/MBBSEMU.DAT"));
+  ASSERT_EQ(expected.size(), 4u);
+  expected.erase(expected.begin() + 1);
+
+  // the second record points back at itself
+  auto dat = writeDeletedRecordChain(tempPath, 5 * 512 + 6 + 90);
+
+  EXPECT_EQ(loadMBBSEmuIds(dat.c_str()), expected);
+}
+
+TEST_F(BtrieveDatabaseTest, FragmentOutsideItsPageThrows) {
+  // record 1's variable data is fragment 0 of page 4, which starts at 0xC and
+  // ends where fragment 1 starts, at 0xD. The offset of fragment 0 is the last
+  // word of the page. 0x7F00 is past the end of the page and 0x20 would make
+  // the fragment's length negative.
+  for (const uint16_t fragmentOffset : {0x7F00, 0x20}) {
+    auto dat = tempPath->copyToTempPath("assets/VARIABLE.DAT");
+
+    FILE *f = fopen(toStdString(dat.c_str()).c_str(), "r+b");
+    ASSERT_NE(f, nullptr);
+    const uint8_t data[] = {static_cast<uint8_t>(fragmentOffset),
+                            static_cast<uint8_t>(fragmentOffset >> 8)};
+    fseek(f, 4 * 512 + 510, SEEK_SET);
+    fwrite(data, 1, sizeof(data), f);
+    fclose(f);
+
+    BtrieveDatabase database;
+    EXPECT_THROW(database.parseDatabase(
+                     dat.c_str(), []() { return true; },
+                     [](std::basic_string_view<uint8_t>) {
+                       return BtrieveDatabase::LoadRecordResult::COUNT;
+                     }),
+                 BtrieveException);
+  }
+}
@@ -3,10 +3,17 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <memory>
+#include <vector>
 
 #include "BtrieveDatabase.h"
+#include "BtrieveException.h"
+#include "PipelinedRecordLoader.h"
+#include "SortedRecordLoader.h"
 #ifdef _WIN32
 #include <io.h>
 #include <stdio.h>
@@ -64,19 +71,75 @@ static std::basic_string<wchar_t> toUpper(
 #define unlink _wunlink
 #endif
 
-BtrieveError BtrieveDriver::open(const wchar_t *fileName, OpenMode openMode) {
-  int64_t fileModificationTimeDat;
-  int64_t fileModificationTimeDb;
+// Brings the modification time of the sql database at dbPath up to that of
+// the DAT file fileName, so the next open doesn't have to hash the DAT again.
+static void touchSqlDatabase(const wchar_t *fileName,
+                             const std::filesystem::path &dbPath) {
+  std::error_code error;
+  auto datModificationTime =
+      std::filesystem::last_write_time(std::filesystem::path(fileName), error);
+  if (!error) {
+    std::filesystem::last_write_time(dbPath, datModificationTime, error);
+  }
+}
+
+bool BtrieveDriver::isSourceUnchanged(
+    const wchar_t *fileName, const std::filesystem::path &dbPath) {
+  std::string fingerprint;
+  try {
+    if (sqlDatabase->open(toWideString(dbPath).c_str(), OpenMode::ReadOnly) !=
+        BtrieveError::Success) {
+      return false;
+    }
+    fingerprint = sqlDatabase->getSourceFingerprint();
+    sqlDatabase->close();
+  } catch (const BtrieveException &) {
+    sqlDatabase->close();
+    return false;
+  }
+
+  return !fingerprint.empty() &&
+         BtrieveDatabase::computeFingerprint(fileName, fingerprint) ==
+             fingerprint;
+}
+
+bool BtrieveDriver::updateSqlDatabase(
+    const wchar_t *fileName, const std::filesystem::path &dbPath,
+    std::unique_ptr<BtrieveDatabase> &btrieveDatabase) {
+  bool updated = false;
+  try {
+    if (sqlDatabase->open(toWideString(dbPath).c_str()) ==
+        BtrieveError::Success) {
+      auto database = std::make_unique<BtrieveDatabase>();
+      database->setDecodeThreads(decodeThreads);
+      database->setReadAhead(readAhead);
+      if (database->open(fileName) == BtrieveError::Success) {
+        btrieveDatabase = std::move(database);
+        updated = sqlDatabase->update(*btrieveDatabase);
+      }
+    }
+  } catch (const BtrieveException &) {
+    updated = false;
+  }
+  sqlDatabase->close();
+  if (updated) {
+    btrieveDatabase.reset();
+  }
+  return updated;
+}
+
+std::filesystem::path BtrieveDriver::findSqlDatabase(
+    const wchar_t *fileName, bool &dbExists, bool &dbStale,
+    bool &datUnchanged) {
+  int64_t fileModificationTimeDat = 0;
+  int64_t fileModificationTimeDb = 0;
 
   std::filesystem::path dbPath =
       std::filesystem::path(fileName).replace_extension(
           sqlDatabase->getFileExtension());
 
-  openedFilename = fileName;
-
   bool datExists = fileExists(fileName, fileModificationTimeDat);
-  bool dbExists =
-      fileExists(toWideString(dbPath).c_str(), fileModificationTimeDb);
+  dbExists = fileExists(toWideString(dbPath).c_str(), fileModificationTimeDb);
   if (!dbExists) {
     // failed to find db, let's uppercase and try again
     std::filesystem::path dbPathUpper = dbPath;
@@ -89,9 +152,237 @@ BtrieveError BtrieveDriver::open(const wchar_t *fileName, OpenMode openMode) {
   }
 
   // if both DAT/DB exist, check if the DAT has an a newer time, if so
-  // we want to reconvert it by deleting the DB
-  if (datExists && dbExists &&
-      fileModificationTimeDat > fileModificationTimeDb) {
+  // we want to reconvert it, unless its contents are the same as when it was
+  // converted, e.g. copied back from a backup.
+  const bool datNewer = datExists && dbExists &&
+                        fileModificationTimeDat > fileModificationTimeDb;
+  if (datNewer && staleFileName == fileName &&
+      staleDatModificationTime == fileModificationTimeDat &&
+      staleDbModificationTime == fileModificationTimeDb) {
+    datUnchanged = false;
+  } else {
+    datUnchanged = datNewer && isSourceUnchanged(fileName, dbPath);
+  }
+  dbStale = datNewer && !datUnchanged;
+
+  if (dbStale) {
+    staleFileName = fileName;
+    staleDatModificationTime = fileModificationTimeDat;
+    staleDbModificationTime = fileModificationTimeDb;
+  } else {
+    staleFileName.clear();
+  }
+  return dbPath;
+}
+
+bool BtrieveDriver::isConversionRequired(const wchar_t *fileName,
+                                         bool refreshUnchanged) {
+  bool dbExists;
+  bool dbStale;
+  bool datUnchanged;
+  std::filesystem::path dbPath =
+      findSqlDatabase(fileName, dbExists, dbStale, datUnchanged);
+  if (datUnchanged && refreshUnchanged) {
+    touchSqlDatabase(fileName, dbPath);
+  }
+  return !dbExists || dbStale;
+}
+
+// Deletes the sql database at dbPath that a conversion was creating. A
+// partially converted DB is loaded without crash safety, so it's never left
+// behind to be opened next time.
+static void discardSqlDatabase(SqlDatabase &sqlDatabase,
+                               const std::filesystem::path &dbPath) {
+  sqlDatabase.close();
+  unlink(dbPath.c_str());
+}
+
+// Creates the sql database at dbPath for btrieveDatabase, returning the loader
+// to store its records with. Throws BtrieveException, discarding the new
+// database, if it can't be created.
+static std::unique_ptr<RecordLoader> createSqlDatabase(
+    SqlDatabase &sqlDatabase, const std::filesystem::path &dbPath,
+    const BtrieveDatabase &btrieveDatabase) {
+  try {
+    return sqlDatabase.create(toWideString(dbPath).c_str(), btrieveDatabase);
+  } catch (const BtrieveException &) {
+    discardSqlDatabase(sqlDatabase, dbPath);
+    throw;
+  }
+}
+
+namespace {
+// Hands records on to another RecordLoader, noting the position of every
+// record it doesn't store, counting from 1 in the order they're loaded.
+class SkippedRecordTracker : public RecordLoader {
+ public:
+  SkippedRecordTracker(std::unique_ptr<RecordLoader> loader_,
+                       std::vector<uint64_t> &skippedRecords_)
+      : loader(std::move(loader_)),
+        skippedRecords(skippedRecords_),
+        position(0) {}
+
+  virtual BtrieveDatabase::LoadRecordResult onRecordLoaded(
+      std::basic_string_view<uint8_t> record) override {
+    BtrieveDatabase::LoadRecordResult result = loader->onRecordLoaded(record);
+    track(result);
+    return result;
+  }
+
+  virtual void onRecordsLoaded(
+      std::span<const std::basic_string_view<uint8_t>> records,
+      std::span<BtrieveDatabase::LoadRecordResult> results) override {
+    loader->onRecordsLoaded(records, results);
+    for (auto result : results) {
+      if (result == BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION) {
+        return;
+      }
+      track(result);
+    }
+  }
+
+  virtual void onRecordsComplete() override { loader->onRecordsComplete(); }
+
+  virtual void addStats(ConversionStats &stats) const override {
+    loader->addStats(stats);
+  }
+
+ private:
+  void track(BtrieveDatabase::LoadRecordResult result) {
+    if (result == BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION) {
+      return;
+    }
+
+    ++position;
+    if (result == BtrieveDatabase::LoadRecordResult::SKIP_COUNT) {
+      skippedRecords.push_back(position);
+    }
+  }
+
+  std::unique_ptr<RecordLoader> loader;
+  std::vector<uint64_t> &skippedRecords;
+  uint64_t position;
+};
+}  // namespace
+
+// Stores every record of btrieveDatabase through loader, which sqlDatabase's
+// create returned for the new database at dbPath, and completes it. Records
+// are stored in the order of key conversionSortKey if it's set, holding up to
+// sortMemoryLimit bytes of them in memory, see
+// BtrieveDriver::setConversionSortKey, and on a writer thread if pipelined.
+// Adds where the time went to stats, and the positions of the records that
+// couldn't be stored to skippedRecords if it's set, see SkippedRecordTracker.
+// Throws BtrieveException, discarding the new database, if the conversion
+// fails or once cancelled is set.
+static void convertRecords(
+    SqlDatabase &sqlDatabase, const std::filesystem::path &dbPath,
+    const BtrieveDatabase &btrieveDatabase,
+    std::unique_ptr<RecordLoader> loader, int conversionSortKey,
+    size_t sortMemoryLimit, bool pipelined,
+    const std::function<void(unsigned int, unsigned int)> &conversionProgress,
+    ConversionStats &stats, std::vector<uint64_t> *skippedRecords,
+    const std::atomic<bool> &cancelled) {
+  try {
+    // released before the database is discarded, along with the statements
+    // it holds on it
+    std::unique_ptr<RecordLoader> recordLoader(std::move(loader));
+    // tracks the records as they're actually stored, behind any pipeline
+    if (skippedRecords) {
+      recordLoader.reset(
+          new SkippedRecordTracker(std::move(recordLoader), *skippedRecords));
+    }
+    const auto &keys = btrieveDatabase.getKeys();
+    const bool sorted = conversionSortKey >= 0 && !keys.empty();
+    PipelinedRecordLoader *pipeline = nullptr;
+
+    const unsigned int recordCount = btrieveDatabase.getRecordCount();
+    unsigned int recordsStored = 0;
+    const auto reportProgress = [&]() {
+      if (conversionProgress) {
+        // a pipeline wrapping the sorted loader only knows what it buffered
+        conversionProgress(pipeline && !sorted ? pipeline->getRecordsWritten()
+                                               : recordsStored,
+                           recordCount);
+      }
+    };
+
+    if (sorted) {
+      const Key &key = static_cast<size_t>(conversionSortKey) < keys.size()
+                           ? keys[conversionSortKey]
+                           : keys[0];
+      // records are only stored once they're all read and sorted
+      recordLoader.reset(new SortedRecordLoader(
+          std::move(recordLoader), key,
+          [&recordsStored, &reportProgress](unsigned int stored) {
+            recordsStored = stored;
+            reportProgress();
+          },
+          sortMemoryLimit));
+    }
+    if (pipelined) {
+      pipeline = new PipelinedRecordLoader(std::move(recordLoader));
+      recordLoader.reset(pipeline);
+    }
+
+    // sorted records can't be traced back to their pages
+    std::vector<BtrieveDatabase::PageSummary> pages;
+    if (recordCount > 0) {
+      btrieveDatabase.readRecordBatches(
+          [&](std::span<const std::basic_string_view<uint8_t>> records,
+              std::span<BtrieveDatabase::LoadRecordResult> results) {
+            if (cancelled) {
+              throw BtrieveException(BtrieveError::CloseError,
+                                     "Conversion cancelled");
+            }
+
+            recordLoader->onRecordsLoaded(records, results);
+
+            if (!sorted) {
+              recordsStored += static_cast<unsigned int>(
+                  std::count(results.begin(), results.end(),
+                             BtrieveDatabase::LoadRecordResult::COUNT));
+            }
+            reportProgress();
+          },
+          BtrieveDatabase::DEFAULT_RECORD_BATCH_SIZE, &stats,
+          sorted ? nullptr : &pages);
+    }
+
+    recordLoader->onRecordsComplete();
+    recordLoader->addStats(stats);
+    if (!sorted) {
+      const auto saveStart = std::chrono::steady_clock::now();
+      sqlDatabase.saveConvertedPages(pages);
+      stats.pageTableTime = std::chrono::steady_clock::now() - saveStart;
+    }
+    reportProgress();
+  } catch (const BtrieveException &) {
+    discardSqlDatabase(sqlDatabase, dbPath);
+    throw;
+  }
+}
+
+BtrieveError BtrieveDriver::open(const wchar_t *fileName, OpenMode openMode) {
+  bool dbExists;
+  bool dbStale;
+  bool datUnchanged;
+  std::filesystem::path dbPath =
+      findSqlDatabase(fileName, dbExists, dbStale, datUnchanged);
+  // whatever open does to a stale database, it won't be stale afterwards
+  staleFileName.clear();
+
+  openedFilename = fileName;
+  openedDbPath = dbPath;
+  openedMode = openMode;
+  conversionStats = ConversionStats();
+  conversionError = BtrieveError::Success;
+
+  if (datUnchanged) {
+    touchSqlDatabase(fileName, dbPath);
+  }
+
+  std::unique_ptr<BtrieveDatabase> btrieveDatabase;
+  if (dbStale && !updateSqlDatabase(fileName, dbPath, btrieveDatabase)) {
     //_logger.Warn($"{fullPathDAT} is newer than {fullPathDB}, reconverting the
     // DAT -> DB");
     unlink(dbPath.c_str());
@@ -103,22 +394,59 @@ BtrieveError BtrieveDriver::open(const wchar_t *fileName, OpenMode openMode) {
   if (dbExists) {
     error = sqlDatabase->open(toWideString(dbPath).c_str(), openMode);
   } else {
-    BtrieveDatabase btrieveDatabase;
-    std::unique_ptr<RecordLoader> recordLoader;
-    error = btrieveDatabase.parseDatabase(
-        fileName,
-        [this, &dbPath, &btrieveDatabase, &recordLoader, openMode]() {
-          recordLoader = sqlDatabase->create(toWideString(dbPath).c_str(),
-                                             btrieveDatabase);
-          return true;
-        },
-        [&recordLoader](const std::basic_string_view<uint8_t> record) {
-          return recordLoader->onRecordLoaded(record);
-        },
-        [&recordLoader]() { recordLoader->onRecordsComplete(); });
+    const auto start = std::chrono::steady_clock::now();
+    if (btrieveDatabase) {
+      error = BtrieveError::Success;
+    } else {
+      btrieveDatabase = std::make_unique<BtrieveDatabase>();
+      btrieveDatabase->setDecodeThreads(decodeThreads);
+      btrieveDatabase->setReadAhead(readAhead);
+      error = btrieveDatabase->open(fileName);
+    }
+    if (error == BtrieveError::Success) {
+      conversionStats.parseTime = std::chrono::steady_clock::now() - start;
+
+      if (backgroundConversion) {
+        backgroundKeys = btrieveDatabase->getKeys();
+        // the conversion owns btrieveDatabase from here on, and never touches
+        // the driver, which may be moved while it runs. Creating the sql
+        // database fingerprints the whole DAT file, so that's left to it too.
+        const BtrieveDatabase &source = *btrieveDatabase;
+        background.reset(new BackgroundConversion(
+            source,
+            [&sqlDatabase = *sqlDatabase, dbPath, start,
+             parseTime = conversionStats.parseTime,
+             pipelined = pipelinedConversion, progress = conversionProgress,
+             btrieveDatabase = std::move(btrieveDatabase)](
+                ConversionStats &stats, std::vector<uint64_t> &skippedRecords,
+                const std::atomic<bool> &cancelled) mutable {
+              stats.parseTime = parseTime;
+              // records keep the positions they're served from meanwhile,
+              // less the records that couldn't be stored
+              convertRecords(
+                  sqlDatabase, dbPath, *btrieveDatabase,
+                  createSqlDatabase(sqlDatabase, dbPath, *btrieveDatabase),
+                  /* conversionSortKey= */ -1,
+                  SortedRecordLoader::DEFAULT_MEMORY_LIMIT, pipelined, progress,
+                  stats, &skippedRecords, cancelled);
+              btrieveDatabase->close();
+              stats.totalTime = std::chrono::steady_clock::now() - start;
+            }));
+      } else {
+        const std::atomic<bool> cancelled(false);
+        convertRecords(
+            *sqlDatabase, dbPath, *btrieveDatabase,
+            createSqlDatabase(*sqlDatabase, dbPath, *btrieveDatabase),
+            conversionSortKey, conversionSortMemoryLimit, pipelinedConversion,
+            conversionProgress, conversionStats, /* skippedRecords= */ nullptr,
+            cancelled);
+        conversionStats.totalTime = std::chrono::steady_clock::now() - start;
+        btrieveDatabase->close();
+      }
+    }
 
     // if newly created and they want read-only, close and reopen
-    if (openMode == OpenMode::ReadOnly) {
+    if (openMode == OpenMode::ReadOnly && !background) {
       sqlDatabase->close();
       error = sqlDatabase->open(toWideString(dbPath).c_str(), openMode);
     }
@@ -133,7 +461,57 @@ BtrieveError BtrieveDriver::open(const wchar_t *fileName, OpenMode openMode) {
   return error;
 }
 
+bool BtrieveDriver::isConverting() {
+  if (!background) {
+    return false;
+  }
+
+  if (!background->isDone()) {
+    return true;
+  }
+
+  waitForConversion();
+  return false;
+}
+
+BtrieveError BtrieveDriver::waitForConversion() {
+  if (!background) {
+    return conversionError;
+  }
+
+  try {
+    background->wait();
+  } catch (const BtrieveException &ex) {
+    // the conversion already discarded its database, so there's nothing
+    // left to serve records from
+    conversionError = ex.getError();
+    background.reset();
+    return conversionError;
+  }
+
+  conversionStats = background->getStats();
+  const uint64_t position =
+      background->getConvertedPosition(background->getPosition());
+  background.reset();
+
+  // reopened here rather than on the conversion's thread, which would swap
+  // the database out from under anyone using it on this one
+  if (openedMode == OpenMode::ReadOnly) {
+    sqlDatabase->close();
+    conversionError =
+        sqlDatabase->open(toWideString(openedDbPath).c_str(), openedMode);
+    if (conversionError != BtrieveError::Success) {
+      return conversionError;
+    }
+  }
+  sqlDatabase->setPosition(position);
+  return BtrieveError::Success;
+}
+
 void BtrieveDriver::close() {
+  // stops a background conversion, which discards what it had converted
+  background.reset();
+  backgroundKeys.clear();
   sqlDatabase->close();
   // release ownership and delete
   sqlDatabase.reset(nullptr);
@@ -142,8 +520,17 @@ void BtrieveDriver::close() {
 BtrieveError BtrieveDriver::performOperation(
     int keyNumber, std::basic_string_view<uint8_t> keyData,
     OperationCode operationCode) {
+  // physical steps are served from the DAT file while it's being converted
+  const bool converting = isConverting();
+  if (!converting && conversionError != BtrieveError::Success) {
+    return conversionError;
+  }
+
   switch (operationCode) {
     case OperationCode::Delete:
+      if (converting && waitForConversion() != BtrieveError::Success) {
+        return conversionError;
+      }
       return sqlDatabase->deleteRecord();
       /* lock biases, which we don't support / care about
       +100 Single wait record lock.
@@ -156,13 +543,13 @@ BtrieveError BtrieveDriver::performOperation(
     case OperationCode::StepFirst + 200:
     case OperationCode::StepFirst + 300:
     case OperationCode::StepFirst + 400:
-      return sqlDatabase->stepFirst();
+      return converting ? background->stepFirst() : sqlDatabase->stepFirst();
     case OperationCode::StepLast:
     case OperationCode::StepLast + 100:
     case OperationCode::StepLast + 200:
     case OperationCode::StepLast + 300:
     case OperationCode::StepLast + 400:
-      return sqlDatabase->stepLast();
+      return converting ? background->stepLast() : sqlDatabase->stepLast();
     case OperationCode::StepNext:
     case OperationCode::StepNext + 100:
     case OperationCode::StepNext + 200:
@@ -173,7 +560,7 @@ BtrieveError BtrieveDriver::performOperation(
     case OperationCode::StepNextExtended + 200:
     case OperationCode::StepNextExtended + 300:
     case OperationCode::StepNextExtended + 400:
-      return sqlDatabase->stepNext();
+      return converting ? background->stepNext() : sqlDatabase->stepNext();
     case OperationCode::StepPrevious:
     case OperationCode::StepPrevious + 100:
     case OperationCode::StepPrevious + 200:
@@ -184,12 +571,18 @@ BtrieveError BtrieveDriver::performOperation(
     case OperationCode::StepPreviousExtended + 200:
     case OperationCode::StepPreviousExtended + 300:
     case OperationCode::StepPreviousExtended + 400:
-      return sqlDatabase->stepPrevious();
+      return converting ? background->stepPrevious()
+                        : sqlDatabase->stepPrevious();
     default:
         // fall through
         ;
   }
 
+  // keys can only be queried once the sql database takes over
+  if (converting && waitForConversion() != BtrieveError::Success) {
+    return conversionError;
+  }
+
   if (usesPreviousQuery(operationCode)) {
     if (!previousQuery) {
       return BtrieveError::InvalidPositioning;
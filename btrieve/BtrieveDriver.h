@@ -1,12 +1,17 @@
 #ifndef __BTRIEVE_DRIVER_H_
 #define __BTRIEVE_DRIVER_H_
 
+#include <filesystem>
+#include <functional>
 #include <memory>
 
+#include "BackgroundConversion.h"
+#include "ConversionStats.h"
 #include "ErrorCode.h"
 #include "OpenMode.h"
 #include "OperationCode.h"
 #include "Record.h"
+#include "SortedRecordLoader.h"
 #include "SqlDatabase.h"
 #include "Text.h"
 
@@ -15,52 +20,191 @@ namespace btrieve {
 // through records.
 class BtrieveDriver {
  public:
-  BtrieveDriver(SqlDatabase *sqlDatabase_) : sqlDatabase(sqlDatabase_) {}
+  BtrieveDriver(SqlDatabase *sqlDatabase_)
+      : sqlDatabase(sqlDatabase_),
+        decodeThreads(1),
+        readAhead(false),
+        pipelinedConversion(false),
+        backgroundConversion(false),
+        conversionSortKey(-1),
+        conversionSortMemoryLimit(SortedRecordLoader::DEFAULT_MEMORY_LIMIT),
+        staleDatModificationTime(0),
+        staleDbModificationTime(0),
+        openedMode(OpenMode::Normal),
+        conversionError(BtrieveError::Success) {}
 
   BtrieveDriver(BtrieveDriver &&driver)
-      : sqlDatabase(std::move(driver.sqlDatabase)) {}
+      : sqlDatabase(std::move(driver.sqlDatabase)),
+        decodeThreads(driver.decodeThreads),
+        readAhead(driver.readAhead),
+        pipelinedConversion(driver.pipelinedConversion),
+        backgroundConversion(driver.backgroundConversion),
+        conversionSortKey(driver.conversionSortKey),
+        conversionSortMemoryLimit(driver.conversionSortMemoryLimit),
+        conversionProgress(std::move(driver.conversionProgress)),
+        conversionStats(driver.conversionStats),
+        staleFileName(std::move(driver.staleFileName)),
+        staleDatModificationTime(driver.staleDatModificationTime),
+        staleDbModificationTime(driver.staleDbModificationTime),
+        openedDbPath(std::move(driver.openedDbPath)),
+        openedMode(driver.openedMode),
+        background(std::move(driver.background)),
+        backgroundKeys(std::move(driver.backgroundKeys)),
+        conversionError(driver.conversionError) {}
 
   ~BtrieveDriver();
 
   BtrieveError open(const wchar_t *fileName,
                     OpenMode openMode = OpenMode::Normal);
 
+  // Returns whether open would convert the DAT file fileName, because it has
+  // no sql database yet or its contents changed since its last conversion.
+  // If refreshUnchanged is set and the DAT file is newer than its database but
+  // its contents aren't, the database's modification time is brought up to
+  // the DAT file's, like open does, so the next check doesn't hash it again.
+  // A DAT file found stale isn't hashed again by an open that follows. Opens
+  // and closes the sql database, so must be called while no database is open.
+  bool isConversionRequired(const wchar_t *fileName,
+                            bool refreshUnchanged = false);
+
+  // Sets the number of threads used to decode the DAT file when open has to
+  // convert it. See BtrieveDatabase::setDecodeThreads.
+  void setDecodeThreads(unsigned int threads) { decodeThreads = threads; }
+
+  // Sets whether the DAT file is prefetched while open converts it. See
+  // BtrieveDatabase::setReadAhead.
+  void setReadAhead(bool readAhead_) { readAhead = readAhead_; }
+
+  // Sets whether open stores converted records on a dedicated writer thread
+  // while it goes on parsing the DAT file, see PipelinedRecordLoader. Off by
+  // default.
+  void setPipelinedConversion(bool pipelinedConversion_) {
+    pipelinedConversion = pipelinedConversion_;
+  }
+
+  // Sets the key whose order open stores converted records in, see
+  // SortedRecordLoader, falling back to key 0 if the DAT file doesn't have
+  // it. -1, the default, stores records in the order of the DAT file.
+  void setConversionSortKey(int keyNumber) { conversionSortKey = keyNumber; }
+
+  // Sets how many bytes of records sorting them by the conversion sort key
+  // holds in memory before it writes them out to a temporary file, see
+  // SortedRecordLoader.
+  void setConversionSortMemoryLimit(size_t bytes) {
+    conversionSortMemoryLimit = bytes;
+  }
+
+  // Sets whether open returns as soon as it has read the metadata of a DAT
+  // file it has to convert, leaving the conversion to a background thread,
+  // see BackgroundConversion. Until the conversion is done, physical steps
+  // and direct record reads are served from the DAT file, and everything else
+  // waits for it. Records are then stored in the order of the DAT file,
+  // whatever the conversion sort key, so their positions carry over, less
+  // one for every earlier record that couldn't be stored. Off by default.
+  void setBackgroundConversion(bool backgroundConversion_) {
+    backgroundConversion = backgroundConversion_;
+  }
+
+  // Returns whether open's background conversion is still running. Once it's
+  // done, the sql database takes over from the DAT file, see
+  // waitForConversion.
+  bool isConverting();
+
+  // Waits for open's background conversion, if there is one, and has the sql
+  // database take over from the DAT file. Returns the error the conversion
+  // failed with, if it did. Its database is discarded then, and everything
+  // that needs it fails with the same error until the next open.
+  BtrieveError waitForConversion();
+
+  // Sets a function that open calls on the thread converting after each batch
+  // of records it converts and once the conversion is complete, with the
+  // number of records stored so far and the number of records in the DAT
+  // file. Records sorted by a key are only stored once they've all been read,
+  // see setConversionSortKey, so their progress stays at 0 until then.
+  void setConversionProgress(
+      std::function<void(unsigned int, unsigned int)> conversionProgress_) {
+    conversionProgress = conversionProgress_;
+  }
+
+  // Returns where the time went during the last conversion open did, see
+  // ConversionStats. All zero if open didn't have to convert the DAT file
+  // from scratch, or until its background conversion is done.
+  const ConversionStats &getConversionStats() const { return conversionStats; }
+
   // Closes an opened database.
   void close();
 
-  unsigned int getRecordLength() const {
-    return sqlDatabase->getRecordLength();
+  // The file's metadata comes from the DAT file while it's being converted in
+  // the background, and from the sql database after that.
+  unsigned int getRecordLength() {
+    return isConverting() ? background->getRecordLength()
+                          : sqlDatabase->getRecordLength();
   }
 
-  unsigned int getRecordCount() const { return sqlDatabase->getRecordCount(); }
+  unsigned int getRecordCount() {
+    if (isConverting()) {
+      return background->getRecordCount();
+    }
+    return conversionError == BtrieveError::Success
+               ? sqlDatabase->getRecordCount()
+               : 0;
+  }
 
-  bool isVariableLengthRecords() const {
-    return sqlDatabase->isVariableLengthRecords();
+  bool isVariableLengthRecords() {
+    return isConverting() ? background->isVariableLengthRecords()
+                          : sqlDatabase->isVariableLengthRecords();
   }
 
-  const std::vector<Key> &getKeys() const { return sqlDatabase->getKeys(); }
+  // The keys returned while converting stay valid after the conversion is
+  // done, until the next open or close.
+  const std::vector<Key> &getKeys() {
+    return isConverting() ? backgroundKeys : sqlDatabase->getKeys();
+  }
 
-  unsigned int getPosition() const { return sqlDatabase->getPosition(); }
+  uint64_t getPosition() const {
+    return background ? background->getPosition() : sqlDatabase->getPosition();
+  }
 
-  void setPosition(unsigned int position) {
-    return sqlDatabase->setPosition(position);
+  void setPosition(uint64_t position) {
+    if (background) {
+      background->setPosition(position);
+    } else {
+      sqlDatabase->setPosition(position);
+    }
   }
 
   std::pair<bool, Record> getRecord() { return getRecord(getPosition()); }
 
-  std::pair<bool, Record> getRecord(unsigned int position) {
+  std::pair<bool, Record> getRecord(uint64_t position) {
+    if (isConverting()) {
+      return background->getRecord(position);
+    }
+    if (conversionError != BtrieveError::Success) {
+      return std::pair<bool, Record>(false, Record());
+    }
     return sqlDatabase->getRecord(position);
   }
 
-  bool deleteAll() { return sqlDatabase->deleteAll(); }
+  bool deleteAll() {
+    return waitForConversion() == BtrieveError::Success &&
+           sqlDatabase->deleteAll();
+  }
 
-  std::pair<BtrieveError, unsigned int> insertRecord(
+  std::pair<BtrieveError, uint64_t> insertRecord(
       std::basic_string_view<uint8_t> record) {
+    const BtrieveError error = waitForConversion();
+    if (error != BtrieveError::Success) {
+      return std::pair<BtrieveError, uint64_t>(error, 0);
+    }
     return sqlDatabase->insertRecord(record);
   }
 
-  BtrieveError updateRecord(unsigned int id,
+  BtrieveError updateRecord(uint64_t id,
                             std::basic_string_view<uint8_t> record) {
+    const BtrieveError error = waitForConversion();
+    if (error != BtrieveError::Success) {
+      return error;
+    }
     return sqlDatabase->updateRecord(id, record);
   }
 
@@ -68,8 +212,11 @@ class BtrieveDriver {
                                 std::basic_string_view<uint8_t> key,
                                 OperationCode operationCode);
 
-  BtrieveError logicalCurrencySeek(int keyNumber, unsigned int position) {
-    BtrieveError ret;
+  BtrieveError logicalCurrencySeek(int keyNumber, uint64_t position) {
+    BtrieveError ret = waitForConversion();
+    if (ret != BtrieveError::Success) {
+      return ret;
+    }
 
     previousQuery = sqlDatabase->logicalCurrencySeek(keyNumber, position, ret);
 
@@ -79,9 +226,61 @@ class BtrieveDriver {
   std::basic_string<wchar_t> getOpenedFilename() { return openedFilename; }
 
  private:
+  // Returns the path of the sql database for the DAT file fileName. Sets
+  // dbExists to whether that database exists, and dbStale to whether it has
+  // to be converted again since the DAT file was modified. Sets datUnchanged
+  // if the DAT file is newer than the database but its contents aren't. Only
+  // hashes a DAT file it last found stale again if it or its database has been
+  // modified since, see staleFileName.
+  std::filesystem::path findSqlDatabase(const wchar_t *fileName,
+                                        bool &dbExists, bool &dbStale,
+                                        bool &datUnchanged);
+
+  // Returns whether the DAT file fileName still has the fingerprint recorded
+  // in the sql database at dbPath when it was converted. Opens and closes
+  // sqlDatabase.
+  bool isSourceUnchanged(const wchar_t *fileName,
+                         const std::filesystem::path &dbPath);
+
+  // Brings the sql database at dbPath up to date with the DAT file fileName
+  // by converting only the pages that changed, see SqlDatabase::update.
+  // Returns false if it has to be converted from scratch instead, leaving the
+  // DAT file in btrieveDatabase if it could be opened, so a conversion from
+  // scratch doesn't have to open and fingerprint it again. Opens and closes
+  // sqlDatabase.
+  bool updateSqlDatabase(const wchar_t *fileName,
+                         const std::filesystem::path &dbPath,
+                         std::unique_ptr<BtrieveDatabase> &btrieveDatabase);
+
   std::unique_ptr<SqlDatabase> sqlDatabase;
   std::unique_ptr<Query> previousQuery;
   std::basic_string<wchar_t> openedFilename;
+  unsigned int decodeThreads;
+  bool readAhead;
+  bool pipelinedConversion;
+  bool backgroundConversion;
+  int conversionSortKey;
+  size_t conversionSortMemoryLimit;
+  std::function<void(unsigned int, unsigned int)> conversionProgress;
+  ConversionStats conversionStats;
+  // the DAT file findSqlDatabase last found stale, with the modification
+  // times of it and its sql database then, so the open that follows
+  // isConversionRequired doesn't hash it a second time
+  std::basic_string<wchar_t> staleFileName;
+  int64_t staleDatModificationTime;
+  int64_t staleDbModificationTime;
+  // the sql database open opened, and how, which waitForConversion reopens
+  // read-only once a background conversion is done
+  std::filesystem::path openedDbPath;
+  OpenMode openedMode;
+  // the conversion open left running in the background, until the sql
+  // database takes over, see isConverting. sqlDatabase belongs to its thread
+  // until then.
+  std::unique_ptr<BackgroundConversion> background;
+  // the keys of the DAT file background converts, see getKeys
+  std::vector<Key> backgroundKeys;
+  // what the last background conversion failed with, Success if it didn't
+  BtrieveError conversionError;
 };
 }  // namespace btrieve
 #endif
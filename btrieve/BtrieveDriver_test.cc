@@ -2,9 +2,18 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <thread>
 
 #include "BtrieveException.h"
+#include "SortedRecordLoader.h"
 #include "SqliteDatabase.h"
 #include "gtest/gtest.h"
 #ifndef WIN32
@@ -60,7 +69,39 @@ static std::string fromPath(const std::filesystem::path &path) {
 #endif
 }
 
-class BtrieveDriverTest : public TestBase {};
+class BtrieveDriverTest : public TestBase {
+ protected:
+  // Steps through every record of driver in physical order, returning their
+  // data.
+  static std::vector<std::vector<uint8_t>> stepRecords(BtrieveDriver &driver) {
+    std::vector<std::vector<uint8_t>> records;
+    BtrieveError error = driver.performOperation(
+        -1, std::basic_string_view<uint8_t>(), OperationCode::StepFirst);
+    while (error == BtrieveError::Success) {
+      auto data = driver.getRecord();
+      EXPECT_TRUE(data.first);
+      records.push_back(data.second.getData());
+      error = driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                      OperationCode::StepNext);
+    }
+    EXPECT_EQ(error, BtrieveError::EndOfFile);
+    return records;
+  }
+
+  // Expects driver to hold exactly the records expected, in that physical
+  // order unless inOrder is false.
+  static void expectRecords(BtrieveDriver &driver,
+                            std::vector<std::vector<uint8_t>> expected,
+                            bool inOrder = true) {
+    EXPECT_EQ(driver.getRecordCount(), expected.size());
+    auto records = stepRecords(driver);
+    if (!inOrder) {
+      std::sort(records.begin(), records.end());
+      std::sort(expected.begin(), expected.end());
+    }
+    EXPECT_EQ(records, expected);
+  }
+};
 
 TEST_F(BtrieveDriverTest, MultithreadMutexingEnabled) {
   ASSERT_NE(sqlite3_threadsafe(), 0);
@@ -129,7 +170,15 @@ TEST_F(BtrieveDriverTest, LoadsAndConverts) {
   ASSERT_EQ(sqlite_exec(db, "SELECT version FROM metadata_t",
                         [](int numResults, char **data, char **columns) {
                           ASSERT_EQ(numResults, 1);
-                          ASSERT_STREQ(data[0], "3");
+                          ASSERT_STREQ(data[0], "6");
+                        }),
+            SQLITE_OK);
+
+  ASSERT_EQ(sqlite_exec(db, "SELECT dat_fingerprint FROM metadata_t",
+                        [](int numResults, char **data, char **columns) {
+                          ASSERT_EQ(numResults, 1);
+                          ASSERT_NE(data[0], nullptr);
+                          EXPECT_STRNE(data[0], "");
                         }),
             SQLITE_OK);
 
@@ -139,7 +188,7 @@ TEST_F(BtrieveDriverTest, LoadsAndConverts) {
       "INTEGER "
       "NOT NULL, page_length INTEGER NOT NULL, variable_length_records INTEGER "
       "NOT "
-      "NULL, version INTEGER NOT NULL)";
+      "NULL, version INTEGER NOT NULL, dat_fingerprint TEXT)";
 
   ASSERT_EQ(
       sqlite_exec(db, "SELECT sql FROM sqlite_master WHERE name = 'metadata_t'",
@@ -199,6 +248,17 @@ TEST_F(BtrieveDriverTest, LoadsAndConverts) {
       SQLITE_OK);
   ASSERT_TRUE(foundTrigger);
 
+  std::vector<std::string> indices;
+  ASSERT_EQ(sqlite_exec(db,
+                        "SELECT name FROM sqlite_master WHERE type = 'index' "
+                        "AND sql IS NOT NULL ORDER BY name",
+                        [&indices](int numResults, char **data, char **columns) {
+                          indices.push_back(data[0]);
+                        }),
+            SQLITE_OK);
+  EXPECT_EQ(indices, std::vector<std::string>({"key_0_index", "key_1_index",
+                                               "key_2_index", "key_3_index"}));
+
   int recordCount = 0;
   ASSERT_EQ(
       sqlite_exec(db, "SELECT * FROM data_t",
@@ -252,6 +312,51 @@ TEST_F(BtrieveDriverTest, LoadsPreexistingSqliteDatabase) {
                           false, 0, 0, 0, acsName, blankACS));
 }
 
+TEST_F(BtrieveDriverTest, QueryOnUnknownKeyIsInvalidKeyNumber) {
+  std::string acsName;
+  std::vector<char> blankACS;
+  std::unique_ptr<SqlDatabase> database(new SqliteDatabase());
+
+  auto mbbsEmuDb = tempPath->copyToTempPath("assets/MBBSEMU.DB");
+  ASSERT_EQ(database->open(mbbsEmuDb.c_str()), BtrieveError::Success);
+
+  // MBBSEMU only has keys 0 through 3
+  KeyDefinition keyDefinition(4, 4, 34, KeyDataType::Integer,
+                              UseExtendedDataType, false, 0, 0, 0, acsName,
+                              blankACS);
+  Key key(&keyDefinition, 1);
+  const uint8_t keyData[4] = {};
+  auto query = database->newQuery(
+      0, &key, std::basic_string_view<uint8_t>(keyData, sizeof(keyData)));
+
+  EXPECT_EQ(database->getByKeyFirst(query.get()),
+            BtrieveError::InvalidKeyNumber);
+  EXPECT_EQ(database->getByKeyLast(query.get()),
+            BtrieveError::InvalidKeyNumber);
+  EXPECT_EQ(database->getByKeyEqual(query.get()),
+            BtrieveError::InvalidKeyNumber);
+}
+
+TEST_F(BtrieveDriverTest, ReconvertsNewerDatThatIsInvalid) {
+  auto mbbsEmuDb = tempPath->copyToTempPath("assets/MBBSEMU.DB");
+  std::filesystem::path datPath(mbbsEmuDb);
+  datPath.replace_extension(".DAT");
+
+  // a DAT newer than its DB is reconverted
+  FILE *f = fopen(fromPath(datPath).c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  const char garbage[512] = "not a btrieve file";
+  fwrite(garbage, 1, sizeof(garbage), f);
+  fclose(f);
+  std::filesystem::last_write_time(
+      datPath, std::filesystem::last_write_time(mbbsEmuDb) +
+                   std::chrono::seconds(10));
+
+  // the DAT's error is reported rather than hidden behind the old DB
+  BtrieveDriver driver(new SqliteDatabase());
+  EXPECT_THROW(driver.open(toWideString(datPath).c_str()), BtrieveException);
+}
+
 #pragma pack(push, 1)
 typedef struct _tagMBBSEmuRecordStruct {
   uint16_t header;
@@ -264,6 +369,770 @@ typedef struct _tagMBBSEmuRecordStruct {
 
 static_assert(sizeof(MBBSEmuRecordStruct) == 74);
 
+TEST_F(BtrieveDriverTest, IsConversionRequired) {
+  auto mbbsEmuDat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+  std::filesystem::path dbPath(mbbsEmuDat);
+  dbPath.replace_extension(".db");
+
+  BtrieveDriver driver(new SqliteDatabase());
+  EXPECT_TRUE(driver.isConversionRequired(mbbsEmuDat.c_str()));
+
+  {
+    BtrieveDriver converter(new SqliteDatabase());
+    ASSERT_EQ(converter.open(mbbsEmuDat.c_str()), BtrieveError::Success);
+  }
+  EXPECT_FALSE(driver.isConversionRequired(mbbsEmuDat.c_str()));
+
+  std::filesystem::last_write_time(
+      mbbsEmuDat, std::filesystem::last_write_time(dbPath) +
+                      std::chrono::seconds(10));
+  // a DAT that's only newer, e.g. restored from a backup, still matches the
+  // fingerprint recorded when it was converted. Checking leaves the DB as is.
+  const auto dbModificationTime = std::filesystem::last_write_time(dbPath);
+  EXPECT_FALSE(driver.isConversionRequired(mbbsEmuDat.c_str()));
+  EXPECT_EQ(std::filesystem::last_write_time(dbPath), dbModificationTime);
+  // unless asked to refresh it, which brings the DB up to the DAT's time so
+  // the next check needn't hash the DAT again
+  EXPECT_FALSE(driver.isConversionRequired(mbbsEmuDat.c_str(),
+                                           /* refreshUnchanged= */ true));
+  EXPECT_EQ(std::filesystem::last_write_time(dbPath),
+            std::filesystem::last_write_time(mbbsEmuDat));
+
+  // change a byte of the last page, which holds records
+  {
+    std::fstream dat(fromPath(mbbsEmuDat),
+                     std::ios::in | std::ios::out | std::ios::binary);
+    dat.seekg(-1, std::ios::end);
+    char c = static_cast<char>(dat.get());
+    dat.seekp(-1, std::ios::end);
+    dat.put(static_cast<char>(c ^ 0xFF));
+  }
+  std::filesystem::last_write_time(
+      mbbsEmuDat, std::filesystem::last_write_time(dbPath) +
+                      std::chrono::seconds(10));
+  EXPECT_TRUE(driver.isConversionRequired(mbbsEmuDat.c_str()));
+  // checking doesn't touch the stale DB, even when asked to refresh it
+  EXPECT_TRUE(driver.isConversionRequired(mbbsEmuDat.c_str(),
+                                          /* refreshUnchanged= */ true));
+  EXPECT_TRUE(std::filesystem::exists(dbPath));
+
+  // opening right after the check brings the stale DB up to date
+  ASSERT_EQ(driver.open(mbbsEmuDat.c_str()), BtrieveError::Success);
+  EXPECT_EQ(driver.getRecordCount(),
+            readAllRecords(mbbsEmuDat.c_str()).size());
+  EXPECT_FALSE(BtrieveDriver(new SqliteDatabase())
+                   .isConversionRequired(mbbsEmuDat.c_str()));
+}
+
+TEST_F(BtrieveDriverTest, KeepsDatabaseWhenNewerDatIsUnchanged) {
+  auto mbbsEmuDat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+  std::filesystem::path dbPath(mbbsEmuDat);
+  dbPath.replace_extension(".db");
+
+  auto expected = readAllRecords(mbbsEmuDat.c_str());
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    ASSERT_EQ(driver.open(mbbsEmuDat.c_str()), BtrieveError::Success);
+    EXPECT_FALSE(driver.getKeys().empty());
+
+    MBBSEmuRecordStruct record;
+    memset(&record, 0, sizeof(record));
+    strcpy(record.key0, "Sysop");
+    record.key1 = 9999;
+    strcpy(record.key2, "9999");
+    auto insertedRecord = driver.insertRecord(std::basic_string_view<uint8_t>(
+        reinterpret_cast<uint8_t *>(&record), sizeof(record)));
+    ASSERT_EQ(insertedRecord.first, BtrieveError::Success);
+    // the autoincremented key is filled in
+    expected.push_back(
+        driver.getRecord(insertedRecord.second).second.getData());
+  }
+
+  std::filesystem::last_write_time(
+      mbbsEmuDat, std::filesystem::last_write_time(dbPath) +
+                      std::chrono::seconds(10));
+
+  // reconverting would have dropped the inserted record
+  BtrieveDriver driver(new SqliteDatabase());
+  ASSERT_EQ(driver.open(mbbsEmuDat.c_str()), BtrieveError::Success);
+  expectRecords(driver, expected);
+  // and the DB's time is brought up to the DAT's, so it isn't hashed again
+  EXPECT_EQ(std::filesystem::last_write_time(dbPath),
+            std::filesystem::last_write_time(mbbsEmuDat));
+}
+
+// Rewrites the last byte of every copy of record in the file fileName, as a
+// legacy tool updating it in place would, and makes the file newer than its
+// DB. Unless keepUsageCounts is set, the usage count of each page holding a
+// copy is bumped too, like Btrieve does on every write. Returns the changed
+// record.
+static std::vector<uint8_t> changeRecordInDat(
+    const std::wstring &fileName, const std::vector<uint8_t> &record,
+    bool keepUsageCounts = false) {
+  std::fstream dat(fromPath(fileName),
+                   std::ios::in | std::ios::out | std::ios::binary);
+  std::vector<uint8_t> contents((std::istreambuf_iterator<char>(dat)),
+                                std::istreambuf_iterator<char>());
+  std::vector<uint8_t> changed(record);
+  changed.back() ^= 0xFF;
+  const size_t pageLength = contents[8] | contents[9] << 8;
+
+  for (auto iter = contents.begin();
+       (iter = std::search(iter, contents.end(), record.begin(),
+                           record.end())) != contents.end();
+       ++iter) {
+    dat.seekp(iter - contents.begin() + record.size() - 1);
+    dat.put(static_cast<char>(changed.back()));
+
+    if (!keepUsageCounts) {
+      // the usage count follows the page number, below the data page flag
+      const size_t page = (iter - contents.begin()) / pageLength * pageLength;
+      dat.seekp(page + 4);
+      dat.put(static_cast<char>(contents[page + 4] + 1));
+    }
+  }
+  dat.close();
+
+  std::filesystem::path dbPath(fileName);
+  dbPath.replace_extension(".db");
+  std::filesystem::last_write_time(
+      fileName,
+      std::filesystem::last_write_time(dbPath) + std::chrono::seconds(10));
+  return changed;
+}
+
+TEST_F(BtrieveDriverTest, ReconvertsOnlyChangedPages) {
+  auto dat = tempPath->copyToTempPath("assets/WCCACMS2.DAT");
+  auto original = readAllRecords(dat.c_str());
+  ASSERT_EQ(original.size(), 7639u);
+
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  }
+  auto changed = changeRecordInDat(dat, original[4000]);
+
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    ASSERT_EQ(driver.getRecordCount(), original.size());
+
+    // records on unchanged pages keep their ids, while the changed page's
+    // records were removed and added back at the end
+    auto first = driver.getRecord(1);
+    ASSERT_TRUE(first.first);
+    EXPECT_EQ(first.second.getData(), original[0]);
+    EXPECT_FALSE(driver.getRecord(4001).first);
+
+    auto expected = readAllRecords(dat.c_str());
+    EXPECT_NE(std::find(expected.begin(), expected.end(), changed),
+              expected.end());
+    expectRecords(driver, expected, /* inOrder= */ false);
+  }
+
+  // and the DAT's new contents are what the database now matches
+  EXPECT_FALSE(
+      BtrieveDriver(new SqliteDatabase()).isConversionRequired(dat.c_str()));
+}
+
+TEST_F(BtrieveDriverTest, KeepsPagesWithUnchangedUsageCounts) {
+  auto dat = tempPath->copyToTempPath("assets/WCCACMS2.DAT");
+  auto original = readAllRecords(dat.c_str());
+
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  }
+  // a v6 page whose usage count stayed the same wasn't written, so it isn't
+  // read again, and a change made behind Btrieve's back goes unnoticed
+  changeRecordInDat(dat, original[4000], /* keepUsageCounts= */ true);
+  changeRecordInDat(dat, original[10]);
+
+  BtrieveDriver driver(new SqliteDatabase());
+  ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  ASSERT_EQ(driver.getRecordCount(), original.size());
+  auto kept = driver.getRecord(4001);
+  ASSERT_TRUE(kept.first);
+  EXPECT_EQ(kept.second.getData(), original[4000]);
+  // while the page whose usage count was bumped was
+  EXPECT_FALSE(driver.getRecord(11).first);
+}
+
+// Rewrites the last byte of record in the file fileName and moves the data
+// page holding it to the end of the file, as Btrieve's shadow paging would,
+// but leaves the page's usage count as it was, as it would be once the count
+// wrapped around. Only the pages mapped by the first PAT pair are looked at.
+// Makes the file newer than its DB and returns the changed record.
+static std::vector<uint8_t> moveRecordPageInDat(
+    const std::wstring &fileName, const std::vector<uint8_t> &record) {
+  std::vector<uint8_t> contents;
+  {
+    std::ifstream dat(fromPath(fileName), std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(dat),
+                    std::istreambuf_iterator<char>());
+  }
+  std::vector<uint8_t> changed(record);
+  changed.back() ^= 0xFF;
+  const size_t pageLength = contents[8] | contents[9] << 8;
+  const size_t newPage = contents.size() / pageLength;
+
+  // the PAT entries of the first pair, pages 2 and 3, are the physical page
+  // number's high byte, the page type, then its low word
+  const auto findPatEntries = [&contents, pageLength](size_t page) {
+    std::vector<size_t> entries;
+    for (size_t pat = 2; pat <= 3; ++pat) {
+      for (size_t entry = pat * pageLength + 8;
+           entry + 4 <= (pat + 1) * pageLength; entry += 4) {
+        if (contents[entry + 1] == 'D' &&
+            static_cast<size_t>(contents[entry] << 16 |
+                                contents[entry + 3] << 8 |
+                                contents[entry + 2]) == page) {
+          entries.push_back(entry);
+        }
+      }
+    }
+    return entries;
+  };
+
+  for (auto iter = contents.begin();
+       (iter = std::search(iter, contents.end(), record.begin(),
+                           record.end())) != contents.end();
+       ++iter) {
+    const size_t page = (iter - contents.begin()) / pageLength;
+    const auto entries = findPatEntries(page);
+    if (entries.empty()) {
+      // a shadow copy
+      continue;
+    }
+
+    for (size_t entry : entries) {
+      contents[entry] = static_cast<uint8_t>(newPage >> 16);
+      contents[entry + 2] = static_cast<uint8_t>(newPage);
+      contents[entry + 3] = static_cast<uint8_t>(newPage >> 8);
+    }
+    contents[iter - contents.begin() + record.size() - 1] = changed.back();
+    contents.insert(contents.end(), contents.begin() + page * pageLength,
+                    contents.begin() + (page + 1) * pageLength);
+    break;
+  }
+  EXPECT_EQ(contents.size(), (newPage + 1) * pageLength);
+
+  {
+    std::ofstream dat(fromPath(fileName), std::ios::binary | std::ios::trunc);
+    dat.write(reinterpret_cast<const char *>(contents.data()),
+              contents.size());
+  }
+
+  std::filesystem::path dbPath(fileName);
+  dbPath.replace_extension(".db");
+  std::filesystem::last_write_time(
+      fileName,
+      std::filesystem::last_write_time(dbPath) + std::chrono::seconds(10));
+  return changed;
+}
+
+TEST_F(BtrieveDriverTest, RereadsMovedPagesWithUnchangedUsageCounts) {
+  auto dat = tempPath->copyToTempPath("assets/WCCACMS2.DAT");
+  auto original = readAllRecords(dat.c_str());
+
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  }
+  auto changed = moveRecordPageInDat(dat, original[10]);
+
+  // the page's usage count matches, but it was written somewhere else
+  BtrieveDriver driver(new SqliteDatabase());
+  ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  ASSERT_EQ(driver.getRecordCount(), original.size());
+  EXPECT_FALSE(driver.getRecord(11).first);
+  auto expected = readAllRecords(dat.c_str());
+  EXPECT_NE(std::find(expected.begin(), expected.end(), changed),
+            expected.end());
+  expectRecords(driver, expected, /* inOrder= */ false);
+}
+
+TEST_F(BtrieveDriverTest, ReconvertsEverythingAfterDatabaseChanges) {
+  auto dat = tempPath->copyToTempPath("assets/WCCACMS2.DAT");
+  auto original = readAllRecords(dat.c_str());
+
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    ASSERT_EQ(driver.deleteAll(), BtrieveError::Success);
+  }
+  changeRecordInDat(dat, original[4000]);
+
+  // the records of unchanged pages are back too, since the database was
+  // converted again
+  BtrieveDriver driver(new SqliteDatabase());
+  ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  expectRecords(driver, readAllRecords(dat.c_str()));
+}
+
+TEST_F(BtrieveDriverTest, ConvertedDatabaseIsSharedAfterLoad) {
+  // loaded in place, then built in memory and written out
+  for (uint64_t inMemoryConversionLimit : {uint64_t{0}, uint64_t{1} << 30}) {
+    SqliteDatabase *database = new SqliteDatabase();
+    database->setInMemoryConversionLimit(inMemoryConversionLimit);
+    BtrieveDriver driver(database);
+
+    auto mbbsEmuDat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+    std::filesystem::path dbPath(mbbsEmuDat);
+    dbPath.replace_extension(".db");
+    std::filesystem::remove(dbPath);
+
+    ASSERT_EQ(driver.open(mbbsEmuDat.c_str()), BtrieveError::Success);
+
+    // the conversion's exclusive lock must be gone while the driver stays
+    // open
+    sqlite3 *db;
+    ASSERT_EQ(sqlite3_open_v2(fromPath(dbPath).c_str(), &db,
+                              SQLITE_OPEN_READWRITE, nullptr),
+              SQLITE_OK);
+
+    std::string recordCount;
+    ASSERT_EQ(sqlite_exec(db, "SELECT COUNT(*) FROM data_t",
+                          [&recordCount](int numResults, char **data,
+                                         char **columns) {
+                            recordCount = data[0];
+                          }),
+              SQLITE_OK);
+    EXPECT_EQ(recordCount, "4");
+
+    std::string integrity;
+    ASSERT_EQ(sqlite_exec(db, "PRAGMA integrity_check",
+                          [&integrity](int numResults, char **data,
+                                       char **columns) {
+                            integrity = data[0];
+                          }),
+              SQLITE_OK);
+    EXPECT_EQ(integrity, "ok");
+
+    ASSERT_EQ(sqlite3_close(db), SQLITE_OK);
+
+    // and the driver's own connection can still write
+    MBBSEmuRecordStruct record;
+    memset(&record, 0, sizeof(record));
+    strcpy(record.key0, "Paladine");
+    record.key1 = 31337;
+    strcpy(record.key2, "In orbe terrarum, optimus sum");
+    auto insertedRecord = driver.insertRecord(std::basic_string_view<uint8_t>(
+        reinterpret_cast<uint8_t *>(&record), sizeof(record)));
+    EXPECT_EQ(insertedRecord.first, BtrieveError::Success);
+    EXPECT_EQ(driver.getRecordCount(), 5u);
+
+    // and read it back by key on whichever connection it ended up with
+    ASSERT_EQ(driver.performOperation(
+                  1,
+                  std::basic_string_view<uint8_t>(
+                      reinterpret_cast<uint8_t *>(&record.key1),
+                      sizeof(record.key1)),
+                  OperationCode::QueryEqual),
+              BtrieveError::Success);
+    EXPECT_EQ(driver.getPosition(), insertedRecord.second);
+  }
+}
+
+TEST_F(BtrieveDriverTest, PipelinedConversion) {
+  for (auto asset : {"assets/WCCACMS2.DAT", "assets/VARIABLE.DAT"}) {
+    auto expected = readAllRecords(toWideString(asset).c_str());
+
+    BtrieveDriver driver(new SqliteDatabase());
+    driver.setPipelinedConversion(true);
+    unsigned int recordsConverted = 0;
+    unsigned int recordCount = 0;
+    driver.setConversionProgress(
+        [&recordsConverted, &recordCount](unsigned int converted,
+                                          unsigned int total) {
+          EXPECT_GE(converted, recordsConverted);
+          recordsConverted = converted;
+          recordCount = total;
+        });
+
+    auto dat = tempPath->copyToTempPath(asset);
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    EXPECT_EQ(recordCount, expected.size());
+    EXPECT_EQ(recordsConverted, recordCount);
+    expectRecords(driver, expected);
+  }
+}
+
+TEST_F(BtrieveDriverTest, SortedConversion) {
+  for (int sortKey : {0, 1, 2}) {
+    auto expected = readAllRecords(_TEXT("assets/WCCACMS2.DAT"));
+
+    BtrieveDriver driver(new SqliteDatabase());
+    driver.setConversionSortKey(sortKey);
+    // the second one is sorted through runs written out to files, and the
+    // last one goes through a pipeline too
+    if (sortKey == 1) {
+      driver.setConversionSortMemoryLimit(64 * 1024);
+    }
+    driver.setPipelinedConversion(sortKey == 2);
+    std::vector<unsigned int> progress;
+    driver.setConversionProgress(
+        [&progress](unsigned int converted, unsigned int total) {
+          progress.push_back(converted);
+        });
+    auto dat = tempPath->copyToTempPath("assets/WCCACMS2.DAT");
+    // converted again for every key
+    std::filesystem::path dbPath(dat);
+    dbPath.replace_extension(".db");
+    std::filesystem::remove(dbPath);
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    ASSERT_EQ(driver.getRecordCount(), expected.size());
+
+    // nothing is stored while the records are read, then they're stored a
+    // batch at a time
+    ASSERT_FALSE(progress.empty());
+    EXPECT_EQ(progress.front(), 0u);
+    EXPECT_TRUE(std::is_sorted(progress.begin(), progress.end()));
+    EXPECT_EQ(progress.back(), expected.size());
+    EXPECT_GT(std::count_if(progress.begin(), progress.end(),
+                            [&expected](unsigned int converted) {
+                              return converted > 0 &&
+                                     converted < expected.size();
+                            }),
+              0);
+
+    // the physical order follows the key, and records with the same key
+    // keep the order they were read in. WCCACMS2 has a single key, so the
+    // others fall back to it.
+    const Key &key = driver.getKeys()[0];
+    const auto keyOf = [&key](const std::vector<uint8_t> &record) {
+      return key.extractKeyInRecordToSqliteObject(
+          std::basic_string_view<uint8_t>(record.data(), record.size()));
+    };
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&keyOf](const std::vector<uint8_t> &left,
+                              const std::vector<uint8_t> &right) {
+                       return SortedRecordLoader::compareKeys(
+                                  keyOf(left), keyOf(right)) < 0;
+                     });
+    expectRecords(driver, expected);
+  }
+}
+
+TEST_F(BtrieveDriverTest, ConversionStats) {
+  for (auto asset : {"assets/WCCACMS2.DAT", "assets/VARIABLE.DAT"}) {
+    for (bool sorted : {false, true}) {
+      auto dat = tempPath->copyToTempPath(asset);
+      std::filesystem::path dbPath(dat);
+      dbPath.replace_extension(".db");
+      std::filesystem::remove(dbPath);
+
+      BtrieveDriver driver(new SqliteDatabase());
+      driver.setConversionSortKey(sorted ? 0 : -1);
+      ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+
+      expectRecords(driver, readAllRecords(dat.c_str()),
+                    /* inOrder= */ !sorted);
+
+      const ConversionStats &stats = driver.getConversionStats();
+      EXPECT_EQ(stats.recordsRead, driver.getRecordCount());
+      EXPECT_EQ(stats.recordsStored, driver.getRecordCount());
+      EXPECT_GT(stats.pagesRead, 0u);
+      EXPECT_GT(stats.bytesRead, stats.pagesRead);
+      EXPECT_GT(stats.insertTime.count(), 0);
+      EXPECT_GT(stats.getRecordsPerSecond(), 0.0);
+      // these all run on the calling thread, one after the other
+      EXPECT_GE(stats.totalTime, stats.parseTime + stats.readTime +
+                                     stats.sortTime + stats.pageTableTime);
+      EXPECT_EQ(stats.sortTime.count() > 0, sorted);
+      // sorted conversions don't save their pages
+      EXPECT_EQ(stats.pageTableTime.count() > 0, !sorted);
+    }
+  }
+
+  // opening the converted database leaves them empty
+  auto dat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    EXPECT_GT(driver.getConversionStats().totalTime.count(), 0);
+  }
+  BtrieveDriver driver(new SqliteDatabase());
+  ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  EXPECT_EQ(driver.getConversionStats().totalTime.count(), 0);
+  EXPECT_EQ(driver.getConversionStats().recordsStored, 0u);
+}
+
+TEST_F(BtrieveDriverTest, BackgroundConversion) {
+  for (auto asset : {"assets/WCCACMS2.DAT", "assets/VARIABLE.DAT"}) {
+    auto dat = tempPath->copyToTempPath(asset);
+    auto expected = readAllRecords(dat.c_str());
+
+    // hold the conversion up after its first batch of records
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    BtrieveDriver driver(new SqliteDatabase());
+    driver.setBackgroundConversion(true);
+    driver.setConversionSortKey(0);
+    driver.setConversionProgress(
+        [released](unsigned int converted, unsigned int total) {
+          released.wait();
+        });
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    EXPECT_TRUE(driver.isConverting());
+    EXPECT_EQ(driver.getConversionStats().totalTime.count(), 0);
+
+    // physical steps and direct reads are served from the DAT meanwhile
+    ASSERT_EQ(driver.getRecordCount(), expected.size());
+    ASSERT_EQ(driver.getPosition(), 1u);
+    BtrieveError error = BtrieveError::Success;
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQ(error, BtrieveError::Success);
+      auto data = driver.getRecord();
+      ASSERT_TRUE(data.first);
+      ASSERT_EQ(data.second.getData(), expected[i]);
+
+      error = driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                      OperationCode::StepNext);
+    }
+    EXPECT_EQ(error, BtrieveError::EndOfFile);
+    auto data = driver.getRecord(100);
+    ASSERT_TRUE(data.first);
+    EXPECT_EQ(data.second.getData(), expected[99]);
+    EXPECT_TRUE(driver.isConverting());
+
+    // a key operation waits for the conversion, which goes on from the same
+    // position. Records are stored in the DAT's order, despite the sort key.
+    release.set_value();
+    ASSERT_EQ(driver.performOperation(0, std::basic_string_view<uint8_t>(),
+                                      OperationCode::QueryFirst),
+              BtrieveError::Success);
+    EXPECT_FALSE(driver.isConverting());
+    EXPECT_EQ(driver.getConversionStats().recordsStored, expected.size());
+    EXPECT_GT(driver.getConversionStats().totalTime.count(), 0);
+    ASSERT_EQ(driver.getRecordCount(), expected.size());
+
+    driver.setPosition(100);
+    ASSERT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                      OperationCode::StepNext),
+              BtrieveError::Success);
+    EXPECT_EQ(driver.getPosition(), 101u);
+    EXPECT_EQ(driver.getRecord().second.getData(), expected[100]);
+    for (size_t i = 0; i < expected.size(); ++i) {
+      data = driver.getRecord(i + 1);
+      ASSERT_TRUE(data.first);
+      ASSERT_EQ(data.second.getData(), expected[i]);
+    }
+  }
+
+  // the converted database is kept
+  auto dat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    driver.setBackgroundConversion(true);
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    driver.waitForConversion();
+  }
+  BtrieveDriver driver(new SqliteDatabase());
+  EXPECT_FALSE(driver.isConversionRequired(dat.c_str()));
+}
+
+TEST_F(BtrieveDriverTest, BackgroundConversionSwitchesOverWhenDone) {
+  auto dat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+  auto expected = readAllRecords(dat.c_str());
+
+  BtrieveDriver driver(new SqliteDatabase());
+  driver.setBackgroundConversion(true);
+  ASSERT_EQ(driver.open(dat.c_str(), OpenMode::ReadOnly),
+            BtrieveError::Success);
+  while (driver.isConverting()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  EXPECT_GT(driver.getConversionStats().recordsStored, 0u);
+  EXPECT_EQ(driver.getRecordCount(), expected.size());
+  ASSERT_EQ(driver.getPosition(), 1u);
+  EXPECT_EQ(driver.getRecord().second.getData(), expected[0]);
+  // and it was reopened read-only
+  EXPECT_NE(driver.insertRecord(std::basic_string_view<uint8_t>(
+                                    expected[0].data(), expected[0].size()))
+                .first,
+            BtrieveError::Success);
+}
+
+TEST_F(BtrieveDriverTest, BackgroundConversionSkipsDuplicateRecords) {
+  auto dat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+  auto original = readAllRecords(dat.c_str());
+  ASSERT_EQ(original.size(), 4u);
+
+  // give the second record the first one's unique key 1, so it can't be
+  // stored
+  {
+    std::fstream file(fromPath(dat),
+                      std::ios::in | std::ios::out | std::ios::binary);
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)),
+                                  std::istreambuf_iterator<char>());
+    auto iter = std::search(contents.begin(), contents.end(),
+                            original[1].begin(), original[1].end());
+    ASSERT_NE(iter, contents.end());
+    file.seekp(iter - contents.begin() + offsetof(MBBSEmuRecordStruct, key1));
+    file.write(reinterpret_cast<const char *>(original[0].data()) +
+                   offsetof(MBBSEmuRecordStruct, key1),
+               sizeof(int32_t));
+  }
+
+  const auto records = readAllRecords(dat.c_str());
+
+  std::filesystem::path dbPath(dat);
+  dbPath.replace_extension(".db");
+  // the records after the duplicate move back once it isn't stored, and the
+  // duplicate itself lands on the record stored before it
+  for (auto [position, convertedPosition] :
+       {std::pair<uint64_t, uint64_t>(3, 2), {2, 1}}) {
+    std::filesystem::remove(dbPath);
+
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    BtrieveDriver driver(new SqliteDatabase());
+    driver.setBackgroundConversion(true);
+    // the records stored are only known on a pipeline's writer thread
+    driver.setPipelinedConversion(position == 2);
+    driver.setConversionProgress(
+        [released](unsigned int converted, unsigned int total) {
+          released.wait();
+        });
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+
+    // every record of the DAT is served meanwhile
+    driver.setPosition(position);
+    EXPECT_EQ(driver.getRecord().second.getData(), records[position - 1]);
+
+    release.set_value();
+    ASSERT_EQ(driver.waitForConversion(), BtrieveError::Success);
+    EXPECT_EQ(driver.getConversionStats().recordsStored, 3u);
+    EXPECT_EQ(driver.getPosition(), convertedPosition);
+    EXPECT_EQ(driver.getRecord().second.getData(),
+              records[convertedPosition == 1 ? 0 : position - 1]);
+    ASSERT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                      OperationCode::StepNext),
+              BtrieveError::Success);
+    EXPECT_EQ(driver.getRecord().second.getData(), records[position]);
+  }
+}
+
+TEST_F(BtrieveDriverTest, BackgroundConversionServesMetadata) {
+  auto dat = tempPath->copyToTempPath("assets/MBBSEMU.DAT");
+
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  BtrieveDriver driver(new SqliteDatabase());
+  driver.setBackgroundConversion(true);
+  driver.setConversionProgress(
+      [released](unsigned int converted, unsigned int total) {
+        released.wait();
+      });
+  ASSERT_EQ(driver.open(dat.c_str(), OpenMode::ReadOnly),
+            BtrieveError::Success);
+
+  // the metadata comes from the DAT, without waiting for the conversion
+  const std::vector<Key> &keys = driver.getKeys();
+  EXPECT_EQ(keys.size(), 4u);
+  EXPECT_EQ(driver.getRecordLength(), 74u);
+  EXPECT_FALSE(driver.isVariableLengthRecords());
+  EXPECT_TRUE(driver.isConverting());
+
+  // and once the sql database takes over, from it, while the keys handed out
+  // before are still there
+  release.set_value();
+  ASSERT_EQ(driver.waitForConversion(), BtrieveError::Success);
+  EXPECT_EQ(keys.size(), 4u);
+  EXPECT_EQ(driver.getKeys().size(), 4u);
+  EXPECT_EQ(driver.getRecordLength(), 74u);
+  EXPECT_FALSE(driver.isVariableLengthRecords());
+  EXPECT_EQ(driver.getPosition(), 1u);
+}
+
+TEST_F(BtrieveDriverTest, FailedBackgroundConversionClosesTheFile) {
+  auto dat = tempPath->copyToTempPath("assets/WCCACMS2.DAT");
+  std::filesystem::path dbPath(dat);
+  dbPath.replace_extension(".db");
+
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  BtrieveDriver driver(new SqliteDatabase());
+  driver.setBackgroundConversion(true);
+  driver.setConversionProgress(
+      [released](unsigned int converted, unsigned int total) {
+        released.wait();
+        throw BtrieveException(BtrieveError::IOError, "Disk full");
+      });
+  ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  ASSERT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                    OperationCode::StepNext),
+            BtrieveError::Success);
+
+  release.set_value();
+  EXPECT_EQ(driver.waitForConversion(), BtrieveError::IOError);
+  EXPECT_FALSE(driver.isConverting());
+  EXPECT_FALSE(std::filesystem::exists(dbPath));
+
+  // and everything reports it from then on, steps included
+  EXPECT_EQ(driver.waitForConversion(), BtrieveError::IOError);
+  EXPECT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                    OperationCode::StepNext),
+            BtrieveError::IOError);
+  EXPECT_EQ(driver.performOperation(0, std::basic_string_view<uint8_t>(),
+                                    OperationCode::QueryFirst),
+            BtrieveError::IOError);
+  EXPECT_FALSE(driver.getRecord().first);
+  EXPECT_EQ(driver.getRecordCount(), 0u);
+  EXPECT_TRUE(driver.getKeys().empty());
+  EXPECT_EQ(driver.insertRecord(std::basic_string_view<uint8_t>()).first,
+            BtrieveError::IOError);
+  EXPECT_FALSE(driver.deleteAll());
+
+  // until the file is opened again
+  driver.setBackgroundConversion(false);
+  driver.setConversionProgress(nullptr);
+  ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  EXPECT_EQ(driver.getRecordCount(), 7639u);
+}
+
+TEST_F(BtrieveDriverTest, ClosingCancelsBackgroundConversion) {
+  auto dat = tempPath->copyToTempPath("assets/WCCACMS2.DAT");
+  std::filesystem::path dbPath(dat);
+  dbPath.replace_extension(".db");
+
+  std::promise<void> started;
+  std::atomic<bool> released(false);
+  bool first = true;
+  std::thread releaser;
+  {
+    BtrieveDriver driver(new SqliteDatabase());
+    driver.setBackgroundConversion(true);
+    driver.setConversionProgress(
+        [&](unsigned int converted, unsigned int total) {
+          if (first) {
+            first = false;
+            started.set_value();
+          }
+          while (!released) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        });
+    ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+    started.get_future().wait();
+
+    // let the conversion go on only once closing has cancelled it
+    releaser = std::thread([&released]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      released = true;
+    });
+  }
+  releaser.join();
+
+  // nothing half converted is left behind
+  EXPECT_FALSE(std::filesystem::exists(dbPath));
+  BtrieveDriver driver(new SqliteDatabase());
+  ASSERT_EQ(driver.open(dat.c_str()), BtrieveError::Success);
+  EXPECT_EQ(driver.getRecordCount(), 7639u);
+}
+
 TEST_F(BtrieveDriverTest, StepNext) {
   BtrieveDriver driver(new SqliteDatabase());
 
@@ -461,6 +1330,84 @@ TEST_F(BtrieveDriverTest, RandomInvalidAccess) {
   ASSERT_EQ(data.second.getData().size(), 0u);
 }
 
+TEST_F(BtrieveDriverTest, PositionsPast32Bits) {
+  const uint64_t base = 0x100000000ull;
+  auto mbbsEmuDb = tempPath->copyToTempPath("assets/MBBSEMU.DB");
+
+  // move the last two records past what fits in 32 bits
+  sqlite3 *db;
+  ASSERT_EQ(sqlite3_open_v2(toStdString(mbbsEmuDb.c_str()).c_str(), &db,
+                            SQLITE_OPEN_READWRITE, nullptr),
+            SQLITE_OK);
+  ASSERT_EQ(
+      sqlite3_exec(db, "UPDATE data_t SET id = id + 4294967296 WHERE id > 2",
+                   nullptr, nullptr, nullptr),
+      SQLITE_OK);
+  ASSERT_EQ(sqlite3_close(db), SQLITE_OK);
+
+  BtrieveDriver driver(new SqliteDatabase());
+  driver.open(mbbsEmuDb.c_str());
+
+  ASSERT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                    OperationCode::StepLast),
+            BtrieveError::Success);
+  ASSERT_EQ(driver.getPosition(), base + 4);
+  std::pair<bool, Record> data(driver.getRecord());
+  ASSERT_TRUE(data.first);
+  EXPECT_EQ(data.second.getPosition(), base + 4);
+  EXPECT_EQ(reinterpret_cast<const MBBSEmuRecordStruct *>(
+                data.second.getData().data())
+                ->key1,
+            -615634567);
+
+  ASSERT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                    OperationCode::StepPrevious),
+            BtrieveError::Success);
+  ASSERT_EQ(driver.getPosition(), base + 3);
+  ASSERT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
+                                    OperationCode::StepPrevious),
+            BtrieveError::Success);
+  ASSERT_EQ(driver.getPosition(), 2u);
+
+  data = driver.getRecord(base + 3);
+  ASSERT_TRUE(data.first);
+  EXPECT_EQ(reinterpret_cast<const MBBSEmuRecordStruct *>(
+                data.second.getData().data())
+                ->key1,
+            1052234073);
+  // the low 32 bits alone don't name a record
+  EXPECT_FALSE(driver.getRecord(3).first);
+
+  // key 0 is the same for every record, so walking it relies on the cursor
+  // seeking back to the current row id when it changes direction
+  ASSERT_EQ(driver.performOperation(0, std::basic_string_view<uint8_t>(),
+                                    OperationCode::QueryFirst),
+            BtrieveError::Success);
+  std::vector<uint64_t> positions = {driver.getPosition()};
+  while (driver.performOperation(0, std::basic_string_view<uint8_t>(),
+                                 OperationCode::QueryNext) ==
+         BtrieveError::Success) {
+    positions.push_back(driver.getPosition());
+  }
+  EXPECT_EQ(positions, std::vector<uint64_t>({1, 2, base + 3, base + 4}));
+
+  ASSERT_EQ(driver.performOperation(0, std::basic_string_view<uint8_t>(),
+                                    OperationCode::QueryPrevious),
+            BtrieveError::Success);
+  EXPECT_EQ(driver.getPosition(), base + 3);
+
+  MBBSEmuRecordStruct record;
+  memset(&record, 0, sizeof(record));
+  strcpy(record.key0, "Paladine");
+  record.key1 = 31337;
+  strcpy(record.key2, "In orbe terrarum, optimus sum");
+
+  ASSERT_EQ(driver.insertRecord(std::basic_string_view<uint8_t>(
+                reinterpret_cast<uint8_t *>(&record), sizeof(record))),
+            std::make_pair(BtrieveError::Success, base + 5));
+  ASSERT_TRUE(driver.getRecord(base + 5).first);
+}
+
 TEST_F(BtrieveDriverTest, GetRecordCount) {
   BtrieveDriver driver(new SqliteDatabase());
 
@@ -588,7 +1535,7 @@ TEST_F(BtrieveDriverTest, InsertionTest) {
 
   ASSERT_EQ(driver.insertRecord(std::basic_string_view<uint8_t>(
                 reinterpret_cast<uint8_t *>(&record), sizeof(record))),
-            std::make_pair(BtrieveError::Success, 5u));
+            std::make_pair(BtrieveError::Success, uint64_t{5}));
 
   std::pair<bool, Record> data(driver.getRecord(5));
   ASSERT_TRUE(data.first);
@@ -620,7 +1567,7 @@ TEST_F(BtrieveDriverTest, InsertionTestManualAutoincrementedValue) {
 
   ASSERT_EQ(driver.insertRecord(std::basic_string_view<uint8_t>(
                 reinterpret_cast<uint8_t *>(&record), sizeof(record))),
-            std::make_pair(BtrieveError::Success, 5u));
+            std::make_pair(BtrieveError::Success, uint64_t{5}));
 
   std::pair<bool, Record> data(driver.getRecord(5));
   ASSERT_TRUE(data.first);
@@ -653,7 +1600,7 @@ TEST_F(BtrieveDriverTest, InsertionTestSubSize) {
   // chop off the last 14 bytes rather than the full 74
   ASSERT_EQ(driver.insertRecord(std::basic_string_view<uint8_t>(
                 reinterpret_cast<uint8_t *>(&record), sizeof(record) - 14)),
-            std::make_pair(BtrieveError::Success, 5u));
+            std::make_pair(BtrieveError::Success, uint64_t{5}));
   std::pair<bool, Record> data(driver.getRecord(5));
   ASSERT_TRUE(data.first);
   ASSERT_EQ(data.second.getData().size(), 74u);
@@ -684,7 +1631,7 @@ TEST_F(BtrieveDriverTest, InsertionConstraintFailure) {
 
   ASSERT_EQ(driver.insertRecord(std::basic_string_view<uint8_t>(
                 reinterpret_cast<uint8_t *>(&record), sizeof(record))),
-            std::make_pair(BtrieveError::DuplicateKeyValue, 0u));
+            std::make_pair(BtrieveError::DuplicateKeyValue, uint64_t{0}));
 
   ASSERT_EQ(driver.getRecordCount(), 4u);
 }
@@ -1882,15 +2829,15 @@ TEST_F(BtrieveDriverTest, ACSSeekByKey_Zstring) {
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Sysop").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 1u));
+            std::make_pair(BtrieveError::Success, uint64_t{1}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Paladine").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 2u));
+            std::make_pair(BtrieveError::Success, uint64_t{2}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Testing").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 3u));
+            std::make_pair(BtrieveError::Success, uint64_t{3}));
 
   std::basic_string_view<uint8_t> key(
       reinterpret_cast<const uint8_t *>("paladine"), 8);
@@ -1914,15 +2861,15 @@ TEST_F(BtrieveDriverTest, ACSSeekByKey_String) {
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Sysop").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 1u));
+            std::make_pair(BtrieveError::Success, uint64_t{1}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Paladine").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 2u));
+            std::make_pair(BtrieveError::Success, uint64_t{2}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Testing").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 3u));
+            std::make_pair(BtrieveError::Success, uint64_t{3}));
 
   char searchKey[30];
   memset(searchKey, 0xFF, sizeof(searchKey));
@@ -1952,7 +2899,7 @@ TEST_F(BtrieveDriverTest, ACSSeekByKey_Lstring) {
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Sysop").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 1u));
+            std::make_pair(BtrieveError::Success, uint64_t{1}));
 
   auto record = createRecord("Paladine");
   // make this an Lstring
@@ -1961,11 +2908,11 @@ TEST_F(BtrieveDriverTest, ACSSeekByKey_Lstring) {
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 record.data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 2u));
+            std::make_pair(BtrieveError::Success, uint64_t{2}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Testing").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 3u));
+            std::make_pair(BtrieveError::Success, uint64_t{3}));
 
   char searchKey[30];
   memset(searchKey, 0xFF, sizeof(searchKey));
@@ -1996,19 +2943,62 @@ TEST_F(BtrieveDriverTest, ACSInsertDuplicateFails) {
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Sysop").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 1u));
+            std::make_pair(BtrieveError::Success, uint64_t{1}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("sysop").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::DuplicateKeyValue, 0u));
+            std::make_pair(BtrieveError::DuplicateKeyValue, uint64_t{0}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("SysOp").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::DuplicateKeyValue, 0u));
+            std::make_pair(BtrieveError::DuplicateKeyValue, uint64_t{0}));
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("SysoP").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::DuplicateKeyValue, 0u));
+            std::make_pair(BtrieveError::DuplicateKeyValue, uint64_t{0}));
+}
+
+TEST_F(BtrieveDriverTest, BatchedLoadSkipsDuplicates) {
+  SqliteDatabase *database = new SqliteDatabase(SQLITE_OPEN_MEMORY);
+  BtrieveDriver driver(database);
+
+  std::vector<std::vector<uint8_t>> records;
+  for (int i = 0; i < 200; ++i) {
+    char username[32];
+    if (i == 10) {
+      strcpy(username, "user3");
+    } else if (i == 150) {
+      // the key's ACS makes it case insensitive
+      strcpy(username, "USER100");
+    } else {
+      snprintf(username, sizeof(username), "user%d", i);
+    }
+    records.push_back(createRecord(username));
+  }
+
+  std::vector<std::basic_string_view<uint8_t>> batch;
+  for (const auto &record : records) {
+    batch.emplace_back(record.data(), record.size());
+  }
+  std::vector<BtrieveDatabase::LoadRecordResult> results(
+      batch.size(), BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION);
+
+  auto recordLoader = database->create(
+      _TEXT("unused.db"), createACSBtrieveDatabase(KeyDataType::Zstring));
+  recordLoader->onRecordsLoaded(batch, results);
+  recordLoader->onRecordsComplete();
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i], i == 10 || i == 150
+                              ? BtrieveDatabase::LoadRecordResult::SKIP_COUNT
+                              : BtrieveDatabase::LoadRecordResult::COUNT)
+        << i;
+  }
+
+  // the rest are stored in order
+  records.erase(records.begin() + 150);
+  records.erase(records.begin() + 10);
+  expectRecords(driver, records);
 }
 
 TEST_F(BtrieveDriverTest, FloatSeekByKey) {
@@ -2021,12 +3011,12 @@ TEST_F(BtrieveDriverTest, FloatSeekByKey) {
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("Sysop", 1.0f, 2.0).data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 1u));
+            std::make_pair(BtrieveError::Success, uint64_t{1}));
 
   ASSERT_EQ(
       database->insertRecord(std::basic_string_view<uint8_t>(
           createRecord("Paladine", -1.0f, -2.0).data(), ACS_RECORD_LENGTH)),
-      std::make_pair(BtrieveError::Success, 2u));
+      std::make_pair(BtrieveError::Success, uint64_t{2}));
 
   float fkey = -1.0f;
   std::basic_string_view<uint8_t> key(reinterpret_cast<const uint8_t *>(&fkey),
@@ -2093,7 +3083,7 @@ TEST_F(BtrieveDriverTest, KeylessDatabaseEnumeration) {
 
   ASSERT_EQ(database->insertRecord(std::basic_string_view<uint8_t>(
                 createRecord("paladine").data(), ACS_RECORD_LENGTH)),
-            std::make_pair(BtrieveError::Success, 4u));
+            std::make_pair(BtrieveError::Success, uint64_t{4}));
 
   ASSERT_EQ(driver.performOperation(-1, std::basic_string_view<uint8_t>(),
                                     OperationCode::StepFirst),
@@ -0,0 +1,147 @@
+#include "ByteScan.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BTRIEVE_BYTE_SCAN_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER) || defined(__GNUC__)
+#define BTRIEVE_BYTE_SCAN_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define BTRIEVE_BYTE_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+namespace btrieve {
+
+static bool isAllBytesEqualScalar(const uint8_t *data, size_t length,
+                                  uint8_t value) {
+  const uint64_t pattern = 0x0101010101010101ULL * value;
+  size_t i = 0;
+  for (; i + sizeof(pattern) <= length; i += sizeof(pattern)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    if (word != pattern) {
+      return false;
+    }
+  }
+
+  for (; i < length; ++i) {
+    if (data[i] != value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef BTRIEVE_BYTE_SCAN_SSE2
+static bool isAllBytesEqualSSE2(const uint8_t *data, size_t length,
+                                uint8_t value) {
+  const __m128i needle = _mm_set1_epi8(static_cast<char>(value));
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)) != 0xFFFF) {
+      return false;
+    }
+  }
+
+  return isAllBytesEqualScalar(data + i, length - i, value);
+}
+#endif
+
+#ifdef BTRIEVE_BYTE_SCAN_AVX2
+#ifdef _MSC_VER
+#define BTRIEVE_TARGET_AVX2
+#else
+#define BTRIEVE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+BTRIEVE_TARGET_AVX2 static bool isAllBytesEqualAVX2(const uint8_t *data,
+                                                    size_t length,
+                                                    uint8_t value) {
+  const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)) != -1) {
+      return false;
+    }
+  }
+
+  // the compiler doesn't always clear the upper ymm halves before tail calling
+  // into non-VEX code, and mixing the two stalls badly on many CPUs
+  _mm256_zeroupper();
+  return isAllBytesEqualSSE2(data + i, length - i, value);
+}
+
+static bool cpuSupportsAVX2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+
+  // the OS has to save the ymm registers on context switches too
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef BTRIEVE_BYTE_SCAN_NEON
+static bool isAllBytesEqualNEON(const uint8_t *data, size_t length,
+                                uint8_t value) {
+  const uint8x16_t needle = vdupq_n_u8(value);
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    uint64x2_t equal =
+        vreinterpretq_u64_u8(vceqq_u8(vld1q_u8(data + i), needle));
+    if ((vgetq_lane_u64(equal, 0) & vgetq_lane_u64(equal, 1)) != ~0ULL) {
+      return false;
+    }
+  }
+
+  return isAllBytesEqualScalar(data + i, length - i, value);
+}
+#endif
+
+typedef bool (*ByteScanner)(const uint8_t *data, size_t length,
+                            uint8_t value);
+
+static ByteScanner selectByteScanner() {
+#if defined(BTRIEVE_BYTE_SCAN_AVX2)
+  return cpuSupportsAVX2() ? isAllBytesEqualAVX2 : isAllBytesEqualSSE2;
+#elif defined(BTRIEVE_BYTE_SCAN_SSE2)
+  return isAllBytesEqualSSE2;
+#elif defined(BTRIEVE_BYTE_SCAN_NEON)
+  return isAllBytesEqualNEON;
+#else
+  return isAllBytesEqualScalar;
+#endif
+}
+
+bool isAllBytesEqual(const uint8_t *data, size_t length, uint8_t value) {
+  static const ByteScanner scanner = selectByteScanner();
+  return scanner(data, length, value);
+}
+}  // namespace btrieve
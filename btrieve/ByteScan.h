@@ -0,0 +1,23 @@
+#ifndef __BYTE_SCAN_H_
+#define __BYTE_SCAN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "ByteStringViewTraits.h"
+
+namespace btrieve {
+// Returns true if every byte in [data, data + length) equals value, which is
+// trivially the case when length is 0. Compares 16 or 32 bytes at a time with
+// SSE2/AVX2 on x86 (AVX2 only when the CPU supports it) and NEON on ARM,
+// falling back to word-at-a-time comparisons elsewhere. Never allocates.
+bool isAllBytesEqual(const uint8_t *data, size_t length, uint8_t value);
+
+inline bool isAllBytesEqual(std::basic_string_view<uint8_t> data,
+                            uint8_t value) {
+  return isAllBytesEqual(data.data(), data.size(), value);
+}
+}  // namespace btrieve
+
+#endif
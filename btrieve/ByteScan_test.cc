@@ -0,0 +1,54 @@
+#include "ByteScan.h"
+
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+TEST(ByteScan, EmptyIsAllEqual) {
+  EXPECT_TRUE(isAllBytesEqual(nullptr, 0, 0));
+  EXPECT_TRUE(isAllBytesEqual(std::basic_string_view<uint8_t>(), 0xFF));
+}
+
+TEST(ByteScan, AllEqual) {
+  for (uint8_t value : {0x00, 0x20, 0x80, 0xFF}) {
+    for (size_t length = 1; length <= 130; ++length) {
+      std::vector<uint8_t> data(length, value);
+      EXPECT_TRUE(isAllBytesEqual(data.data(), length, value))
+          << "length " << length << " value " << static_cast<int>(value);
+      EXPECT_FALSE(isAllBytesEqual(data.data(), length, value ^ 0x01))
+          << "length " << length << " value " << static_cast<int>(value);
+    }
+  }
+}
+
+TEST(ByteScan, FindsMismatchAtEveryPosition) {
+  // covers the vector loops, their tails and misaligned starts
+  std::vector<uint8_t> data(160, 0);
+  for (size_t start = 0; start < 32; ++start) {
+    for (size_t length = 1; start + length <= data.size(); length += 7) {
+      for (size_t i = 0; i < length; ++i) {
+        data[start + i] = 0x80;
+        EXPECT_FALSE(isAllBytesEqual(data.data() + start, length, 0))
+            << "start " << start << " length " << length << " at " << i;
+        data[start + i] = 0;
+      }
+      EXPECT_TRUE(isAllBytesEqual(data.data() + start, length, 0));
+    }
+  }
+}
+
+TEST(ByteScan, IgnoresBytesOutsideTheRange) {
+  uint8_t data[64];
+  memset(data, 'x', sizeof(data));
+  data[0] = 'a';
+  data[63] = 'a';
+
+  EXPECT_TRUE(isAllBytesEqual(data + 1, 62, 'x'));
+  EXPECT_TRUE(isAllBytesEqual(std::basic_string_view<uint8_t>(data + 1, 62),
+                              'x'));
+  EXPECT_FALSE(isAllBytesEqual(data, 63, 'x'));
+  EXPECT_FALSE(isAllBytesEqual(data + 1, 63, 'x'));
+}
@@ -0,0 +1,65 @@
+#include "ConversionStats.h"
+
+#include <cstdio>
+
+namespace btrieve {
+
+static double toMilliseconds(ConversionStats::Duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static double toSeconds(ConversionStats::Duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+ConversionStats &ConversionStats::operator+=(const ConversionStats &stats) {
+  parseTime += stats.parseTime;
+  readTime += stats.readTime;
+  sortTime += stats.sortTime;
+  keyEncodingTime += stats.keyEncodingTime;
+  insertTime += stats.insertTime;
+  indexTime += stats.indexTime;
+  commitTime += stats.commitTime;
+  pageTableTime += stats.pageTableTime;
+  totalTime += stats.totalTime;
+  pagesRead += stats.pagesRead;
+  bytesRead += stats.bytesRead;
+  fragmentPagesRead += stats.fragmentPagesRead;
+  fragmentPageVisits += stats.fragmentPageVisits;
+  recordsRead += stats.recordsRead;
+  recordsStored += stats.recordsStored;
+  return *this;
+}
+
+double ConversionStats::getRecordsPerSecond() const {
+  const double seconds = toSeconds(totalTime);
+  return seconds > 0 ? recordsStored / seconds : 0.0;
+}
+
+double ConversionStats::getBytesPerSecond() const {
+  const double seconds = toSeconds(totalTime);
+  return seconds > 0 ? bytesRead / seconds : 0.0;
+}
+
+std::string ConversionStats::toString() const {
+  char buf[512];
+  snprintf(buf, sizeof(buf),
+           "%llu/%llu records stored, %llu pages and %llu fragment pages "
+           "read (%llu visits), %.1f MB in %.1f ms: %.0f records/s, %.1f "
+           "MB/s; parse %.1f ms, read %.1f ms, sort %.1f ms, key encoding "
+           "%.1f ms, insert %.1f ms, index %.1f ms, commit %.1f ms, page "
+           "table %.1f ms",
+           static_cast<unsigned long long>(recordsStored),
+           static_cast<unsigned long long>(recordsRead),
+           static_cast<unsigned long long>(pagesRead),
+           static_cast<unsigned long long>(fragmentPagesRead),
+           static_cast<unsigned long long>(fragmentPageVisits),
+           bytesRead / 1e6, toMilliseconds(totalTime), getRecordsPerSecond(),
+           getBytesPerSecond() / 1e6, toMilliseconds(parseTime),
+           toMilliseconds(readTime), toMilliseconds(sortTime),
+           toMilliseconds(keyEncodingTime), toMilliseconds(insertTime),
+           toMilliseconds(indexTime), toMilliseconds(commitTime),
+           toMilliseconds(pageTableTime));
+  return buf;
+}
+}  // namespace btrieve
@@ -0,0 +1,68 @@
+#ifndef __CONVERSION_STATS_H_
+#define __CONVERSION_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace btrieve {
+
+// Where the time went while converting a DAT file to a sql database, and how
+// much was read and stored. Filled in by BtrieveDatabase::readRecordBatches,
+// the RecordLoaders records pass through and BtrieveDriver::open.
+//
+// Phases that run on other threads, like storing records behind a
+// PipelinedRecordLoader, overlap the ones on the calling thread, so the phases
+// can add up to more than totalTime.
+struct ConversionStats {
+  typedef std::chrono::steady_clock::duration Duration;
+
+  // opening the DAT file: its header, PAT and key definitions
+  Duration parseTime{};
+  // reading and decoding data pages and their variable length fragments, as
+  // seen by the thread records are handed over on
+  Duration readTime{};
+  // buffering records and sorting them by key, see SortedRecordLoader
+  Duration sortTime{};
+  // extracting the key values of records and binding them to statements
+  Duration keyEncodingTime{};
+  // running the statements inserting records
+  Duration insertTime{};
+  // building the indices and triggers deferred until every record is stored
+  Duration indexTime{};
+  // committing the conversion, and writing out a database built in memory
+  Duration commitTime{};
+  // saving the checksums of the pages read, see
+  // SqlDatabase::saveConvertedPages
+  Duration pageTableTime{};
+  // the whole conversion, from opening the DAT file to saving its pages
+  Duration totalTime{};
+
+  // data pages read, and the bytes of them and of fragment pages read
+  uint64_t pagesRead = 0;
+  uint64_t bytesRead = 0;
+  // distinct variable length fragment pages read, and the visits to them
+  // while reassembling records, which come back to the same pages
+  uint64_t fragmentPagesRead = 0;
+  uint64_t fragmentPageVisits = 0;
+  // records handed to the RecordLoader, and those it stored
+  uint64_t recordsRead = 0;
+  uint64_t recordsStored = 0;
+
+  // Adds the timings and counters of stats to these, e.g. to total up the
+  // conversions of several files.
+  ConversionStats &operator+=(const ConversionStats &stats);
+
+  // Returns the records stored per second of totalTime, or 0 if it's 0.
+  double getRecordsPerSecond() const;
+
+  // Returns the bytes read per second of totalTime, or 0 if it's 0.
+  double getBytesPerSecond() const;
+
+  // Returns a single line report of the counters, rates and the time spent
+  // in each phase, in milliseconds.
+  std::string toString() const;
+};
+}  // namespace btrieve
+
+#endif
@@ -0,0 +1,63 @@
+#include "ConversionStats.h"
+
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+TEST(ConversionStats, StartsAtZero) {
+  ConversionStats stats;
+
+  EXPECT_EQ(stats.totalTime.count(), 0);
+  EXPECT_EQ(stats.recordsStored, 0u);
+  EXPECT_EQ(stats.getRecordsPerSecond(), 0.0);
+  EXPECT_EQ(stats.getBytesPerSecond(), 0.0);
+}
+
+TEST(ConversionStats, Rates) {
+  ConversionStats stats;
+  stats.totalTime = std::chrono::milliseconds(500);
+  stats.recordsStored = 1000;
+  stats.bytesRead = 4096;
+
+  EXPECT_DOUBLE_EQ(stats.getRecordsPerSecond(), 2000.0);
+  EXPECT_DOUBLE_EQ(stats.getBytesPerSecond(), 8192.0);
+}
+
+TEST(ConversionStats, Adds) {
+  ConversionStats stats;
+  stats.readTime = std::chrono::milliseconds(3);
+  stats.pagesRead = 10;
+  stats.recordsStored = 7;
+
+  ConversionStats other;
+  other.readTime = std::chrono::milliseconds(4);
+  other.insertTime = std::chrono::milliseconds(5);
+  other.pagesRead = 1;
+  other.recordsStored = 2;
+
+  stats += other;
+  EXPECT_EQ(stats.readTime, std::chrono::milliseconds(7));
+  EXPECT_EQ(stats.insertTime, std::chrono::milliseconds(5));
+  EXPECT_EQ(stats.pagesRead, 11u);
+  EXPECT_EQ(stats.recordsStored, 9u);
+}
+
+TEST(ConversionStats, ToString) {
+  ConversionStats stats;
+  stats.totalTime = std::chrono::milliseconds(250);
+  stats.insertTime = std::chrono::microseconds(12340);
+  stats.recordsRead = 101;
+  stats.recordsStored = 100;
+  stats.pagesRead = 5;
+  stats.fragmentPagesRead = 2;
+  stats.fragmentPageVisits = 3;
+  stats.bytesRead = 7168;
+
+  EXPECT_EQ(stats.toString(),
+            "100/101 records stored, 5 pages and 2 fragment pages read (3 "
+            "visits), 0.0 MB in 250.0 ms: 400 records/s, 0.0 MB/s; parse 0.0 "
+            "ms, read 0.0 ms, sort 0.0 ms, key encoding 0.0 ms, insert 12.3 "
+            "ms, index 0.0 ms, commit 0.0 ms, page table 0.0 ms");
+}
@@ -0,0 +1,56 @@
+#ifndef __FRAGMENT_PAGE_TRACKER_H_
+#define __FRAGMENT_PAGE_TRACKER_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace btrieve {
+// Counts the variable length data pages visited while reassembling records:
+// every visit, and the distinct pages among them, which are the pages that
+// actually had to be read. Not thread-safe, each scan keeps its own and
+// merges those of the scans it hands work to.
+class FragmentPageTracker {
+ public:
+  FragmentPageTracker() : visits(0) {}
+
+  // Notes a visit to logicalPage.
+  void visit(uint32_t logicalPage) {
+    ++visits;
+    mark(logicalPage);
+  }
+
+  // Adds the visits and pages of tracker, counting pages both have visited
+  // once.
+  void merge(const FragmentPageTracker &tracker) {
+    visits += tracker.visits;
+    for (uint32_t logicalPage : tracker.pages) {
+      mark(logicalPage);
+    }
+  }
+
+  // Returns the number of visits so far.
+  uint64_t getVisits() const { return visits; }
+
+  // Returns the number of distinct pages visited so far.
+  uint64_t getPageCount() const { return pages.size(); }
+
+ private:
+  void mark(uint32_t logicalPage) {
+    if (logicalPage >= visited.size()) {
+      visited.resize(logicalPage + 1);
+    }
+    if (!visited[logicalPage]) {
+      visited[logicalPage] = true;
+      pages.push_back(logicalPage);
+    }
+  }
+
+  // indexed by logical page
+  std::vector<bool> visited;
+  // the pages set in visited, in the order they were first visited
+  std::vector<uint32_t> pages;
+  uint64_t visits;
+};
+}  // namespace btrieve
+
+#endif
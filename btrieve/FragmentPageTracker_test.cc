@@ -0,0 +1,40 @@
+#include "FragmentPageTracker.h"
+
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+TEST(FragmentPageTracker, CountsDistinctPages) {
+  FragmentPageTracker tracker;
+
+  tracker.visit(12);
+  tracker.visit(12);
+  tracker.visit(3);
+  tracker.visit(12);
+
+  EXPECT_EQ(tracker.getVisits(), 4u);
+  EXPECT_EQ(tracker.getPageCount(), 2u);
+}
+
+TEST(FragmentPageTracker, MergesPagesVisitedByBoth) {
+  FragmentPageTracker tracker;
+  tracker.visit(1);
+  tracker.visit(2);
+
+  FragmentPageTracker other;
+  other.visit(2);
+  other.visit(300);
+  other.visit(300);
+
+  tracker.merge(other);
+
+  EXPECT_EQ(tracker.getVisits(), 5u);
+  EXPECT_EQ(tracker.getPageCount(), 3u);
+}
+
+TEST(FragmentPageTracker, StartsEmpty) {
+  FragmentPageTracker tracker;
+
+  EXPECT_EQ(tracker.getVisits(), 0u);
+  EXPECT_EQ(tracker.getPageCount(), 0u);
+}
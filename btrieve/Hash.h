@@ -0,0 +1,37 @@
+#ifndef __HASH_H_
+#define __HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace btrieve {
+// 64-bit FNV-1a, see http://www.isthe.com/chongo/tech/comp/fnv/
+static const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+static const uint64_t FNV_PRIME = 0x100000001b3ull;
+
+// Folds value into hash as a single FNV-1a step.
+inline uint64_t fnv1a(uint64_t hash, uint64_t value) {
+  return (hash ^ value) * FNV_PRIME;
+}
+
+// Folds every byte of [data, data + length) into hash with FNV-1a.
+inline uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    hash = fnv1a(hash, data[i]);
+  }
+  return hash;
+}
+
+// Folds a 64-bit word into hash and runs the result through the splitmix64
+// finalizer, so every bit of word reaches every bit of the returned hash.
+// Used to hash whole files a word at a time, where FNV-1a over words would
+// let a difference in a word's top bit fall off the end of the multiply.
+inline uint64_t hashWord(uint64_t hash, uint64_t word) {
+  hash ^= word;
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+  return hash ^ (hash >> 31);
+}
+}  // namespace btrieve
+
+#endif
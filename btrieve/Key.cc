@@ -4,6 +4,8 @@
 #include <cstring>
 #include <sstream>
 
+#include "ByteScan.h"
+
 namespace btrieve {
 
 std::string Key::getSqliteColumnSql() const {
@@ -62,12 +64,6 @@ std::vector<uint8_t> Key::extractKeyDataFromRecord(
   return composite;
 }
 
-static bool isAllSameByteValue(std::basic_string_view<uint8_t> data,
-                               uint8_t value) {
-  auto found = data.find_first_not_of(value);
-  return found == std::string::npos;
-}
-
 static const char *createDefaultACS() {
   static uint8_t INTERNAL_DEFAULT_ACS[ACS_LENGTH];
   for (unsigned int i = 0; i < ACS_LENGTH; ++i) {
@@ -137,10 +133,17 @@ static std::string extractNullTerminatedString(
 }
 
 bool Key::isNullKeyInRecord(std::basic_string_view<uint8_t> record) const {
-  std::vector<uint8_t> keyData = extractKeyDataFromRecord(record);
-  return isAllSameByteValue(
-      std::basic_string_view<uint8_t>(keyData.data(), keyData.size()),
-      getPrimarySegment().getNullValue());
+  // checks each segment in place rather than extracting the key first, since
+  // this runs on every inserted record
+  const uint8_t nullValue = getPrimarySegment().getNullValue();
+  for (auto &segment : segments) {
+    if (!isAllBytesEqual(
+            record.substr(segment.getOffset(), segment.getLength()),
+            nullValue)) {
+      return false;
+    }
+  }
+  return true;
 }
 
 static bool isBigEndian() {
@@ -157,7 +160,7 @@ static bool bigEndian = isBigEndian();
 BindableValue Key::keyDataToSqliteObject(
     std::basic_string_view<uint8_t> keyData) const {
   if (isNullable() &&
-      (isAllSameByteValue(
+      (isAllBytesEqual(
            keyData, getPrimarySegment().getNullValue()) ||  // legacy null check
        (getPrimarySegment().getDataType() ==
             KeyDataType::Zstring &&  // special handling for null strings
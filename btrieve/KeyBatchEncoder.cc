@@ -0,0 +1,228 @@
+#include "KeyBatchEncoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "BtrieveException.h"
+#include "ByteScan.h"
+
+namespace btrieve {
+
+KeyBatchEncoder::KeyBatchEncoder(const std::vector<Key> &keys_)
+    : keys(keys_), columns(keys_.size()) {
+  layouts.reserve(keys.size());
+  for (const Key &key : keys) {
+    Layout layout;
+    layout.key = &key;
+    layout.dataType = key.getPrimarySegment().getDataType();
+    layout.length = key.getLength();
+    layout.end = 0;
+    layout.composite = key.isComposite();
+    layout.nullable = key.isNullable();
+    layout.nullValue = key.getPrimarySegment().getNullValue();
+    layout.fallback = false;
+
+    for (const KeyDefinition &segment : key.getSegments()) {
+      layout.segments.push_back(
+          {segment.getOffset(), segment.getLength(),
+           segment.requiresACS()
+               ? reinterpret_cast<const uint8_t *>(segment.getACS())
+               : nullptr,
+           segment.getDataType() == KeyDataType::Lstring});
+      layout.end = std::max<size_t>(
+          layout.end, segment.getOffset() + segment.getLength());
+      layout.fallback |= segment.getLength() == 0;
+    }
+
+    layouts.push_back(std::move(layout));
+  }
+}
+
+void KeyBatchEncoder::encode(
+    std::span<const std::basic_string_view<uint8_t>> records) {
+  arena.clear();
+  for (size_t i = 0; i < layouts.size(); ++i) {
+    std::vector<Value> &column = columns[i];
+    column.clear();
+    for (const auto &record : records) {
+      column.push_back(encodeKey(layouts[i], record));
+    }
+  }
+}
+
+KeyBatchEncoder::Value KeyBatchEncoder::encodeKey(
+    const Layout &layout, std::basic_string_view<uint8_t> record) {
+  Value value;
+  value.type = BindableValue::Type::Null;
+  value.length = 0;
+
+  // Key reads past the end of short records in ways that aren't worth
+  // repeating here, so leave those to it
+  if (layout.fallback || record.size() < layout.end) {
+    return storeValue(layout.key->extractKeyInRecordToSqliteObject(record));
+  }
+
+  if (layout.nullable) {
+    bool null = true;
+    for (const auto &segment : layout.segments) {
+      if (!isAllBytesEqual(record.data() + segment.offset, segment.length,
+                           layout.nullValue)) {
+        null = false;
+        break;
+      }
+    }
+    // special handling for null strings
+    if (null || (layout.dataType == KeyDataType::Zstring &&
+                 record[layout.segments[0].offset] == 0)) {
+      return value;
+    }
+  }
+
+  // gather the key's segments into the arena, translating them through their
+  // ACS
+  const size_t offset = arena.size();
+  arena.resize(offset + layout.length);
+  uint8_t *data = arena.data() + offset;
+  uint8_t *dst = data;
+  for (const auto &segment : layout.segments) {
+    const uint8_t *src = record.data() + segment.offset;
+    if (segment.acs == nullptr) {
+      memcpy(dst, src, segment.length);
+      dst += segment.length;
+      continue;
+    }
+
+    unsigned int i = 0;
+    if (segment.keepsFirstByte) {
+      *(dst++) = *(src++);
+      i = 1;
+    }
+    for (; i < segment.length; ++i) {
+      *(dst++) = segment.acs[*(src++)];
+    }
+  }
+
+  value.offset = offset;
+  value.length = layout.length;
+  if (layout.composite) {
+    value.type = BindableValue::Type::Blob;
+    return value;
+  }
+
+  switch (layout.dataType) {
+    case KeyDataType::AutoInc:
+    case KeyDataType::Integer:
+    case KeyDataType::Unsigned:
+    case KeyDataType::UnsignedBinary:
+    case KeyDataType::OldBinary:
+      if (layout.length <= 8) {
+        uint64_t integer = 0;
+        // extend the sign bit of signed types
+        if ((layout.dataType == KeyDataType::AutoInc ||
+             layout.dataType == KeyDataType::Integer) &&
+            (data[layout.length - 1] & 0x80)) {
+          integer = ~0ull;
+        }
+        for (unsigned int i = 0; i < layout.length; ++i) {
+          integer &= ~(0xFFull << (8 * i));
+          integer |= static_cast<uint64_t>(data[i]) << (8 * i);
+        }
+        arena.resize(offset);
+        value.type = BindableValue::Type::Integer;
+        value.integerValue = static_cast<int64_t>(integer);
+      } else {
+        // integers with size > 8 are unsupported on sqlite, so they're blobs
+        // with their bytes swapped to compare msb first
+        std::reverse(data, data + layout.length);
+        value.type = BindableValue::Type::Blob;
+      }
+      break;
+    case KeyDataType::Lstring: {
+      size_t length = data[0];
+      if (length >= layout.length) {
+        length = layout.length - 1;
+      }
+      value.type = BindableValue::Type::Text;
+      value.offset = offset + 1;
+      value.length = length;
+    } break;
+    case KeyDataType::Zstring:
+    case KeyDataType::OldAscii:
+      value.type = BindableValue::Type::Text;
+      value.length = std::find(data, data + layout.length, 0) - data;
+      break;
+    case KeyDataType::Float:
+      if (layout.length == 4) {
+        float single;
+        memcpy(&single, data, sizeof(single));
+        value.doubleValue = single;
+      } else if (layout.length == 8) {
+        memcpy(&value.doubleValue, data, sizeof(value.doubleValue));
+      } else {
+        // should never happen since we verify on db creation
+        throw BtrieveException(BtrieveError::BadKeyLength,
+                               "Float key not 4/8 bytes");
+      }
+      arena.resize(offset);
+      value.type = BindableValue::Type::Double;
+      break;
+    case KeyDataType::String:
+    default:
+      value.type = BindableValue::Type::Blob;
+      break;
+  }
+
+  return value;
+}
+
+KeyBatchEncoder::Value KeyBatchEncoder::storeValue(
+    const BindableValue &bindableValue) {
+  Value value;
+  value.type = bindableValue.getType();
+  value.length = 0;
+
+  switch (bindableValue.getType()) {
+    case BindableValue::Type::Null:
+      break;
+    case BindableValue::Type::Integer:
+      value.integerValue = bindableValue.getIntegerValue();
+      break;
+    case BindableValue::Type::Double:
+      value.doubleValue = bindableValue.getDoubleValue();
+      break;
+    case BindableValue::Type::Text: {
+      const std::string &text = bindableValue.getStringValue();
+      value.offset = arena.size();
+      value.length = text.size();
+      arena.insert(arena.end(), text.begin(), text.end());
+    } break;
+    case BindableValue::Type::Blob: {
+      const std::vector<uint8_t> &blob = bindableValue.getBlobValue();
+      value.offset = arena.size();
+      value.length = blob.size();
+      arena.insert(arena.end(), blob.begin(), blob.end());
+    } break;
+  }
+
+  return value;
+}
+
+BindableValue KeyBatchEncoder::toBindableValue(const Value &value) const {
+  switch (value.type) {
+    case BindableValue::Type::Integer:
+      return BindableValue(value.integerValue);
+    case BindableValue::Type::Double:
+      return BindableValue(value.doubleValue);
+    case BindableValue::Type::Text: {
+      const auto bytes = getBytes(value);
+      return BindableValue(std::string_view(
+          reinterpret_cast<const char *>(bytes.data()), bytes.size()));
+    }
+    case BindableValue::Type::Blob:
+      return BindableValue(getBytes(value));
+    case BindableValue::Type::Null:
+    default:
+      return BindableValue();
+  }
+}
+}  // namespace btrieve
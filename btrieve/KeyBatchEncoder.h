@@ -0,0 +1,110 @@
+#ifndef __KEY_BATCH_ENCODER_H_
+#define __KEY_BATCH_ENCODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "BindableValue.h"
+#include "ByteStringViewTraits.h"
+#include "Key.h"
+
+namespace btrieve {
+
+// Encodes the sql values of a set of keys for a batch of records at a time,
+// the same values Key::extractKeyInRecordToSqliteObject returns for each
+// record, but stored by key: each key gets a column holding the value of
+// every record, with integers and doubles in place and the bytes of text and
+// blobs back to back in a single arena. Once its buffers have grown to the
+// batch size, encoding allocates nothing, and values can be bound straight
+// from the arena without being copied.
+class KeyBatchEncoder {
+ public:
+  // A key value of one record. Text and blobs are stored in the arena, see
+  // getBytes.
+  struct Value {
+    BindableValue::Type type;
+    union {
+      int64_t integerValue;
+      double doubleValue;
+      // where the bytes of text and blobs start in the arena
+      size_t offset;
+    };
+    // the length of text and blobs
+    size_t length;
+  };
+
+  // Encodes keys, which are copied.
+  explicit KeyBatchEncoder(const std::vector<Key> &keys);
+
+  KeyBatchEncoder(const KeyBatchEncoder &) = delete;
+  KeyBatchEncoder &operator=(const KeyBatchEncoder &) = delete;
+
+  // Encodes the value of every key in each of records, replacing the values
+  // of the previous batch. Throws BtrieveException for values that can't be
+  // encoded, like extractKeyInRecordToSqliteObject.
+  void encode(std::span<const std::basic_string_view<uint8_t>> records);
+
+  // Returns the number of keys encoded.
+  size_t getKeyCount() const { return columns.size(); }
+
+  // Returns the values of the key at keyIndex in the keys given to the
+  // constructor, one for each record of the last batch, in order.
+  std::span<const Value> getColumn(size_t keyIndex) const {
+    return columns[keyIndex];
+  }
+
+  // Returns the bytes of a text or blob value, which stay valid until the
+  // next batch is encoded.
+  std::basic_string_view<uint8_t> getBytes(const Value &value) const {
+    return std::basic_string_view<uint8_t>(arena.data() + value.offset,
+                                           value.length);
+  }
+
+  // Returns value as a BindableValue, copying any bytes out of the arena.
+  BindableValue toBindableValue(const Value &value) const;
+
+ private:
+  // What's needed to encode a key without going through Key, worked out once
+  // up front.
+  struct Layout {
+    struct Segment {
+      uint16_t offset;
+      uint16_t length;
+      // the ACS translating the segment's bytes, nullptr if it has none
+      const uint8_t *acs;
+      // whether the leading length byte of an Lstring is kept as is
+      bool keepsFirstByte;
+    };
+
+    const Key *key;
+    std::vector<Segment> segments;
+    KeyDataType dataType;
+    unsigned int length;
+    // one past the last byte of the record any segment reads
+    size_t end;
+    bool composite;
+    bool nullable;
+    uint8_t nullValue;
+    // whether records holding the key are encoded by Key instead, for keys
+    // with empty segments that it treats specially
+    bool fallback;
+  };
+
+  // Encodes the value of the key described by layout in record.
+  Value encodeKey(const Layout &layout,
+                  std::basic_string_view<uint8_t> record);
+
+  // Stores value, as encoded by Key, in the arena.
+  Value storeValue(const BindableValue &value);
+
+  const std::vector<Key> keys;
+  std::vector<Layout> layouts;
+  std::vector<std::vector<Value>> columns;
+  std::vector<uint8_t> arena;
+};
+}  // namespace btrieve
+
+#endif
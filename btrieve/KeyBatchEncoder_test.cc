@@ -0,0 +1,181 @@
+#include "KeyBatchEncoder.h"
+
+#include <cctype>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "AttributeMask.h"
+#include "BtrieveDatabase.h"
+#include "Text.h"
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+namespace {
+
+static void expectSameValue(const BindableValue &actual,
+                            const BindableValue &expected) {
+  ASSERT_EQ(actual.getType(), expected.getType());
+  switch (expected.getType()) {
+    case BindableValue::Type::Null:
+      break;
+    case BindableValue::Type::Integer:
+      EXPECT_EQ(actual.getIntegerValue(), expected.getIntegerValue());
+      break;
+    case BindableValue::Type::Double:
+      EXPECT_EQ(actual.getDoubleValue(), expected.getDoubleValue());
+      break;
+    case BindableValue::Type::Text:
+      EXPECT_EQ(actual.getStringValue(), expected.getStringValue());
+      break;
+    case BindableValue::Type::Blob:
+      EXPECT_EQ(actual.getBlobValue(), expected.getBlobValue());
+      break;
+  }
+}
+
+// Encodes records in batches of batchSize and checks every value against the
+// one Key encodes.
+static void expectEncodedLikeKey(
+    const std::vector<Key> &keys,
+    const std::vector<std::basic_string<uint8_t>> &records,
+    size_t batchSize) {
+  KeyBatchEncoder encoder(keys);
+  ASSERT_EQ(encoder.getKeyCount(), keys.size());
+
+  std::vector<std::basic_string_view<uint8_t>> batch;
+  for (size_t first = 0; first < records.size(); first += batchSize) {
+    batch.clear();
+    for (size_t i = first; i < records.size() && i < first + batchSize; ++i) {
+      batch.push_back(records[i]);
+    }
+
+    encoder.encode(batch);
+    for (size_t key = 0; key < keys.size(); ++key) {
+      auto column = encoder.getColumn(key);
+      ASSERT_EQ(column.size(), batch.size());
+      for (size_t i = 0; i < batch.size(); ++i) {
+        SCOPED_TRACE(testing::Message()
+                     << "key " << key << ", record " << first + i);
+        expectSameValue(encoder.toBindableValue(column[i]),
+                        keys[key].extractKeyInRecordToSqliteObject(batch[i]));
+      }
+    }
+  }
+}
+
+static std::vector<char> upperACS() {
+  std::vector<char> acs(ACS_LENGTH);
+  for (int i = 0; i < ACS_LENGTH; ++i) {
+    acs[i] = static_cast<char>(toupper(i));
+  }
+  return acs;
+}
+
+static Key createKey(KeyDataType dataType, uint16_t length, uint16_t offset,
+                     uint16_t attributes = UseExtendedDataType,
+                     uint8_t nullValue = 0) {
+  const bool usesACS = attributes & NumberedACS;
+  KeyDefinition keyDefinition(0, length, offset, dataType, attributes, false,
+                              0, 0, nullValue, usesACS ? "upper" : "",
+                              usesACS ? upperACS() : std::vector<char>());
+  return Key(&keyDefinition, 1);
+}
+
+}  // namespace
+
+TEST(KeyBatchEncoder, MatchesKeyOnEveryAsset) {
+  for (auto asset : {"assets/MBBSEMU.DAT", "assets/GALTELA.DAT",
+                     "assets/MBMGEPLT.DAT", "assets/VARIABLE.DAT",
+                     "assets/WCCACMS2.DAT", "assets/WGSMENU2.DAT"}) {
+    SCOPED_TRACE(asset);
+    BtrieveDatabase database;
+    ASSERT_EQ(database.open(toWideString(asset).c_str()),
+              BtrieveError::Success);
+
+    std::vector<std::basic_string<uint8_t>> records;
+    database.readRecords(
+        [&records](const std::basic_string_view<uint8_t> record) {
+          records.emplace_back(record);
+          return BtrieveDatabase::LoadRecordResult::COUNT;
+        });
+    ASSERT_FALSE(records.empty());
+
+    expectEncodedLikeKey(database.getKeys(), records,
+                         BtrieveDatabase::DEFAULT_RECORD_BATCH_SIZE);
+  }
+}
+
+TEST(KeyBatchEncoder, MatchesKeyOnEveryDataType) {
+  std::vector<Key> keys;
+  for (auto dataType :
+       {KeyDataType::Integer, KeyDataType::AutoInc, KeyDataType::Unsigned,
+        KeyDataType::UnsignedBinary, KeyDataType::OldBinary}) {
+    for (uint16_t length : {1, 2, 3, 4, 6, 8, 10}) {
+      keys.push_back(createKey(dataType, length, 1));
+    }
+  }
+  keys.push_back(createKey(KeyDataType::Float, 4, 3));
+  keys.push_back(createKey(KeyDataType::Float, 8, 5));
+  for (auto dataType : {KeyDataType::String, KeyDataType::Lstring,
+                        KeyDataType::Zstring, KeyDataType::OldAscii}) {
+    keys.push_back(createKey(dataType, 6, 2));
+    keys.push_back(
+        createKey(dataType, 6, 2, UseExtendedDataType | NumberedACS));
+    keys.push_back(createKey(dataType, 1, 0));
+  }
+  // nullable keys, with records holding the null value
+  keys.push_back(createKey(KeyDataType::Integer, 2, 0,
+                           UseExtendedDataType | NullAllSegments, 'a'));
+  keys.push_back(createKey(KeyDataType::String, 4, 4,
+                           UseExtendedDataType | NullAnySegment, 'a'));
+  // composite keys, with an ACS on some of their segments
+  KeyDefinition segments[] = {
+      KeyDefinition(1, 3, 6, KeyDataType::Lstring,
+                    UseExtendedDataType | SegmentedKey | NumberedACS, true, 1,
+                    0, 0, "upper", upperACS()),
+      KeyDefinition(1, 2, 0, KeyDataType::Integer,
+                    UseExtendedDataType | SegmentedKey, true, 1, 1, 0, "",
+                    std::vector<char>()),
+      KeyDefinition(1, 4, 10, KeyDataType::Zstring,
+                    UseExtendedDataType | NumberedACS, true, 1, 2, 0, "upper",
+                    upperACS())};
+  keys.push_back(Key(segments, 3));
+  keys.push_back(Key(segments + 1, 2));
+
+  std::mt19937 random(23);
+  const char letters[] = "aAbB\0z9 ";
+  std::vector<std::basic_string<uint8_t>> records;
+  for (int i = 0; i < 1000; ++i) {
+    std::basic_string<uint8_t> record(16, 0);
+    for (auto &b : record) {
+      // mostly a few letters, so null values and string terminators turn up
+      b = random() % 4 ? letters[random() % 8] : random() % 256;
+    }
+    records.push_back(record);
+  }
+
+  expectEncodedLikeKey(keys, records, 100);
+}
+
+TEST(KeyBatchEncoder, ReplacesPreviousBatch) {
+  std::vector<Key> keys = {createKey(KeyDataType::Zstring, 4, 0)};
+  KeyBatchEncoder encoder(keys);
+
+  const std::basic_string<uint8_t> first(
+      reinterpret_cast<const uint8_t *>("abcd"), 4);
+  const std::basic_string<uint8_t> second(
+      reinterpret_cast<const uint8_t *>("xy\0z"), 4);
+  std::vector<std::basic_string_view<uint8_t>> batch = {first, first};
+  encoder.encode(batch);
+  ASSERT_EQ(encoder.getColumn(0).size(), 2u);
+
+  batch = {second};
+  encoder.encode(batch);
+  ASSERT_EQ(encoder.getColumn(0).size(), 1u);
+  const auto &value = encoder.getColumn(0)[0];
+  EXPECT_EQ(value.type, BindableValue::Type::Text);
+  EXPECT_EQ(encoder.getBytes(value),
+            std::basic_string_view<uint8_t>(second.data(), 2));
+}
@@ -193,6 +193,35 @@ TEST(Key, CompositeKeyConcatentation) {
             std::vector<uint8_t>(expected, expected + sizeof(expected)));
 }
 
+TEST(Key, NullKeyInRecordChecksEverySegment) {
+  KeyDefinition keyDefinitions[2] = {
+      KeyDefinition(0, 8, 2, KeyDataType::AutoInc, UseExtendedDataType, true, 0,
+                    0, 0, "", std::vector<char>()),
+      KeyDefinition(0, 40, 20, KeyDataType::String, UseExtendedDataType, false,
+                    1, 0, 0, "", std::vector<char>())};
+
+  uint8_t record[128];
+  memset(record, 0xFF, sizeof(record));
+  memset(record + 2, 0, 8);
+  memset(record + 20, 0, 40);
+
+  Key key(keyDefinitions, 2);
+  std::basic_string_view<uint8_t> view(record, sizeof(record));
+
+  EXPECT_TRUE(key.isNullKeyInRecord(view));
+
+  // bytes between the segments don't matter
+  record[15] = 1;
+  EXPECT_TRUE(key.isNullKeyInRecord(view));
+
+  // but a single byte anywhere in a segment does
+  record[59] = 1;
+  EXPECT_FALSE(key.isNullKeyInRecord(view));
+  record[59] = 0;
+  record[2] = 1;
+  EXPECT_FALSE(key.isNullKeyInRecord(view));
+}
+
 struct ParameterizedKeyDataType {
   KeyDataType type;
 };
@@ -0,0 +1,85 @@
+#include "PageReadAhead.h"
+
+#include <algorithm>
+
+#include "PageSource.h"
+
+namespace btrieve {
+
+PageReadAhead::PageReadAhead(std::shared_ptr<const PageSource> source_,
+                             std::vector<uint64_t> pageOffsets_,
+                             size_t pageLength_, size_t window_)
+    : source(source_),
+      pageOffsets(std::move(pageOffsets_)),
+      pageLength(pageLength_),
+      window(std::max<size_t>(window_, 1)),
+      wakeupInterval(std::max<size_t>(window / 8, 1)),
+      readerIndex(0),
+      stop(false),
+      notifiedIndex(0),
+      prefetchedPages(0) {
+  thread = std::thread([this]() { prefetchPages(); });
+}
+
+PageReadAhead::~PageReadAhead() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wakeup.notify_one();
+  thread.join();
+}
+
+void PageReadAhead::advanceTo(size_t index) {
+  if (index < notifiedIndex + wakeupInterval) {
+    return;
+  }
+
+  notifiedIndex = index;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    readerIndex = index;
+  }
+  wakeup.notify_one();
+}
+
+void PageReadAhead::prefetchPages() {
+  size_t next = 0;
+  while (next < pageOffsets.size()) {
+    size_t end;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeup.wait(lock, [this, next]() {
+        return stop || next < readerIndex + window;
+      });
+      if (stop) {
+        return;
+      }
+      end = std::min(readerIndex + window, pageOffsets.size());
+    }
+
+    // coalesce runs of adjacent pages into a single range
+    uint64_t rangeStart = NO_PAGE;
+    uint64_t rangeEnd = NO_PAGE;
+    for (; next < end; ++next) {
+      const uint64_t offset = pageOffsets[next];
+      if (offset == NO_PAGE) {
+        continue;
+      }
+
+      if (offset != rangeEnd) {
+        if (rangeStart != NO_PAGE) {
+          source->prefetch(rangeStart, rangeEnd - rangeStart);
+        }
+        rangeStart = offset;
+      }
+      rangeEnd = offset + pageLength;
+    }
+    if (rangeStart != NO_PAGE) {
+      source->prefetch(rangeStart, rangeEnd - rangeStart);
+    }
+
+    prefetchedPages.store(next);
+  }
+}
+}  // namespace btrieve
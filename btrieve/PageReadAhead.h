@@ -0,0 +1,68 @@
+#ifndef __PAGE_READ_AHEAD_H_
+#define __PAGE_READ_AHEAD_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace btrieve {
+
+class PageSource;
+
+// Prefetches a sequence of pages of a PageSource on a background thread, so
+// the reader finds them in memory instead of waiting on the disk for each
+// one. The thread stays at most window pages ahead of the page last passed to
+// advanceTo, which bounds how much of the file is pulled in ahead of time.
+// Pages that are adjacent in the file are prefetched as one range.
+class PageReadAhead {
+ public:
+  // Marks an entry of pageOffsets that doesn't need to be prefetched.
+  static const uint64_t NO_PAGE = UINT64_MAX;
+
+  // The default number of pages to stay ahead of the reader.
+  static const size_t DEFAULT_WINDOW = 1024;
+
+  // Starts prefetching the pageLength bytes at each of pageOffsets, in order.
+  PageReadAhead(std::shared_ptr<const PageSource> source,
+                std::vector<uint64_t> pageOffsets, size_t pageLength,
+                size_t window = DEFAULT_WINDOW);
+
+  // Stops prefetching and waits for the thread to exit.
+  ~PageReadAhead();
+
+  // Tells the read-ahead thread that the reader has moved on to
+  // pageOffsets[index]. Cheap enough to call for every page.
+  void advanceTo(size_t index);
+
+  // Returns how many entries of pageOffsets have been prefetched so far.
+  size_t getPrefetchedPages() const { return prefetchedPages.load(); }
+
+ private:
+  void prefetchPages();
+
+  std::shared_ptr<const PageSource> source;
+  const std::vector<uint64_t> pageOffsets;
+  const size_t pageLength;
+  const size_t window;
+  // the reader only wakes the thread up once it moved this many pages
+  const size_t wakeupInterval;
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  size_t readerIndex;
+  bool stop;
+
+  // the index last handed to the thread, only touched by the reader
+  size_t notifiedIndex;
+  std::atomic<size_t> prefetchedPages;
+
+  std::thread thread;
+};
+}  // namespace btrieve
+
+#endif
@@ -0,0 +1,94 @@
+#include "PageReadAhead.h"
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "PageSource.h"
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+namespace {
+
+// Records the ranges it's asked to prefetch instead of touching memory.
+class RecordingPageSource : public PageSource {
+ public:
+  explicit RecordingPageSource(uint64_t length_) { length = length_; }
+
+  virtual void prefetch(uint64_t offset, uint64_t length) const override {
+    std::lock_guard<std::mutex> lock(mutex);
+    ranges.emplace_back(offset, length);
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> getRanges() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ranges;
+  }
+
+ private:
+  mutable std::mutex mutex;
+  mutable std::vector<std::pair<uint64_t, uint64_t>> ranges;
+};
+
+// Waits a bounded amount of time for the read-ahead thread to catch up.
+static void waitForPrefetchedPages(const PageReadAhead &readAhead,
+                                   size_t pages) {
+  for (int i = 0; i < 500 && readAhead.getPrefetchedPages() < pages; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+}
+
+TEST(PageReadAhead, CoalescesAdjacentPages) {
+  auto source = std::make_shared<RecordingPageSource>(100 * 512);
+  std::vector<uint64_t> offsets = {
+      512, 1024, 1536, PageReadAhead::NO_PAGE, 2048, 4096, 3584, 4096 + 512};
+
+  {
+    PageReadAhead readAhead(source, offsets, 512);
+    waitForPrefetchedPages(readAhead, offsets.size());
+    EXPECT_EQ(readAhead.getPrefetchedPages(), offsets.size());
+  }
+
+  // 512..2560 stays one run across the skipped page, then 4096, 3584 and
+  // 4608 each start a new one since they're read out of file order
+  std::vector<std::pair<uint64_t, uint64_t>> expected = {
+      {512, 2048}, {4096, 512}, {3584, 512}, {4608, 512}};
+  EXPECT_EQ(source->getRanges(), expected);
+}
+
+TEST(PageReadAhead, StaysWithinWindowOfReader) {
+  auto source = std::make_shared<RecordingPageSource>(1000 * 512);
+  std::vector<uint64_t> offsets;
+  for (uint64_t page = 0; page < 1000; ++page) {
+    // every other page, so nothing coalesces
+    offsets.push_back(page * 1024 % (1000 * 512));
+  }
+
+  PageReadAhead readAhead(source, offsets, 512, 16);
+  waitForPrefetchedPages(readAhead, 16);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(readAhead.getPrefetchedPages(), 16u);
+
+  for (size_t page = 0; page < offsets.size(); ++page) {
+    readAhead.advanceTo(page);
+    EXPECT_LE(readAhead.getPrefetchedPages(), page + 16);
+  }
+  waitForPrefetchedPages(readAhead, offsets.size());
+  EXPECT_EQ(readAhead.getPrefetchedPages(), offsets.size());
+}
+
+TEST(PageReadAhead, StopsWhileWaitingOnReader) {
+  auto source = std::make_shared<RecordingPageSource>(1000 * 512);
+  std::vector<uint64_t> offsets(1000, 0);
+
+  auto readAhead = std::make_unique<PageReadAhead>(source, offsets, 512, 8);
+  waitForPrefetchedPages(*readAhead, 8);
+  // the thread is parked on the window, destroying it must not hang
+  readAhead.reset();
+  EXPECT_LE(source->getRanges().size(), 8u);
+}
+
+}  // namespace
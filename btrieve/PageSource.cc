@@ -0,0 +1,183 @@
+#include "PageSource.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+#include "Text.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN  // Exclude rarely-used stuff from Windows headers
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace btrieve {
+
+// Maps the entire file into the address space, so reading a page is nothing
+// more than pointer arithmetic and the OS page cache does the rest.
+class MappedPageSource : public PageSource {
+ public:
+  virtual ~MappedPageSource() {
+#ifdef _WIN32
+    if (data != nullptr) {
+      UnmapViewOfFile(data);
+    }
+#else
+    if (data != nullptr) {
+      munmap(const_cast<uint8_t *>(data), static_cast<size_t>(length));
+    }
+#endif
+  }
+
+  // Returns nullptr if the file couldn't be mapped, in which case the caller
+  // should fall back to BufferedPageSource.
+  static std::unique_ptr<PageSource> map(const wchar_t *fileName) {
+    std::unique_ptr<MappedPageSource> source(new MappedPageSource());
+#ifdef _WIN32
+    HANDLE file =
+        CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                    nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return nullptr;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 ||
+        static_cast<uint64_t>(fileSize.QuadPart) > SIZE_MAX) {
+      CloseHandle(file);
+      return nullptr;
+    }
+
+    HANDLE mapping =
+        CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) {
+      return nullptr;
+    }
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    // the view keeps the mapping alive
+    CloseHandle(mapping);
+    if (view == nullptr) {
+      return nullptr;
+    }
+
+    source->data = reinterpret_cast<const uint8_t *>(view);
+    source->length = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(toStdString(fileName).c_str(), O_RDONLY);
+    if (fd < 0) {
+      return nullptr;
+    }
+
+    struct stat stbuf;
+    if (fstat(fd, &stbuf) != 0 || stbuf.st_size <= 0 ||
+        static_cast<uint64_t>(stbuf.st_size) > SIZE_MAX) {
+      close(fd);
+      return nullptr;
+    }
+
+    void *view = mmap(nullptr, static_cast<size_t>(stbuf.st_size), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (view == MAP_FAILED) {
+      return nullptr;
+    }
+
+    source->data = reinterpret_cast<const uint8_t *>(view);
+    source->length = static_cast<uint64_t>(stbuf.st_size);
+#endif
+    return source;
+  }
+
+  virtual void prefetch(uint64_t offset, uint64_t length) const override {
+    if (offset >= this->length || length == 0) {
+      return;
+    }
+    length = std::min(length, this->length - offset);
+
+#ifndef _WIN32
+    // let the kernel start reading the whole range at once rather than
+    // faulting it in a page at a time below
+    static const uintptr_t PAGE_MASK =
+        ~static_cast<uintptr_t>(sysconf(_SC_PAGESIZE) - 1);
+    uintptr_t start = reinterpret_cast<uintptr_t>(data + offset) & PAGE_MASK;
+    uintptr_t end = reinterpret_cast<uintptr_t>(data + offset + length);
+    madvise(reinterpret_cast<void *>(start), end - start, MADV_WILLNEED);
+#endif
+
+    // touch every page of the range, so it's resident by the time it's read
+    static const uint64_t TOUCH_STRIDE = 4096;
+    uint8_t sum = 0;
+    for (uint64_t i = offset; i < offset + length; i += TOUCH_STRIDE) {
+      sum += *reinterpret_cast<const volatile uint8_t *>(data + i);
+    }
+    sum += *reinterpret_cast<const volatile uint8_t *>(data + offset + length -
+                                                       1);
+    (void)sum;
+  }
+
+ private:
+  MappedPageSource() = default;
+};
+
+// Reads the entire file into memory with a handful of large sequential reads.
+// Used when the file can't be mapped, e.g. it's empty or lives on a
+// filesystem that doesn't support mapping.
+class BufferedPageSource : public PageSource {
+ public:
+  static std::unique_ptr<PageSource> load(const wchar_t *fileName) {
+    static const size_t CHUNK_SIZE = 1024 * 1024;
+
+#ifdef _WIN32
+    FILE *f = _wfopen(fileName, L"rb");
+#else
+    FILE *f = fopen(toStdString(fileName).c_str(), "rb");
+#endif
+    if (f == nullptr) {
+      return nullptr;
+    }
+
+    std::unique_ptr<BufferedPageSource> source(new BufferedPageSource());
+    size_t numRead;
+    do {
+      size_t currentSize = source->buffer.size();
+      source->buffer.resize(currentSize + CHUNK_SIZE);
+      numRead = fread(source->buffer.data() + currentSize, 1, CHUNK_SIZE, f);
+      source->buffer.resize(currentSize + numRead);
+    } while (numRead == CHUNK_SIZE);
+
+    bool failed = ferror(f) != 0;
+    fclose(f);
+    if (failed) {
+      throw BtrieveException(BtrieveError::IOError,
+                             "Failed to read all bytes, errno=%d", errno);
+    }
+
+    source->data = source->buffer.data();
+    source->length = source->buffer.size();
+    return source;
+  }
+
+ private:
+  BufferedPageSource() = default;
+
+  std::vector<uint8_t> buffer;
+};
+
+std::unique_ptr<PageSource> PageSource::open(const wchar_t *fileName) {
+  std::unique_ptr<PageSource> source = MappedPageSource::map(fileName);
+  if (!source) {
+    source = BufferedPageSource::load(fileName);
+  }
+  return source;
+}
+}  // namespace btrieve
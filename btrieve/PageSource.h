@@ -0,0 +1,55 @@
+#ifndef __PAGE_SOURCE_H_
+#define __PAGE_SOURCE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "BtrieveException.h"
+#include "ByteStringViewTraits.h"
+
+namespace btrieve {
+// A read-only view over the bytes of a legacy Btrieve DAT file. The whole file
+// is addressable at once, either by memory-mapping it or, if that isn't
+// possible, by reading it into memory, so page spans handed out by read() stay
+// valid for the lifetime of the PageSource and never need to be copied.
+class PageSource {
+ public:
+  virtual ~PageSource() = default;
+
+  // Opens fileName for reading. Returns nullptr if the file can't be opened.
+  static std::unique_ptr<PageSource> open(const wchar_t *fileName);
+
+  // Returns the total size in bytes of the underlying file.
+  uint64_t getLength() const { return length; }
+
+  // Returns a view of length bytes starting at offset. Throws
+  // BtrieveException if the requested range isn't entirely within the file.
+  std::basic_string_view<uint8_t> read(uint64_t offset, size_t length) const {
+    if (offset > this->length || length > this->length - offset) {
+      throw BtrieveException(
+          BtrieveError::IOError,
+          "Failed to read all bytes at offset %llu, wanted %llu, have %llu",
+          static_cast<unsigned long long>(offset),
+          static_cast<unsigned long long>(length),
+          static_cast<unsigned long long>(this->length));
+    }
+
+    return std::basic_string_view<uint8_t>(data + offset, length);
+  }
+
+  // Hints that the length bytes at offset are about to be read, and pulls
+  // them into memory on the calling thread if they aren't already, so a later
+  // read doesn't have to wait on the disk. Ranges outside the file are
+  // ignored. Safe to call from any thread.
+  virtual void prefetch(uint64_t /*offset*/, uint64_t /*length*/) const {}
+
+ protected:
+  PageSource() : data(nullptr), length(0) {}
+
+  const uint8_t *data;
+  uint64_t length;
+};
+}  // namespace btrieve
+
+#endif
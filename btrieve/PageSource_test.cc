@@ -0,0 +1,48 @@
+#include "PageSource.h"
+
+#include "BtrieveException.h"
+#include "TestBase.h"
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+class PageSourceTest : public TestBase {};
+
+TEST_F(PageSourceTest, ViewsWholeFile) {
+  auto source = PageSource::open(_TEXT("assets/MBBSEMU.DAT"));
+  ASSERT_TRUE(static_cast<bool>(source));
+  ASSERT_EQ(source->getLength(), 3072u);
+
+  auto page = source->read(512, 512);
+  ASSERT_EQ(page.size(), 512u);
+  // views are stable, so reading another page doesn't disturb the first
+  auto firstPage = source->read(0, 512);
+  EXPECT_EQ(page.data(), firstPage.data() + 512);
+}
+
+TEST_F(PageSourceTest, ReadPastEndThrows) {
+  auto source = PageSource::open(_TEXT("assets/MBBSEMU.DAT"));
+  ASSERT_TRUE(static_cast<bool>(source));
+
+  EXPECT_NO_THROW(source->read(2560, 512));
+  EXPECT_THROW(source->read(2560, 513), BtrieveException);
+  EXPECT_THROW(source->read(4096, 1), BtrieveException);
+}
+
+TEST_F(PageSourceTest, MissingFileReturnsNull) {
+  auto source = PageSource::open(_TEXT("assets/DOESNOTEXIST.DAT"));
+  ASSERT_FALSE(static_cast<bool>(source));
+}
+
+TEST_F(PageSourceTest, EmptyFileFallsBackToBuffer) {
+  std::filesystem::path emptyPath(tempPath->getTempPath());
+  emptyPath /= "EMPTY.DAT";
+  FILE *f = fopen(toStdString(emptyPath).c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  fclose(f);
+
+  auto source = PageSource::open(toWideString(emptyPath).c_str());
+  ASSERT_TRUE(static_cast<bool>(source));
+  EXPECT_EQ(source->getLength(), 0u);
+  EXPECT_THROW(source->read(0, 1), BtrieveException);
+}
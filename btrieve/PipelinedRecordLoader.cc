@@ -0,0 +1,162 @@
+#include "PipelinedRecordLoader.h"
+
+#include <algorithm>
+
+namespace btrieve {
+
+PipelinedRecordLoader::PipelinedRecordLoader(
+    std::unique_ptr<RecordLoader> loader_, size_t queueDepth)
+    : loader(std::move(loader_)),
+      freeBatches(std::max<size_t>(queueDepth, 1)),
+      done(false),
+      stop(false),
+      cancelled(false),
+      recordsWritten(0) {
+  writer = std::thread([this]() { writeBatches(); });
+}
+
+PipelinedRecordLoader::~PipelinedRecordLoader() { stopWriter(); }
+
+void PipelinedRecordLoader::stopWriter() {
+  if (!writer.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  batchQueued.notify_one();
+  writer.join();
+}
+
+BtrieveDatabase::LoadRecordResult PipelinedRecordLoader::onRecordLoaded(
+    std::basic_string_view<uint8_t> record) {
+  BtrieveDatabase::LoadRecordResult result =
+      BtrieveDatabase::LoadRecordResult::SKIP_COUNT;
+  onRecordsLoaded(std::span<const std::basic_string_view<uint8_t>>(&record, 1),
+                  std::span<BtrieveDatabase::LoadRecordResult>(&result, 1));
+  return result;
+}
+
+void PipelinedRecordLoader::onRecordsLoaded(
+    std::span<const std::basic_string_view<uint8_t>> records,
+    std::span<BtrieveDatabase::LoadRecordResult> results) {
+  if (records.empty()) {
+    return;
+  }
+
+  Batch batch;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    batchFreed.wait(lock, [this]() {
+      return !freeBatches.empty() || cancelled || error;
+    });
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    if (cancelled) {
+      results[0] = BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION;
+      return;
+    }
+
+    batch = std::move(freeBatches.back());
+    freeBatches.pop_back();
+  }
+
+  batch.data.clear();
+  batch.lengths.clear();
+  for (const auto &record : records) {
+    batch.data.insert(batch.data.end(), record.begin(), record.end());
+    batch.lengths.push_back(record.size());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queuedBatches.push_back(std::move(batch));
+  }
+  batchQueued.notify_one();
+
+  std::fill(results.begin(), results.begin() + records.size(),
+            BtrieveDatabase::LoadRecordResult::COUNT);
+}
+
+void PipelinedRecordLoader::onRecordsComplete() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+  batchQueued.notify_one();
+  writer.join();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  loader->onRecordsComplete();
+}
+
+void PipelinedRecordLoader::writeBatches() {
+  std::vector<std::basic_string_view<uint8_t>> records;
+  std::vector<BtrieveDatabase::LoadRecordResult> results;
+
+  while (true) {
+    Batch batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      batchQueued.wait(lock, [this]() {
+        return stop || done || !queuedBatches.empty();
+      });
+      if (stop || queuedBatches.empty()) {
+        return;
+      }
+
+      batch = std::move(queuedBatches.front());
+      queuedBatches.pop_front();
+    }
+
+    records.clear();
+    const uint8_t *data = batch.data.data();
+    for (size_t length : batch.lengths) {
+      records.emplace_back(data, length);
+      data += length;
+    }
+    results.assign(records.size(),
+                   BtrieveDatabase::LoadRecordResult::SKIP_COUNT);
+
+    try {
+      loader->onRecordsLoaded(records, results);
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+      }
+      batchFreed.notify_all();
+      return;
+    }
+
+    unsigned int written = 0;
+    bool cancel = false;
+    for (auto result : results) {
+      if (result == BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION) {
+        cancel = true;
+        break;
+      } else if (result == BtrieveDatabase::LoadRecordResult::COUNT) {
+        ++written;
+      }
+    }
+    recordsWritten += written;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      cancelled = cancel;
+      freeBatches.push_back(std::move(batch));
+    }
+    batchFreed.notify_all();
+
+    if (cancel) {
+      return;
+    }
+  }
+}
+}  // namespace btrieve
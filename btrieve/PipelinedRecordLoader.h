@@ -0,0 +1,91 @@
+#ifndef __PIPELINED_RECORD_LOADER_H_
+#define __PIPELINED_RECORD_LOADER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "BtrieveDatabase.h"
+#include "SqlDatabase.h"
+
+namespace btrieve {
+
+// Hands records to another RecordLoader on a dedicated writer thread, so the
+// caller goes on parsing the next records while the previous ones are being
+// stored. Records are copied into one of queueDepth batch buffers, which
+// bounds the memory held by the pipeline; the caller blocks once every buffer
+// is waiting on the writer.
+//
+// Since the caller doesn't wait for the writer, every record handed over is
+// reported as COUNT. If the wrapped loader cancels the enumeration or throws,
+// the writer stops and the caller finds out on its next call.
+class PipelinedRecordLoader : public RecordLoader {
+ public:
+  // The default number of batches that can be in flight at once.
+  static const size_t DEFAULT_QUEUE_DEPTH = 8;
+
+  PipelinedRecordLoader(std::unique_ptr<RecordLoader> loader,
+                        size_t queueDepth = DEFAULT_QUEUE_DEPTH);
+
+  // Stops the writer, dropping any batches it hasn't written yet.
+  virtual ~PipelinedRecordLoader();
+
+  virtual BtrieveDatabase::LoadRecordResult onRecordLoaded(
+      std::basic_string_view<uint8_t> record) override;
+
+  virtual void onRecordsLoaded(
+      std::span<const std::basic_string_view<uint8_t>> records,
+      std::span<BtrieveDatabase::LoadRecordResult> results) override;
+
+  // Waits for the writer to store every queued batch, then completes the
+  // wrapped loader on the calling thread. Rethrows anything the writer threw.
+  virtual void onRecordsComplete() override;
+
+  virtual void addStats(ConversionStats &stats) const override {
+    loader->addStats(stats);
+  }
+
+  // Returns how many records the wrapped loader has stored so far.
+  unsigned int getRecordsWritten() const { return recordsWritten.load(); }
+
+ private:
+  // Records stored back to back in data, with their lengths in lengths.
+  struct Batch {
+    std::vector<uint8_t> data;
+    std::vector<size_t> lengths;
+  };
+
+  void writeBatches();
+
+  void stopWriter();
+
+  std::unique_ptr<RecordLoader> loader;
+
+  std::mutex mutex;
+  std::condition_variable batchQueued;
+  std::condition_variable batchFreed;
+  std::deque<Batch> queuedBatches;
+  std::vector<Batch> freeBatches;
+  // no more batches are coming, the writer exits once the queue is empty
+  bool done;
+  // the writer exits right away
+  bool stop;
+  bool cancelled;
+  std::exception_ptr error;
+
+  std::atomic<unsigned int> recordsWritten;
+
+  std::thread writer;
+};
+}  // namespace btrieve
+
+#endif
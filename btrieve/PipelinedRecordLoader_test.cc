@@ -0,0 +1,154 @@
+#include "PipelinedRecordLoader.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BtrieveException.h"
+#include "TestBase.h"
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+namespace {
+
+static std::basic_string<uint8_t> makeRecord(unsigned int i) {
+  std::basic_string<uint8_t> record;
+  // vary the length so batches are packed with records of different sizes
+  for (unsigned int j = 0; j <= i % 7; ++j) {
+    record.push_back(static_cast<uint8_t>(i + j));
+  }
+  return record;
+}
+
+// Feeds count records to loader in batches of batchSize, stopping early if
+// it's cancelled. Returns how many records were handed over.
+static unsigned int loadRecords(RecordLoader &loader, unsigned int count,
+                                unsigned int batchSize) {
+  std::vector<std::basic_string<uint8_t>> storage;
+  std::vector<std::basic_string_view<uint8_t>> batch;
+  std::vector<BtrieveDatabase::LoadRecordResult> results;
+
+  unsigned int i = 0;
+  while (i < count) {
+    storage.clear();
+    batch.clear();
+    for (unsigned int j = 0; j < batchSize && i < count; ++j, ++i) {
+      storage.push_back(makeRecord(i));
+    }
+    for (const auto &record : storage) {
+      batch.push_back(record);
+    }
+
+    results.assign(batch.size(), BtrieveDatabase::LoadRecordResult::SKIP_COUNT);
+    loader.onRecordsLoaded(batch, results);
+    if (results[0] == BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION) {
+      return i - static_cast<unsigned int>(batch.size());
+    }
+    for (auto result : results) {
+      EXPECT_EQ(result, BtrieveDatabase::LoadRecordResult::COUNT);
+    }
+  }
+  return i;
+}
+
+}  // namespace
+
+TEST(PipelinedRecordLoader, WritesEveryRecordInOrder) {
+  auto collector = new CollectingRecordLoader();
+  collector->skipEveryOther = true;
+  PipelinedRecordLoader pipeline((std::unique_ptr<RecordLoader>(collector)),
+                                 /* queueDepth= */ 2);
+
+  ASSERT_EQ(loadRecords(pipeline, 1000, 16), 1000u);
+  pipeline.onRecordsComplete();
+
+  ASSERT_EQ(collector->records.size(), 1000u);
+  for (unsigned int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(collector->records[i], makeRecord(i)) << i;
+  }
+
+  // the collector skips counting every other record
+  EXPECT_EQ(pipeline.getRecordsWritten(), 500u);
+  EXPECT_EQ(collector->completions, 1);
+}
+
+TEST(PipelinedRecordLoader, WritesOnItsOwnThread) {
+  auto collector = new CollectingRecordLoader();
+  PipelinedRecordLoader pipeline((std::unique_ptr<RecordLoader>(collector)));
+
+  loadRecords(pipeline, 10, 4);
+  pipeline.onRecordsComplete();
+
+  EXPECT_NE(collector->loaderThread, std::this_thread::get_id());
+  EXPECT_EQ(collector->completionThread, std::this_thread::get_id());
+}
+
+TEST(PipelinedRecordLoader, SingleRecords) {
+  auto collector = new CollectingRecordLoader();
+  PipelinedRecordLoader pipeline((std::unique_ptr<RecordLoader>(collector)));
+
+  for (unsigned int i = 0; i < 5; ++i) {
+    auto record = makeRecord(i);
+    EXPECT_EQ(pipeline.onRecordLoaded(record),
+              BtrieveDatabase::LoadRecordResult::COUNT);
+  }
+  pipeline.onRecordsComplete();
+
+  EXPECT_EQ(collector->records.size(), 5u);
+}
+
+TEST(PipelinedRecordLoader, RethrowsWriterErrors) {
+  auto collector = new CollectingRecordLoader();
+  collector->throwAt = 100;
+  PipelinedRecordLoader pipeline((std::unique_ptr<RecordLoader>(collector)),
+                                 /* queueDepth= */ 2);
+
+  // depending on how far behind the writer is, the error surfaces either
+  // while queueing or when completing
+  EXPECT_THROW(
+      {
+        loadRecords(pipeline, 1000, 16);
+        pipeline.onRecordsComplete();
+      },
+      BtrieveException);
+
+  EXPECT_EQ(collector->records.size(), 100u);
+  EXPECT_EQ(collector->completions, 0);
+}
+
+TEST(PipelinedRecordLoader, StopsWhenCancelled) {
+  auto collector = new CollectingRecordLoader();
+  collector->cancelAt = 40;
+  PipelinedRecordLoader pipeline((std::unique_ptr<RecordLoader>(collector)),
+                                 /* queueDepth= */ 1);
+
+  unsigned int handedOver = loadRecords(pipeline, 1000, 16);
+  pipeline.onRecordsComplete();
+
+  EXPECT_LT(handedOver, 1000u);
+  EXPECT_EQ(collector->records.size(), 40u);
+  EXPECT_EQ(collector->completions, 1);
+}
+
+TEST(PipelinedRecordLoader, DestructionWithoutCompleting) {
+  bool destroyed = false;
+  bool destroyedWhileLoading = false;
+  int completions = -1;
+  auto collector = new CollectingRecordLoader();
+  collector->onDestroyed = [&](const CollectingRecordLoader &loader) {
+    destroyed = true;
+    destroyedWhileLoading = loader.loading;
+    completions = loader.completions;
+  };
+  {
+    PipelinedRecordLoader pipeline((std::unique_ptr<RecordLoader>(collector)));
+    loadRecords(pipeline, 1000, 16);
+  }
+
+  // the writer was stopped before the loader went away, and nothing was
+  // committed
+  EXPECT_TRUE(destroyed);
+  EXPECT_FALSE(destroyedWhileLoading);
+  EXPECT_EQ(completions, 0);
+}
@@ -7,6 +7,7 @@
 
 #include "Key.h"
 #include "Reader.h"
+#include "Record.h"
 
 namespace btrieve {
 
@@ -14,7 +15,7 @@ enum CursorDirection { Seek, Forward, Reverse };
 
 class Query {
  public:
-  Query(unsigned int position_, const Key *key_,
+  Query(uint64_t position_, const Key *key_,
         std::basic_string_view<uint8_t> keyData_)
       : position(position_),
         cursorDirection(CursorDirection::Seek),
@@ -31,7 +32,7 @@ class Query {
 
   const Key *getKey() const { return key; }
 
-  const unsigned int getPosition() const { return position; }
+  uint64_t getPosition() const { return position; }
 
   std::basic_string_view<uint8_t> getKeyData() const {
     return std::basic_string_view<uint8_t>(keyData.data(), keyData.size());
@@ -40,7 +41,7 @@ class Query {
   virtual std::pair<bool, Record> next(CursorDirection cursorDirection) = 0;
 
  protected:
-  unsigned int position;
+  uint64_t position;
   CursorDirection cursorDirection;
   const Key *key;
   std::vector<uint8_t> keyData;
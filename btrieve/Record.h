@@ -13,10 +13,10 @@ class Record {
  public:
   Record() : position(-1) {}
 
-  Record(unsigned int position_, std::basic_string_view<uint8_t> data_)
+  Record(uint64_t position_, std::basic_string_view<uint8_t> data_)
       : position(position_), data(data_.data(), data_.data() + data_.size()) {}
 
-  Record(unsigned int position_, std::vector<uint8_t> data_)
+  Record(uint64_t position_, std::vector<uint8_t> data_)
       : position(position_), data(data_) {}
 
   Record(const Record &record) : position(record.position), data(record.data) {}
@@ -24,7 +24,7 @@ class Record {
   Record(Record &&record)
       : position(record.position), data(std::move(record.data)) {}
 
-  unsigned int getPosition() const { return position; }
+  uint64_t getPosition() const { return position; }
 
   const std::vector<uint8_t> &getData() const { return data; }
 
@@ -35,7 +35,7 @@ class Record {
   }
 
  private:
-  unsigned int position;
+  uint64_t position;
   std::vector<uint8_t> data;
 };
 }  // namespace btrieve
@@ -0,0 +1,367 @@
+#include "RecordCursor.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "BtrieveDatabase.h"
+#include "PageReadAhead.h"
+#include "PageSource.h"
+
+namespace btrieve {
+
+// The number of consecutive pages handed to a decode thread at a time.
+static const unsigned int PAGES_PER_DECODE_CHUNK = 64;
+
+// Decodes runs of pages on a pool of worker threads and hands them back to the
+// cursor in page order.
+class ParallelPageDecoder {
+ public:
+  // The records decoded from a run of consecutive pages. Fixed length records
+  // are views straight into the page source, variable length records are
+  // copied into storage since the decoding cursor reuses its scratch buffer.
+  struct DecodedChunk {
+    struct DecodedRecord {
+      const uint8_t *data;  // nullptr if the record lives in storage
+      size_t offset;
+      size_t length;
+      unsigned int recordOffset;
+    };
+
+    struct DecodedPage {
+      unsigned int logicalPage;
+      // index into records one past the last record of this page
+      size_t recordsEnd;
+    };
+
+    std::vector<DecodedPage> pages;
+    std::vector<DecodedRecord> records;
+    std::vector<uint8_t> storage;
+    // set if decoding threw, in which case the chunk ends where it did
+    std::exception_ptr error;
+    // whether error was thrown while reading the records of the last page,
+    // rather than while moving to the page after it
+    bool errorInPage = false;
+    // the fragment pages visited by the cursor that decoded the chunk
+    FragmentPageTracker fragmentPages;
+    bool ready = false;
+  };
+
+  ParallelPageDecoder(const BtrieveDatabase &database_,
+                      std::shared_ptr<const PageSource> source_,
+                      unsigned int firstPage_, unsigned int endPage_,
+                      unsigned int threads, PageReadAhead *readAhead_)
+      : database(database_),
+        source(source_),
+        readAhead(readAhead_),
+        firstPage(firstPage_),
+        endPage(endPage_),
+        chunkCount((endPage_ - firstPage_ + PAGES_PER_DECODE_CHUNK - 1) /
+                   PAGES_PER_DECODE_CHUNK),
+        // bounds how far the workers may run ahead of the cursor, and with it
+        // memory use
+        window(static_cast<size_t>(threads) * 4),
+        slots(window),
+        nextChunk(0),
+        consumedChunks(0),
+        stop(false) {
+    for (unsigned int i = 0; i < threads; ++i) {
+      workers.emplace_back([this]() { decodeChunks(); });
+    }
+  }
+
+  ~ParallelPageDecoder() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    slotFree.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Waits for the next chunk in page order and moves it into chunk. Returns
+  // false once every chunk has been handed out.
+  bool next(DecodedChunk &chunk) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (consumedChunks >= chunkCount) {
+        return false;
+      }
+
+      DecodedChunk &slot = slots[consumedChunks % window];
+      chunkReady.wait(lock, [&slot]() { return slot.ready; });
+      chunk = std::move(slot);
+      slot.ready = false;
+      ++consumedChunks;
+    }
+    slotFree.notify_all();
+    return true;
+  }
+
+ private:
+  void decodeChunks() {
+    while (true) {
+      size_t chunk;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        slotFree.wait(lock, [this]() {
+          return stop || nextChunk >= chunkCount ||
+                 nextChunk < consumedChunks + window;
+        });
+        if (stop || nextChunk >= chunkCount) {
+          return;
+        }
+        chunk = nextChunk++;
+        // the workers read pages in chunk order, so this is as far as they got
+        if (readAhead != nullptr) {
+          readAhead->advanceTo(chunk * PAGES_PER_DECODE_CHUNK);
+        }
+      }
+
+      DecodedChunk decoded;
+      decode(chunk, decoded);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      decoded.ready = true;
+      slots[chunk % window] = std::move(decoded);
+      chunkReady.notify_all();
+    }
+  }
+
+  void decode(size_t chunk, DecodedChunk &decoded) {
+    const unsigned int begin =
+        firstPage + static_cast<unsigned int>(chunk * PAGES_PER_DECODE_CHUNK);
+    const unsigned int end = std::min(begin + PAGES_PER_DECODE_CHUNK, endPage);
+    const bool variableLength = database.isVariableLengthRecords();
+
+    RecordCursor cursor(database, source, begin, end, 1);
+    bool inPage = false;
+    try {
+      while (cursor.nextPage()) {
+        decoded.pages.push_back(
+            {cursor.getLogicalPage(), decoded.records.size()});
+        inPage = true;
+
+        while (cursor.nextInPage()) {
+          std::basic_string_view<uint8_t> record = cursor.getRecord();
+          if (variableLength) {
+            decoded.records.push_back({nullptr, decoded.storage.size(),
+                                       record.size(),
+                                       cursor.getRecordOffset()});
+            decoded.storage.insert(decoded.storage.end(), record.begin(),
+                                   record.end());
+          } else {
+            decoded.records.push_back(
+                {record.data(), 0, record.size(), cursor.getRecordOffset()});
+          }
+          decoded.pages.back().recordsEnd = decoded.records.size();
+        }
+        inPage = false;
+      }
+    } catch (...) {
+      decoded.error = std::current_exception();
+      decoded.errorInPage = inPage;
+    }
+
+    decoded.fragmentPages = std::move(cursor.fragmentPages);
+  }
+
+  const BtrieveDatabase &database;
+  std::shared_ptr<const PageSource> source;
+  // nullptr unless pages are prefetched, only touched with mutex held
+  PageReadAhead *readAhead;
+  const unsigned int firstPage;
+  const unsigned int endPage;
+  const size_t chunkCount;
+  const size_t window;
+
+  std::mutex mutex;
+  std::condition_variable chunkReady;
+  std::condition_variable slotFree;
+  std::vector<DecodedChunk> slots;
+  size_t nextChunk;
+  size_t consumedChunks;
+  bool stop;
+
+  std::vector<std::thread> workers;
+
+  friend class RecordCursor;
+
+  // the chunk the cursor is reading from, only touched by the cursor
+  DecodedChunk current;
+  size_t currentPage = 0;
+  size_t currentRecord = 0;
+};
+
+RecordCursor::RecordCursor(const BtrieveDatabase &database_,
+                           std::shared_ptr<const PageSource> source_,
+                           unsigned int firstPage_, unsigned int endPage_,
+                           unsigned int threads, bool readAhead_)
+    : database(database_),
+      source(source_),
+      firstPage(firstPage_),
+      nextLogicalPage(firstPage_),
+      endPage(endPage_),
+      page(nullptr),
+      slot(0),
+      logicalPage(0),
+      recordOffset(0),
+      pagesRead(0) {
+  if (readAhead_ && endPage > firstPage) {
+    // prefetch every page that could be read, in the order it will be read
+    std::vector<uint64_t> pageOffsets;
+    pageOffsets.reserve(endPage - firstPage);
+    for (unsigned int page = firstPage; page < endPage; ++page) {
+      uint8_t patType = 'D';
+      int64_t offset = database.lookupPATEntry(page, patType);
+      if (offset < 0 || (database.v6 && patType != 'D' && patType != 'V')) {
+        pageOffsets.push_back(PageReadAhead::NO_PAGE);
+      } else {
+        pageOffsets.push_back(static_cast<uint64_t>(offset));
+      }
+    }
+    readAhead.reset(new PageReadAhead(source, std::move(pageOffsets),
+                                      database.getPageLength()));
+  }
+
+  // not worth spinning up threads unless each has a few chunks to chew on
+  if (threads > 1 && endPage > firstPage &&
+      endPage - firstPage > PAGES_PER_DECODE_CHUNK * 2) {
+    decoder.reset(new ParallelPageDecoder(database, source, firstPage, endPage,
+                                          threads, readAhead.get()));
+  }
+}
+
+RecordCursor::RecordCursor(RecordCursor &&cursor)
+    : database(cursor.database),
+      source(std::move(cursor.source)),
+      firstPage(cursor.firstPage),
+      nextLogicalPage(cursor.nextLogicalPage),
+      endPage(cursor.endPage),
+      page(cursor.page),
+      slot(cursor.slot),
+      readAhead(std::move(cursor.readAhead)),
+      decoder(std::move(cursor.decoder)),
+      logicalPage(cursor.logicalPage),
+      recordOffset(cursor.recordOffset),
+      pagesRead(cursor.pagesRead),
+      record(cursor.record),
+      scratch(std::move(cursor.scratch)),
+      fragmentPages(std::move(cursor.fragmentPages)) {
+  cursor.page = nullptr;
+  cursor.nextLogicalPage = cursor.endPage;
+}
+
+RecordCursor::~RecordCursor() {}
+
+bool RecordCursor::nextPage() {
+  record = std::basic_string_view<uint8_t>();
+
+  if (!decoder) {
+    if (!nextPageSerial()) {
+      return false;
+    }
+    ++pagesRead;
+    return true;
+  }
+
+  auto &current = decoder->current;
+  while (true) {
+    if (decoder->currentPage + 1 < current.pages.size()) {
+      // skip whatever the caller didn't read of the previous page
+      decoder->currentRecord = current.pages[decoder->currentPage].recordsEnd;
+      ++decoder->currentPage;
+      break;
+    }
+
+    // done with this chunk, so surface any error that ended it
+    if (current.error) {
+      std::exception_ptr error = current.error;
+      current.error = nullptr;
+      std::rethrow_exception(error);
+    }
+
+    if (!decoder->next(current)) {
+      return false;
+    }
+    fragmentPages.merge(current.fragmentPages);
+
+    if (!current.pages.empty()) {
+      decoder->currentPage = 0;
+      decoder->currentRecord = 0;
+      break;
+    }
+  }
+
+  logicalPage = current.pages[decoder->currentPage].logicalPage;
+  ++pagesRead;
+  return true;
+}
+
+bool RecordCursor::nextInPage() {
+  if (!decoder) {
+    return nextInPageSerial();
+  }
+
+  auto &current = decoder->current;
+  if (decoder->currentPage >= current.pages.size()) {
+    return false;
+  }
+
+  if (decoder->currentRecord <
+      current.pages[decoder->currentPage].recordsEnd) {
+    const auto &r = current.records[decoder->currentRecord++];
+    const uint8_t *data =
+        r.data != nullptr ? r.data : current.storage.data() + r.offset;
+    record = std::basic_string_view<uint8_t>(data, r.length);
+    recordOffset = r.recordOffset;
+    return true;
+  }
+
+  record = std::basic_string_view<uint8_t>();
+  // the error was thrown partway through this page
+  if (current.error && current.errorInPage &&
+      decoder->currentPage + 1 == current.pages.size()) {
+    std::exception_ptr error = current.error;
+    current.error = nullptr;
+    std::rethrow_exception(error);
+  }
+  return false;
+}
+
+bool RecordCursor::nextPageSerial() {
+  page = nullptr;
+
+  while (nextLogicalPage < endPage) {
+    logicalPage = nextLogicalPage++;
+    if (readAhead) {
+      readAhead->advanceTo(logicalPage - firstPage);
+    }
+    page = database.getDataPage(*source, logicalPage);
+    if (page != nullptr) {
+      slot = 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool RecordCursor::nextInPageSerial() {
+  if (page != nullptr &&
+      database.nextRecordInPage(*source, logicalPage, page, slot, scratch,
+                                fragmentPages, record)) {
+    // slot has moved past the record
+    recordOffset = 6 + (slot - 1) * database.getPhysicalRecordLength();
+    return true;
+  }
+
+  page = nullptr;
+  record = std::basic_string_view<uint8_t>();
+  return false;
+}
+}  // namespace btrieve
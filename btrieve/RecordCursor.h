@@ -0,0 +1,119 @@
+#ifndef __RECORD_CURSOR_H_
+#define __RECORD_CURSOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "ByteStringViewTraits.h"
+#include "FragmentPageTracker.h"
+
+namespace btrieve {
+
+class BtrieveDatabase;
+class PageReadAhead;
+class PageSource;
+class ParallelPageDecoder;
+
+// Iterates over every record of a BtrieveDatabase in physical order, decoding
+// one page at a time. Views returned by getRecord point either straight into
+// the page source or into a scratch buffer owned by the cursor, and stay valid
+// until the cursor advances. A cursor must not outlive the BtrieveDatabase
+// that opened it.
+class RecordCursor {
+ public:
+  RecordCursor(RecordCursor &&cursor);
+
+  ~RecordCursor();
+
+  // Advances to the next record, moving on to later pages as needed. Returns
+  // false once every record has been read.
+  bool next() {
+    while (!nextInPage()) {
+      if (!nextPage()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Moves to the next data page, skipping pages that can't hold records.
+  // Returns false once there are no more pages. The records on the page are
+  // then read with nextInPage.
+  bool nextPage();
+
+  // Advances to the next record on the current page. Returns false once the
+  // current page has no more records.
+  bool nextInPage();
+
+  // Returns the current record.
+  std::basic_string_view<uint8_t> getRecord() const { return record; }
+
+  // Returns the logical page holding the current record.
+  unsigned int getLogicalPage() const { return logicalPage; }
+
+  // Returns the offset in bytes of the current record from the start of its
+  // page.
+  unsigned int getRecordOffset() const { return recordOffset; }
+
+  // Returns how many data pages nextPage has moved to so far.
+  uint64_t getPagesRead() const { return pagesRead; }
+
+  // Returns how many distinct variable length fragment pages the records
+  // read so far were reassembled from.
+  uint64_t getFragmentPagesRead() const {
+    return fragmentPages.getPageCount();
+  }
+
+  // Returns how many times the records read so far visited a variable length
+  // fragment page, counting every fragment.
+  uint64_t getFragmentPageVisits() const { return fragmentPages.getVisits(); }
+
+ private:
+  friend class BtrieveDatabase;
+  friend class ParallelPageDecoder;
+
+  // Iterates over logical pages [firstPage, endPage) of database, decoding
+  // pages on threads worker threads if threads > 1, and prefetching them on
+  // another if readAhead is set.
+  RecordCursor(const BtrieveDatabase &database,
+               std::shared_ptr<const PageSource> source, unsigned int firstPage,
+               unsigned int endPage, unsigned int threads,
+               bool readAhead = false);
+
+  bool nextPageSerial();
+  bool nextInPageSerial();
+
+  const BtrieveDatabase &database;
+  std::shared_ptr<const PageSource> source;
+
+  const unsigned int firstPage;
+  unsigned int nextLogicalPage;
+  unsigned int endPage;
+
+  // the current page when decoding serially, nullptr if there isn't one
+  const uint8_t *page;
+  // the next record slot to read on page
+  unsigned int slot;
+
+  // set when pages are prefetched, declared before decoder so it outlives the
+  // decode threads reporting to it
+  std::unique_ptr<PageReadAhead> readAhead;
+  // set when pages are decoded by a pool of threads instead
+  std::unique_ptr<ParallelPageDecoder> decoder;
+
+  unsigned int logicalPage;
+  unsigned int recordOffset;
+  uint64_t pagesRead;
+  std::basic_string_view<uint8_t> record;
+  // holds the current record if it's variable length and had to be
+  // reassembled
+  std::vector<uint8_t> scratch;
+  // the variable length pages visited by this cursor, and by decoder for the
+  // chunks it has handed back
+  FragmentPageTracker fragmentPages;
+};
+}  // namespace btrieve
+
+#endif
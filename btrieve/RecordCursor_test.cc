@@ -0,0 +1,147 @@
+#include "RecordCursor.h"
+
+#include "BtrieveDatabase.h"
+#include "BtrieveException.h"
+#include "TestBase.h"
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+TEST(RecordCursor, MatchesParseDatabase) {
+  for (const wchar_t *fileName :
+       {_TEXT("assets/MBBSEMU.DAT"), _TEXT("assets/VARIABLE.DAT"),
+        _TEXT("assets/WCCACMS2.DAT"), _TEXT("assets/WGSMENU2.DAT"),
+        _TEXT("assets/GALTELA.DAT")}) {
+    auto expected = readAllRecords(fileName);
+
+    for (unsigned int threads : {1u, 3u}) {
+      BtrieveDatabase database;
+      database.setDecodeThreads(threads);
+      ASSERT_EQ(database.open(fileName), BtrieveError::Success);
+
+      std::vector<std::vector<uint8_t>> records;
+      unsigned int lastPage = 0;
+      unsigned int lastOffset = 0;
+      RecordCursor cursor = database.openCursor();
+      while (cursor.next()) {
+        records.emplace_back(cursor.getRecord().begin(),
+                             cursor.getRecord().end());
+
+        // records come back in physical order
+        EXPECT_TRUE(cursor.getLogicalPage() > lastPage ||
+                    (cursor.getLogicalPage() == lastPage &&
+                     cursor.getRecordOffset() > lastOffset));
+        lastPage = cursor.getLogicalPage();
+        lastOffset = cursor.getRecordOffset();
+      }
+
+      EXPECT_TRUE(records == expected)
+          << toStdString(fileName) << " with " << threads << " threads";
+    }
+  }
+}
+
+TEST(RecordCursor, ReadAheadMatchesParseDatabase) {
+  for (const wchar_t *fileName :
+       {_TEXT("assets/MBBSEMU.DAT"), _TEXT("assets/VARIABLE.DAT"),
+        _TEXT("assets/WCCACMS2.DAT"), _TEXT("assets/GALTELA.DAT")}) {
+    auto expected = readAllRecords(fileName);
+
+    for (unsigned int threads : {1u, 3u}) {
+      BtrieveDatabase database;
+      database.setDecodeThreads(threads);
+      database.setReadAhead(true);
+      ASSERT_EQ(database.open(fileName), BtrieveError::Success);
+
+      std::vector<std::vector<uint8_t>> records;
+      RecordCursor cursor = database.openCursor();
+      while (cursor.next()) {
+        records.emplace_back(cursor.getRecord().begin(),
+                             cursor.getRecord().end());
+      }
+
+      EXPECT_TRUE(records == expected)
+          << toStdString(fileName) << " with " << threads << " threads";
+    }
+  }
+}
+
+TEST(RecordCursor, IteratesPageByPage) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/MBBSEMU.DAT")), BtrieveError::Success);
+
+  RecordCursor cursor = database.openCursor();
+  // nothing to read before the first page
+  EXPECT_FALSE(cursor.nextInPage());
+
+  ASSERT_TRUE(cursor.nextPage());
+  // the only data page in the file
+  EXPECT_EQ(cursor.getLogicalPage(), 5u);
+
+  unsigned int recordCount = 0;
+  while (cursor.nextInPage()) {
+    EXPECT_EQ(cursor.getRecord().size(), database.getRecordLength());
+    EXPECT_EQ(cursor.getRecordOffset(),
+              6 + recordCount * database.getPhysicalRecordLength());
+    ++recordCount;
+  }
+  EXPECT_EQ(recordCount, 4u);
+
+  // the remaining pages hold no records
+  while (cursor.nextPage()) {
+    EXPECT_FALSE(cursor.nextInPage());
+  }
+  EXPECT_FALSE(cursor.next());
+}
+
+TEST(RecordCursor, OutlivesClose) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/GALTELA.DAT")), BtrieveError::Success);
+
+  RecordCursor cursor = database.openCursor();
+  database.close();
+
+  unsigned int recordCount = 0;
+  while (cursor.next()) {
+    ++recordCount;
+  }
+  EXPECT_EQ(recordCount, 73u);
+
+  EXPECT_THROW(database.openCursor(), BtrieveException);
+}
+
+TEST(RecordCursor, OpenCursorRequiresOpenDatabase) {
+  BtrieveDatabase database;
+
+  EXPECT_THROW(database.openCursor(), BtrieveException);
+}
+
+TEST(RecordCursor, CountsDistinctFragmentPages) {
+  for (unsigned int threads : {1u, 4u}) {
+    BtrieveDatabase database;
+    database.setDecodeThreads(threads);
+    ASSERT_EQ(database.open(_TEXT("assets/VARIABLE.DAT")),
+              BtrieveError::Success);
+
+    RecordCursor cursor = database.openCursor();
+    while (cursor.next()) {
+    }
+
+    // records here span several pages, but the next record usually continues
+    // on a page the previous one already visited
+    EXPECT_EQ(cursor.getFragmentPageVisits(), 2001u) << threads;
+    EXPECT_EQ(cursor.getFragmentPagesRead(), 1070u) << threads;
+  }
+}
+
+TEST(RecordCursor, NoFragmentPagesForFixedRecords) {
+  BtrieveDatabase database;
+  ASSERT_EQ(database.open(_TEXT("assets/GALTELA.DAT")), BtrieveError::Success);
+
+  RecordCursor cursor = database.openCursor();
+  while (cursor.next()) {
+  }
+
+  EXPECT_EQ(cursor.getFragmentPageVisits(), 0u);
+  EXPECT_EQ(cursor.getFragmentPagesRead(), 0u);
+}
@@ -0,0 +1,437 @@
+#include "SortedRecordLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <queue>
+
+#include "BtrieveException.h"
+
+namespace btrieve {
+
+// Ranks the storage classes of sqlite values in the order sqlite sorts them.
+static int getStorageClassRank(BindableValue::Type type) {
+  switch (type) {
+    case BindableValue::Type::Null:
+      return 0;
+    case BindableValue::Type::Integer:
+    case BindableValue::Type::Double:
+      return 1;
+    case BindableValue::Type::Text:
+      return 2;
+    case BindableValue::Type::Blob:
+    default:
+      return 3;
+  }
+}
+
+static int compareBytes(const void *left, size_t leftLength, const void *right,
+                        size_t rightLength) {
+  int result = memcmp(left, right, std::min(leftLength, rightLength));
+  if (result != 0) {
+    return result;
+  }
+  return leftLength < rightLength ? -1 : (leftLength > rightLength ? 1 : 0);
+}
+
+namespace {
+// A key value as either a BindableValue or a KeyBatchEncoder::Value holds it,
+// with the bytes of text and blobs wherever they're kept.
+struct KeyView {
+  BindableValue::Type type;
+  int64_t integerValue;
+  double doubleValue;
+  std::basic_string_view<uint8_t> bytes;
+};
+
+// Reads back the records of a run written by SortedRecordLoader::writeRun, in
+// order. Each record is its key value's type, then the value itself, a 64-bit
+// integer or double, or the length and bytes of text and blobs, then the
+// length and bytes of the record.
+class RunReader {
+ public:
+  explicit RunReader(FILE *file_) : file(file_) {}
+
+  // Reads the next record of the run, returning false once there are none
+  // left. Throws BtrieveException if the run is cut short.
+  bool next() {
+    uint8_t storedType;
+    if (fread(&storedType, 1, 1, file) != 1) {
+      if (ferror(file)) {
+        throw BtrieveException(BtrieveError::IOError,
+                               "Can't read sorted records");
+      }
+      return false;
+    }
+
+    key.type = static_cast<BindableValue::Type>(storedType);
+    switch (key.type) {
+      case BindableValue::Type::Integer:
+        readExactly(&key.integerValue, sizeof(key.integerValue));
+        break;
+      case BindableValue::Type::Double:
+        readExactly(&key.doubleValue, sizeof(key.doubleValue));
+        break;
+      case BindableValue::Type::Text:
+      case BindableValue::Type::Blob:
+        readBytes(keyBytes);
+        key.bytes =
+            std::basic_string_view<uint8_t>(keyBytes.data(), keyBytes.size());
+        break;
+      case BindableValue::Type::Null:
+      default:
+        break;
+    }
+    readBytes(record);
+    return true;
+  }
+
+  const KeyView &getKey() const { return key; }
+
+  std::basic_string_view<uint8_t> getRecord() const {
+    return std::basic_string_view<uint8_t>(record.data(), record.size());
+  }
+
+ private:
+  void readExactly(void *buffer, size_t length) {
+    if (fread(buffer, 1, length, file) != length) {
+      throw BtrieveException(BtrieveError::IOError,
+                             "Sorted records were cut short");
+    }
+  }
+
+  void readBytes(std::vector<uint8_t> &bytes) {
+    uint32_t length;
+    readExactly(&length, sizeof(length));
+    bytes.resize(length);
+    readExactly(bytes.data(), length);
+  }
+
+  FILE *file;
+  KeyView key;
+  std::vector<uint8_t> keyBytes;
+  std::vector<uint8_t> record;
+};
+}  // namespace
+
+static int compareKeyViews(const KeyView &left, const KeyView &right) {
+  const int leftRank = getStorageClassRank(left.type);
+  const int rightRank = getStorageClassRank(right.type);
+  if (leftRank != rightRank) {
+    return leftRank - rightRank;
+  }
+
+  switch (left.type) {
+    case BindableValue::Type::Null:
+      return 0;
+    case BindableValue::Type::Integer:
+    case BindableValue::Type::Double:
+      if (left.type == BindableValue::Type::Integer &&
+          right.type == BindableValue::Type::Integer) {
+        return left.integerValue < right.integerValue
+                   ? -1
+                   : (left.integerValue > right.integerValue ? 1 : 0);
+      } else {
+        const double leftValue = left.type == BindableValue::Type::Integer
+                                     ? static_cast<double>(left.integerValue)
+                                     : left.doubleValue;
+        const double rightValue = right.type == BindableValue::Type::Integer
+                                      ? static_cast<double>(right.integerValue)
+                                      : right.doubleValue;
+        return leftValue < rightValue ? -1 : (leftValue > rightValue ? 1 : 0);
+      }
+    case BindableValue::Type::Text:
+    case BindableValue::Type::Blob:
+    default:
+      return compareBytes(left.bytes.data(), left.bytes.size(),
+                          right.bytes.data(), right.bytes.size());
+  }
+}
+
+static KeyView toKeyView(const BindableValue &value) {
+  KeyView view = {value.getType(), 0, 0, std::basic_string_view<uint8_t>()};
+  switch (value.getType()) {
+    case BindableValue::Type::Integer:
+      view.integerValue = value.getIntegerValue();
+      break;
+    case BindableValue::Type::Double:
+      view.doubleValue = value.getDoubleValue();
+      break;
+    case BindableValue::Type::Text:
+      view.bytes = std::basic_string_view<uint8_t>(
+          reinterpret_cast<const uint8_t *>(value.getStringValue().data()),
+          value.getStringValue().size());
+      break;
+    case BindableValue::Type::Blob:
+      view.bytes = std::basic_string_view<uint8_t>(
+          value.getBlobValue().data(), value.getBlobValue().size());
+      break;
+    case BindableValue::Type::Null:
+    default:
+      break;
+  }
+  return view;
+}
+
+static KeyView toKeyView(const KeyBatchEncoder::Value &value,
+                         const std::vector<uint8_t> &keyBytes) {
+  KeyView view = {value.type, 0, 0, std::basic_string_view<uint8_t>()};
+  switch (value.type) {
+    case BindableValue::Type::Integer:
+      view.integerValue = value.integerValue;
+      break;
+    case BindableValue::Type::Double:
+      view.doubleValue = value.doubleValue;
+      break;
+    case BindableValue::Type::Text:
+    case BindableValue::Type::Blob:
+      view.bytes = std::basic_string_view<uint8_t>(
+          keyBytes.data() + value.offset, value.length);
+      break;
+    case BindableValue::Type::Null:
+    default:
+      break;
+  }
+  return view;
+}
+
+int SortedRecordLoader::compareKeys(const BindableValue &left,
+                                    const BindableValue &right) {
+  return compareKeyViews(toKeyView(left), toKeyView(right));
+}
+
+SortedRecordLoader::SortedRecordLoader(
+    std::unique_ptr<RecordLoader> loader_, const Key &key,
+    std::function<void(unsigned int)> onRecordsStored_, size_t memoryLimit_)
+    : loader(std::move(loader_)),
+      encoder(std::vector<Key>{key}),
+      onRecordsStored(std::move(onRecordsStored_)),
+      memoryLimit(memoryLimit_),
+      sortTime(0) {}
+
+BtrieveDatabase::LoadRecordResult SortedRecordLoader::onRecordLoaded(
+    std::basic_string_view<uint8_t> record) {
+  addRecords(std::span<const std::basic_string_view<uint8_t>>(&record, 1));
+  return BtrieveDatabase::LoadRecordResult::COUNT;
+}
+
+void SortedRecordLoader::onRecordsLoaded(
+    std::span<const std::basic_string_view<uint8_t>> records,
+    std::span<BtrieveDatabase::LoadRecordResult> results) {
+  const auto start = std::chrono::steady_clock::now();
+  addRecords(records);
+  std::fill_n(results.begin(), records.size(),
+              BtrieveDatabase::LoadRecordResult::COUNT);
+  sortTime += std::chrono::steady_clock::now() - start;
+}
+
+void SortedRecordLoader::addRecords(
+    std::span<const std::basic_string_view<uint8_t>> records) {
+  encoder.encode(records);
+  const auto keyValues = encoder.getColumn(0);
+  for (size_t i = 0; i < records.size(); ++i) {
+    Entry entry = {keyValues[i], data.size(), records[i].size()};
+    if (entry.keyValue.type == BindableValue::Type::Text ||
+        entry.keyValue.type == BindableValue::Type::Blob) {
+      const auto bytes = encoder.getBytes(keyValues[i]);
+      entry.keyValue.offset = keyBytes.size();
+      keyBytes.insert(keyBytes.end(), bytes.begin(), bytes.end());
+    }
+    data.insert(data.end(), records[i].begin(), records[i].end());
+    entries.push_back(entry);
+  }
+
+  if (data.size() + keyBytes.size() + entries.size() * sizeof(Entry) >
+      memoryLimit) {
+    writeRun();
+  }
+}
+
+void SortedRecordLoader::sortEntries() {
+  std::stable_sort(entries.begin(), entries.end(),
+                   [this](const Entry &left, const Entry &right) {
+                     return compareKeyViews(toKeyView(left.keyValue, keyBytes),
+                                            toKeyView(right.keyValue,
+                                                      keyBytes)) < 0;
+                   });
+}
+
+void SortedRecordLoader::writeRun() {
+  sortEntries();
+
+  FILE *file = tmpfile();
+  if (file == nullptr) {
+    throw BtrieveException(BtrieveError::IOError,
+                           "Can't create a file to sort records in");
+  }
+  runs.emplace_back(file);
+
+  const auto writeBytes = [file](const uint8_t *bytes, size_t length) {
+    const uint32_t storedLength = static_cast<uint32_t>(length);
+    fwrite(&storedLength, sizeof(storedLength), 1, file);
+    fwrite(bytes, 1, length, file);
+  };
+  for (const Entry &entry : entries) {
+    const uint8_t storedType = static_cast<uint8_t>(entry.keyValue.type);
+    fwrite(&storedType, 1, 1, file);
+    switch (entry.keyValue.type) {
+      case BindableValue::Type::Integer:
+        fwrite(&entry.keyValue.integerValue,
+               sizeof(entry.keyValue.integerValue), 1, file);
+        break;
+      case BindableValue::Type::Double:
+        fwrite(&entry.keyValue.doubleValue, sizeof(entry.keyValue.doubleValue),
+               1, file);
+        break;
+      case BindableValue::Type::Text:
+      case BindableValue::Type::Blob:
+        writeBytes(keyBytes.data() + entry.keyValue.offset,
+                   entry.keyValue.length);
+        break;
+      case BindableValue::Type::Null:
+      default:
+        break;
+    }
+    writeBytes(data.data() + entry.offset, entry.length);
+  }
+
+  if (fflush(file) != 0 || ferror(file)) {
+    throw BtrieveException(BtrieveError::IOError,
+                           "Can't write sorted records");
+  }
+  rewind(file);
+
+  // the buffers are kept for the next run
+  entries.clear();
+  data.clear();
+  keyBytes.clear();
+}
+
+void SortedRecordLoader::onRecordsComplete() {
+  if (runs.empty()) {
+    const auto start = std::chrono::steady_clock::now();
+    sortEntries();
+    // the keys aren't needed anymore
+    keyBytes.clear();
+    keyBytes.shrink_to_fit();
+    sortTime += std::chrono::steady_clock::now() - start;
+
+    size_t i = 0;
+    storeRecords([this, &i](std::basic_string_view<uint8_t> &record) {
+      if (i >= entries.size()) {
+        return false;
+      }
+      record = std::basic_string_view<uint8_t>(data.data() + entries[i].offset,
+                                               entries[i].length);
+      ++i;
+      return true;
+    });
+  } else {
+    const auto start = std::chrono::steady_clock::now();
+    if (!entries.empty()) {
+      writeRun();
+    }
+    entries.shrink_to_fit();
+    data.shrink_to_fit();
+    keyBytes.shrink_to_fit();
+
+    // merges the runs, taking the record with the lowest key from the front
+    // of any of them, and from the oldest run when keys are equal, since it
+    // was loaded first
+    std::vector<RunReader> readers;
+    readers.reserve(runs.size());
+    for (const auto &run : runs) {
+      readers.emplace_back(run.get());
+    }
+    const auto follows = [&readers](size_t left, size_t right) {
+      const int result =
+          compareKeyViews(readers[left].getKey(), readers[right].getKey());
+      return result > 0 || (result == 0 && left > right);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(follows)> fronts(
+        follows);
+    for (size_t i = 0; i < readers.size(); ++i) {
+      if (readers[i].next()) {
+        fronts.push(i);
+      }
+    }
+    sortTime += std::chrono::steady_clock::now() - start;
+
+    // the run of the record last returned, which moves on to its next record
+    // only once that one has been copied
+    std::optional<size_t> current;
+    storeRecords([&](std::basic_string_view<uint8_t> &record) {
+      if (current) {
+        if (readers[*current].next()) {
+          fronts.push(*current);
+        }
+        current.reset();
+      }
+      if (fronts.empty()) {
+        return false;
+      }
+      current = fronts.top();
+      fronts.pop();
+      record = readers[*current].getRecord();
+      return true;
+    });
+  }
+
+  // deletes the runs
+  runs.clear();
+  loader->onRecordsComplete();
+}
+
+void SortedRecordLoader::storeRecords(
+    const std::function<bool(std::basic_string_view<uint8_t> &)>
+        &nextRecord) {
+  std::vector<uint8_t> batchData;
+  std::vector<size_t> lengths;
+  std::vector<std::basic_string_view<uint8_t>> batch;
+  std::vector<BtrieveDatabase::LoadRecordResult> results;
+  unsigned int recordsStored = 0;
+  for (;;) {
+    const auto start = std::chrono::steady_clock::now();
+    batchData.clear();
+    lengths.clear();
+    std::basic_string_view<uint8_t> record;
+    while (lengths.size() < BtrieveDatabase::DEFAULT_RECORD_BATCH_SIZE &&
+           nextRecord(record)) {
+      batchData.insert(batchData.end(), record.begin(), record.end());
+      lengths.push_back(record.size());
+    }
+    sortTime += std::chrono::steady_clock::now() - start;
+    if (lengths.empty()) {
+      break;
+    }
+
+    batch.clear();
+    const uint8_t *recordData = batchData.data();
+    for (size_t length : lengths) {
+      batch.emplace_back(recordData, length);
+      recordData += length;
+    }
+
+    results.assign(batch.size(), BtrieveDatabase::LoadRecordResult::SKIP_COUNT);
+    loader->onRecordsLoaded(batch, results);
+    if (std::find(results.begin(), results.end(),
+                  BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION) !=
+        results.end()) {
+      break;
+    }
+
+    recordsStored += static_cast<unsigned int>(
+        std::count(results.begin(), results.end(),
+                   BtrieveDatabase::LoadRecordResult::COUNT));
+    if (onRecordsStored) {
+      onRecordsStored(recordsStored);
+    }
+  }
+}
+
+void SortedRecordLoader::addStats(ConversionStats &stats) const {
+  stats.sortTime += sortTime;
+  loader->addStats(stats);
+}
+}  // namespace btrieve
@@ -0,0 +1,128 @@
+#ifndef __SORTED_RECORD_LOADER_H_
+#define __SORTED_RECORD_LOADER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "BindableValue.h"
+#include "BtrieveDatabase.h"
+#include "Key.h"
+#include "KeyBatchEncoder.h"
+#include "SqlDatabase.h"
+
+namespace btrieve {
+
+// Hands records to another RecordLoader in the order of one of their keys,
+// rather than the order they're found in the DAT file. The sql database then
+// stores records next to the ones that follow them in that key, and that
+// key's index is built from sequential inserts, so scanning through the key
+// touches fewer and fuller pages.
+//
+// Records are held in memory back to back, with their key values encoded by
+// KeyBatchEncoder into an arena of their own, until onRecordsComplete sorts
+// them and stores them all. Once what's held takes more than the memory
+// limit, it's sorted and written out to a temporary file as a run, and
+// onRecordsComplete merges the runs instead, so files of any size can be
+// sorted. Since storing is deferred, every record handed over is reported as
+// COUNT, and progress is only made by storing them, which onRecordsStored
+// reports.
+class SortedRecordLoader : public RecordLoader {
+ public:
+  // The default number of bytes of records and key values held in memory
+  // before they're written out to a run.
+  static const size_t DEFAULT_MEMORY_LIMIT = 256 << 20;
+
+  // Sorts by key, which is copied. onRecordsStored, if set, is called after
+  // each batch onRecordsComplete stores, with the number of records the
+  // wrapped loader has counted so far. Since buffers grow by doubling, up to
+  // about twice memoryLimit may be held at once.
+  SortedRecordLoader(
+      std::unique_ptr<RecordLoader> loader, const Key &key,
+      std::function<void(unsigned int)> onRecordsStored = nullptr,
+      size_t memoryLimit = DEFAULT_MEMORY_LIMIT);
+
+  virtual ~SortedRecordLoader() {}
+
+  virtual BtrieveDatabase::LoadRecordResult onRecordLoaded(
+      std::basic_string_view<uint8_t> record) override;
+
+  // Throws BtrieveException if a run can't be written.
+  virtual void onRecordsLoaded(
+      std::span<const std::basic_string_view<uint8_t>> records,
+      std::span<BtrieveDatabase::LoadRecordResult> results) override;
+
+  // Sorts the records by key, keeping records with equal keys in the order
+  // they were loaded, hands them to the wrapped loader in batches and then
+  // completes it. Throws BtrieveException if a run can't be read back.
+  virtual void onRecordsComplete() override;
+
+  // Adds the time spent buffering, sorting and merging records to stats'
+  // sortTime, then the wrapped loader's stats.
+  virtual void addStats(ConversionStats &stats) const override;
+
+  // Returns the number of runs written out so far.
+  size_t getRunCount() const { return runs.size(); }
+
+  // Orders two key values the way sqlite orders a column holding them: NULLs
+  // first, then numbers, then text and then blobs, with text and blobs
+  // compared byte by byte. Returns <0, 0 or >0 like memcmp.
+  static int compareKeys(const BindableValue &left,
+                         const BindableValue &right);
+
+ private:
+  // A record held in memory: its key value, whose bytes are in keyBytes, and
+  // where it's stored in data.
+  struct Entry {
+    KeyBatchEncoder::Value keyValue;
+    size_t offset;
+    size_t length;
+  };
+
+  struct FileCloser {
+    void operator()(FILE *f) const { fclose(f); }
+  };
+
+  // Holds on to records and their key values, writing them out to a run
+  // if that takes them over the memory limit.
+  void addRecords(std::span<const std::basic_string_view<uint8_t>> records);
+
+  // Sorts entries by key, keeping records with equal keys in the order they
+  // were loaded.
+  void sortEntries();
+
+  // Writes the records held in memory out to a new run, in key order, and
+  // lets go of them.
+  void writeRun();
+
+  // Hands the records nextRecord returns to the wrapped loader in batches,
+  // until it returns false or the loader cancels. A record only needs to stay
+  // valid until nextRecord is called again.
+  void storeRecords(
+      const std::function<bool(std::basic_string_view<uint8_t> &)>
+          &nextRecord);
+
+  std::unique_ptr<RecordLoader> loader;
+  KeyBatchEncoder encoder;
+  std::function<void(unsigned int)> onRecordsStored;
+  const size_t memoryLimit;
+
+  // The records held in memory, stored back to back in data, with the bytes
+  // of their text and blob key values in keyBytes.
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> keyBytes;
+  std::vector<Entry> entries;
+  // The runs written out so far, oldest first. Each is a temporary file,
+  // deleted once it's closed.
+  std::vector<std::unique_ptr<FILE, FileCloser>> runs;
+
+  ConversionStats::Duration sortTime;
+};
+}  // namespace btrieve
+
+#endif
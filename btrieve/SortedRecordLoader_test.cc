@@ -0,0 +1,157 @@
+#include "SortedRecordLoader.h"
+
+#include <string>
+#include <vector>
+
+#include "TestBase.h"
+#include "gtest/gtest.h"
+
+using namespace btrieve;
+
+namespace {
+
+// A 2 byte integer key at offset 0, the rest of the record is a tag.
+static Key createKey() {
+  KeyDefinition keyDefinition(0, 2, 0, KeyDataType::Integer, Duplicates,
+                              false, 0, 0, 0, "", std::vector<char>());
+  return Key(&keyDefinition, 1);
+}
+
+static std::basic_string<uint8_t> makeRecord(int16_t key, uint8_t tag) {
+  return {static_cast<uint8_t>(key & 0xFF),
+          static_cast<uint8_t>((key >> 8) & 0xFF), tag};
+}
+
+}  // namespace
+
+TEST(SortedRecordLoader, LoadsInKeyOrder) {
+  auto collector = new CollectingRecordLoader();
+  SortedRecordLoader sorter((std::unique_ptr<RecordLoader>(collector)),
+                            createKey());
+
+  // more than a batch, with every key found twice
+  std::vector<std::basic_string<uint8_t>> records;
+  for (unsigned int i = 0; i < 1000; ++i) {
+    records.push_back(makeRecord(static_cast<int16_t>((i * 37) % 500 - 250),
+                                 static_cast<uint8_t>(i / 500)));
+  }
+  std::vector<std::basic_string_view<uint8_t>> batch(records.begin(),
+                                                     records.end());
+  std::vector<BtrieveDatabase::LoadRecordResult> results(
+      batch.size(), BtrieveDatabase::LoadRecordResult::SKIP_COUNT);
+
+  sorter.onRecordsLoaded(batch, results);
+  for (auto result : results) {
+    EXPECT_EQ(result, BtrieveDatabase::LoadRecordResult::COUNT);
+  }
+  EXPECT_TRUE(collector->records.empty());
+
+  sorter.onRecordsComplete();
+  ASSERT_EQ(collector->records.size(), 1000u);
+  for (unsigned int i = 0; i < 1000; ++i) {
+    // records with the same key keep the order they were loaded in
+    ASSERT_EQ(collector->records[i],
+              makeRecord(static_cast<int16_t>(i / 2 - 250),
+                         static_cast<uint8_t>(i % 2)))
+        << i;
+  }
+  EXPECT_EQ(collector->completions, 1);
+}
+
+TEST(SortedRecordLoader, MergesRunsAboveMemoryLimit) {
+  auto collector = new CollectingRecordLoader();
+  SortedRecordLoader sorter((std::unique_ptr<RecordLoader>(collector)),
+                            createKey(), nullptr, /* memoryLimit= */ 1000);
+
+  std::vector<std::basic_string<uint8_t>> records;
+  for (unsigned int i = 0; i < 1000; ++i) {
+    records.push_back(makeRecord(static_cast<int16_t>((i * 37) % 500 - 250),
+                                 static_cast<uint8_t>(i / 500)));
+  }
+  // each batch sorted on its own would keep its records in order, so the
+  // runs are what gets merged
+  for (size_t i = 0; i < records.size(); i += 50) {
+    std::vector<std::basic_string_view<uint8_t>> batch(
+        records.begin() + i, records.begin() + i + 50);
+    std::vector<BtrieveDatabase::LoadRecordResult> results(
+        batch.size(), BtrieveDatabase::LoadRecordResult::SKIP_COUNT);
+    sorter.onRecordsLoaded(batch, results);
+  }
+  EXPECT_GT(sorter.getRunCount(), 1u);
+  EXPECT_TRUE(collector->records.empty());
+
+  sorter.onRecordsComplete();
+  ASSERT_EQ(collector->records.size(), 1000u);
+  for (unsigned int i = 0; i < 1000; ++i) {
+    // records with the same key keep the order they were loaded in, even
+    // when they ended up in different runs
+    ASSERT_EQ(collector->records[i],
+              makeRecord(static_cast<int16_t>(i / 2 - 250),
+                         static_cast<uint8_t>(i % 2)))
+        << i;
+  }
+  EXPECT_EQ(collector->completions, 1);
+}
+
+TEST(SortedRecordLoader, StopsWhenCancelled) {
+  auto collector = new CollectingRecordLoader();
+  collector->cancelAt = 300;
+  SortedRecordLoader sorter((std::unique_ptr<RecordLoader>(collector)),
+                            createKey());
+
+  for (unsigned int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(sorter.onRecordLoaded(makeRecord(static_cast<int16_t>(i), 0)),
+              BtrieveDatabase::LoadRecordResult::COUNT);
+  }
+  sorter.onRecordsComplete();
+
+  // nothing is handed over after the record that cancelled
+  EXPECT_EQ(collector->records.size(), 300u);
+  EXPECT_EQ(collector->calls, 301u);
+  EXPECT_EQ(collector->completions, 1);
+}
+
+TEST(SortedRecordLoader, NoRecords) {
+  auto collector = new CollectingRecordLoader();
+  SortedRecordLoader sorter((std::unique_ptr<RecordLoader>(collector)),
+                            createKey());
+
+  sorter.onRecordsComplete();
+
+  EXPECT_TRUE(collector->records.empty());
+  EXPECT_EQ(collector->completions, 1);
+}
+
+TEST(SortedRecordLoader, ComparesKeysLikeSqlite) {
+  const std::vector<uint8_t> blob = {0x00, 0x01};
+  const std::vector<uint8_t> longerBlob = {0x00, 0x01, 0x00};
+
+  std::vector<BindableValue> ascending;
+  ascending.emplace_back();
+  ascending.emplace_back(int64_t{-5});
+  ascending.emplace_back(-4.5);
+  ascending.emplace_back(int64_t{3});
+  ascending.emplace_back(1e10);
+  ascending.emplace_back("");
+  ascending.emplace_back("ABC");
+  ascending.emplace_back("abc");
+  ascending.emplace_back(blob);
+  ascending.emplace_back(longerBlob);
+
+  for (size_t i = 0; i < ascending.size(); ++i) {
+    for (size_t j = 0; j < ascending.size(); ++j) {
+      int result = SortedRecordLoader::compareKeys(ascending[i], ascending[j]);
+      if (i < j) {
+        EXPECT_LT(result, 0) << i << " " << j;
+      } else if (i > j) {
+        EXPECT_GT(result, 0) << i << " " << j;
+      } else {
+        EXPECT_EQ(result, 0) << i;
+      }
+    }
+  }
+
+  EXPECT_EQ(SortedRecordLoader::compareKeys(BindableValue(int64_t{2}),
+                                            BindableValue(2.0)),
+            0);
+}
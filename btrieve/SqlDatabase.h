@@ -2,13 +2,17 @@
 #define __SQL_DATABASE_H_
 
 #include <memory>
+#include <span>
+#include <string>
 
 #include "BtrieveDatabase.h"
+#include "ConversionStats.h"
 #include "ErrorCode.h"
 #include "LRUCache.h"
 #include "OpenMode.h"
 #include "OperationCode.h"
 #include "Query.h"
+#include "Record.h"
 #include "Text.h"
 
 namespace btrieve {
@@ -20,7 +24,27 @@ class RecordLoader {
   virtual BtrieveDatabase::LoadRecordResult onRecordLoaded(
       std::basic_string_view<uint8_t> record) = 0;
 
+  // Called with a batch of consecutive records, which are only valid until
+  // this returns. Stores the result for each record in the matching entry of
+  // results, and stops at the first record whose result is
+  // CANCEL_ENUMERATION. The default calls onRecordLoaded for each record.
+  virtual void onRecordsLoaded(
+      std::span<const std::basic_string_view<uint8_t>> records,
+      std::span<BtrieveDatabase::LoadRecordResult> results) {
+    for (size_t i = 0; i < records.size(); ++i) {
+      results[i] = onRecordLoaded(records[i]);
+      if (results[i] == BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION) {
+        return;
+      }
+    }
+  }
+
   virtual void onRecordsComplete() = 0;
+
+  // Adds the time this loader and the loaders it wraps spent storing records,
+  // and how many they stored, to stats. Only called after onRecordsComplete.
+  // The default adds nothing.
+  virtual void addStats(ConversionStats & /*stats*/) const {}
 };
 
 // An interface that abstracts a SQL-compatible implementation of
@@ -38,10 +62,27 @@ class SqlDatabase {
                             OpenMode openMode = OpenMode::Normal) = 0;
 
   // Creates a new sql backed file using database as the source of records. If
-  // fileName is nullptr, then it will be created in-memory.
+  // fileName is nullptr, then it will be created in-memory. Records are fed
+  // through the returned RecordLoader, and the database isn't complete until
+  // its onRecordsComplete has been called.
   virtual std::unique_ptr<RecordLoader> create(
       const wchar_t *fileName, const BtrieveDatabase &database) = 0;
 
+  // Records which DAT page each record stored by create's RecordLoader came
+  // from, along with a checksum of each page, so that update can later
+  // replace just the pages that change. pages are those summarized by the
+  // readRecordBatches call whose records reached the RecordLoader, in the
+  // order it delivered them.
+  virtual void saveConvertedPages(
+      const std::vector<BtrieveDatabase::PageSummary> &pages) = 0;
+
+  // Brings the opened database up to date with database, the DAT file it was
+  // converted from, replacing only the records of pages that changed since.
+  // Returns false without changing anything if it can't: the pages weren't
+  // saved, the database was modified after it was converted, the DAT's
+  // record layout or keys changed, or a changed record can't be stored.
+  virtual bool update(const BtrieveDatabase &database) = 0;
+
   // Closes an opened database.
   virtual void close() = 0;
 
@@ -51,11 +92,15 @@ class SqlDatabase {
 
   virtual const std::vector<Key> &getKeys() const { return keys; }
 
-  unsigned int getPosition() const { return position; }
+  // Returns the fingerprint of the DAT file the database was converted from,
+  // see BtrieveDatabase::getFingerprint. Empty if it wasn't recorded.
+  const std::string &getSourceFingerprint() const { return sourceFingerprint; }
+
+  uint64_t getPosition() const { return position; }
 
-  void setPosition(unsigned int position_) { position = position_; }
+  void setPosition(uint64_t position_) { position = position_; }
 
-  std::pair<bool, Record> getRecord(unsigned int position) {
+  std::pair<bool, Record> getRecord(uint64_t position) {
     std::shared_ptr<Record> data = cache.get(position);
     if (data) {
       return std::pair<bool, Record>(true, *data);
@@ -75,9 +120,9 @@ class SqlDatabase {
   virtual unsigned int getRecordCount() const = 0;
   virtual BtrieveError deleteAll() = 0;
   virtual BtrieveError deleteRecord() = 0;
-  virtual std::pair<BtrieveError, unsigned int> insertRecord(
+  virtual std::pair<BtrieveError, uint64_t> insertRecord(
       std::basic_string_view<uint8_t> record) = 0;
-  virtual BtrieveError updateRecord(unsigned int offset,
+  virtual BtrieveError updateRecord(uint64_t offset,
                                     std::basic_string_view<uint8_t> record) = 0;
 
   virtual BtrieveError getByKeyFirst(Query *query) = 0;
@@ -91,21 +136,23 @@ class SqlDatabase {
   virtual BtrieveError getByKeyPrevious(Query *query) = 0;
 
   virtual std::unique_ptr<Query> newQuery(
-      unsigned int position, const Key *key,
+      uint64_t position, const Key *key,
       std::basic_string_view<uint8_t> keyData) = 0;
 
   virtual std::unique_ptr<Query> logicalCurrencySeek(int keyNumber,
-                                                     unsigned int position,
+                                                     uint64_t position,
                                                      BtrieveError &error) = 0;
 
  protected:
-  virtual std::pair<bool, Record> selectRecord(unsigned int position) = 0;
+  virtual std::pair<bool, Record> selectRecord(uint64_t position) = 0;
 
   unsigned int recordLength;
-  unsigned int position;
+  // the sqlite row id of the current record, which isn't bound to 32 bits
+  uint64_t position;
   bool variableLengthRecords;
   std::vector<Key> keys;
-  LRUCache<unsigned int, Record> cache;
+  std::string sourceFingerprint;
+  LRUCache<uint64_t, Record> cache;
 };
 }  // namespace btrieve
 
@@ -1,10 +1,15 @@
 #include "SqliteDatabase.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <optional>
 #include <sstream>
 
 #include "BindableValue.h"
 #include "BtrieveException.h"
+#include "KeyBatchEncoder.h"
 #include "SqlitePreparedStatement.h"
 #include "SqliteQuery.h"
 #include "SqliteTransaction.h"
@@ -17,7 +22,26 @@
 
 namespace btrieve {
 
-static const unsigned int CURRENT_VERSION = 3;
+static const unsigned int CURRENT_VERSION = 6;
+
+// A file being created is brand new and is thrown away if conversion fails, so
+// while loading it there's no need for an on-disk journal, syncing, or sharing
+// it with other connections. The journal is kept in memory rather than turned
+// off, since an insert that fails on a duplicate unique key, single or
+// multi-row, has to roll back the rows it already wrote. Pages past the end of
+// the new file are never journaled, so it stays nearly empty.
+static const char *const BULK_LOAD_PRAGMAS =
+    "PRAGMA journal_mode = MEMORY; PRAGMA synchronous = OFF; "
+    "PRAGMA locking_mode = EXCLUSIVE; PRAGMA cache_size = -65536; "
+    "PRAGMA temp_store = MEMORY;";
+
+// SQLite's default settings, which every connection from open() runs with. The
+// exclusive lock is only released on the next read after returning to normal
+// locking, hence the trailing query.
+static const char *const RUNTIME_PRAGMAS =
+    "PRAGMA journal_mode = DELETE; PRAGMA synchronous = FULL; "
+    "PRAGMA locking_mode = NORMAL; PRAGMA cache_size = -2000; "
+    "PRAGMA temp_store = DEFAULT; SELECT COUNT(*) FROM metadata_t;";
 
 template <class InputIt, class UnaryPred>
 static std::string commaDelimited(InputIt first, InputIt last, UnaryPred pred) {
@@ -34,72 +58,250 @@ static std::string commaDelimited(InputIt first, InputIt last, UnaryPred pred) {
   return sb.str();
 }
 
+// Returns the statement that inserts rows records into data_t, each taking the
+// record followed by the value of each of keys.
+static std::string getInsertionSql(const std::vector<Key> &keys, size_t rows) {
+  std::stringstream sb;
+  sb << "INSERT INTO data_t(data";
+  for (auto &key : keys) {
+    sb << ", " << key.getSqliteKeyName();
+  }
+  sb << ") VALUES";
+
+  std::string row = "(?";
+  for (size_t i = 0; i < keys.size(); ++i) {
+    row += ", ?";
+  }
+  row += ")";
+
+  for (size_t i = 0; i < rows; ++i) {
+    sb << (i > 0 ? ", " : " ") << row;
+  }
+  return sb.str();
+}
+
+// Binds the data and keys of record, starting at parameterNumber.
+static void bindRecord(SqlitePreparedStatement &command,
+                       unsigned int &parameterNumber,
+                       const std::vector<Key> &keys,
+                       std::basic_string_view<uint8_t> record) {
+  command.bindParameter(parameterNumber++, record);
+
+  for (auto &key : keys) {
+    auto param = key.extractKeyInRecordToSqliteObject(record);
+
+    command.bindParameter(parameterNumber++, param);
+  }
+}
+
 class SqliteCreationRecordLoader : public RecordLoader {
  public:
-  SqliteCreationRecordLoader(std::shared_ptr<sqlite3> database_,
-                             const BtrieveDatabase &database)
-      : database(database_), keys(database.getKeys()) {}
+  // persistFileName is where to write the database once it's loaded, when
+  // it's being built in memory. Empty if it's loaded in place.
+  SqliteCreationRecordLoader(SqliteDatabase &sqliteDatabase_,
+                             const BtrieveDatabase &database,
+                             const std::string &persistFileName_)
+      : sqliteDatabase(sqliteDatabase_),
+        persistFileName(persistFileName_),
+        database(sqliteDatabase_.database),
+        keys(database.getKeys()),
+        keyEncoder(keys) {}
   virtual ~SqliteCreationRecordLoader() {}
 
   void createSqliteInsertionCommand() {
-    std::string insertSql;
-    if (!keys.empty()) {
-      std::stringstream sb;
-      sb << "INSERT INTO data_t(data, ";
-      sb << commaDelimited(keys.begin(), keys.end(), [](const Key &key) {
-        return key.getSqliteKeyName();
-      });
-      sb << ") VALUES(@data, ";
-      sb << commaDelimited(keys.begin(), keys.end(), [](const Key &key) {
-        return "@" + key.getSqliteKeyName();
-      });
-      sb << ");";
-      insertSql = sb.str();
-    } else {
-      insertSql = "INSERT INTO data_t(data) VALUES (@data)";
-    }
+    // stay within the number of parameters a statement can have, which is as
+    // low as 999 in older SQLite builds
+    const size_t parametersPerRow = keys.size() + 1;
+    const size_t maxParameters = static_cast<size_t>(
+        sqlite3_limit(database.get(), SQLITE_LIMIT_VARIABLE_NUMBER, -1));
+    rowsPerInsertion =
+        std::min(MAX_ROWS_PER_INSERTION, maxParameters / parametersPerRow);
 
     transaction.reset(new SqliteTransaction(this->database));
-    insertionCommand.reset(
-        new SqlitePreparedStatement(this->database, insertSql.c_str()));
+    insertionCommand.reset(new SqlitePreparedStatement(
+        this->database, getInsertionSql(keys, /* rows= */ 1)));
   }
 
  private:
+  // The most records inserted by a single statement. Past this, longer
+  // statements stop paying off.
+  static constexpr size_t MAX_ROWS_PER_INSERTION = 64;
+
   virtual BtrieveDatabase::LoadRecordResult onRecordLoaded(
       std::basic_string_view<uint8_t> record) {
-    insertionCommand->reset();
-    insertionCommand->bindParameter(1, record);
+    const auto records =
+        std::span<const std::basic_string_view<uint8_t>>(&record, 1);
+    encodeKeys(records);
+    BtrieveDatabase::LoadRecordResult result = insertRecord(record, 0);
+    insertionCommand->clearBindings();
+    return result;
+  }
+
+  virtual void onRecordsLoaded(
+      std::span<const std::basic_string_view<uint8_t>> records,
+      std::span<BtrieveDatabase::LoadRecordResult> results) {
+    encodeKeys(records);
+
+    // inserting never cancels the enumeration, so every record gets a result
+    size_t i = 0;
+    if (rowsPerInsertion > 1) {
+      for (; i + rowsPerInsertion <= records.size(); i += rowsPerInsertion) {
+        insertRecords(records.subspan(i, rowsPerInsertion),
+                      results.subspan(i, rowsPerInsertion), i);
+      }
+    }
+
+    for (; i < records.size(); ++i) {
+      results[i] = insertRecord(records[i], i);
+    }
+
+    // the records and their keys are bound in place, and are about to go away
+    insertionCommand->clearBindings();
+    if (multiRowInsertionCommand) {
+      multiRowInsertionCommand->clearBindings();
+    }
+  }
+
+  // Encodes the keys of records all at once, for bindEncodedRecord.
+  void encodeKeys(std::span<const std::basic_string_view<uint8_t>> records) {
+    const auto start = std::chrono::steady_clock::now();
+    keyEncoder.encode(records);
+    stats.keyEncodingTime += std::chrono::steady_clock::now() - start;
+  }
+
+  // Binds record, which is the one at index in the records last encoded by
+  // encodeKeys, along with its keys, starting at parameterNumber. Neither is
+  // copied, so they're bound until the records are gone.
+  void bindEncodedRecord(SqlitePreparedStatement &command,
+                         unsigned int &parameterNumber,
+                         std::basic_string_view<uint8_t> record,
+                         size_t index) {
+    command.bindStaticBlob(parameterNumber++, record);
+
+    for (size_t key = 0; key < keyEncoder.getKeyCount(); ++key) {
+      const KeyBatchEncoder::Value &value = keyEncoder.getColumn(key)[index];
+      switch (value.type) {
+        case BindableValue::Type::Text:
+          command.bindStaticText(parameterNumber++,
+                                 keyEncoder.getBytes(value));
+          break;
+        case BindableValue::Type::Blob:
+          command.bindStaticBlob(parameterNumber++,
+                                 keyEncoder.getBytes(value));
+          break;
+        default:
+          // integers, doubles and NULLs aren't allocated by BindableValue
+          command.bindParameter(parameterNumber++,
+                                keyEncoder.toBindableValue(value));
+          break;
+      }
+    }
+  }
 
-    unsigned int parameterNumber = 2;
+  // Inserts rowsPerInsertion records with a single statement. firstIndex is
+  // the index of the first of them in the records last encoded.
+  void insertRecords(std::span<const std::basic_string_view<uint8_t>> records,
+                     std::span<BtrieveDatabase::LoadRecordResult> results,
+                     size_t firstIndex) {
+    // prepared on first use, since it's wasted on files with a few records
+    if (!multiRowInsertionCommand) {
+      multiRowInsertionCommand.reset(new SqlitePreparedStatement(
+          this->database, getInsertionSql(keys, rowsPerInsertion)));
+    }
+    multiRowInsertionCommand->reset();
 
-    for (auto &key : keys) {
-      auto param = key.extractKeyInRecordToSqliteObject(record);
+    const auto start = std::chrono::steady_clock::now();
+    unsigned int parameterNumber = 1;
+    for (size_t i = 0; i < records.size(); ++i) {
+      bindEncodedRecord(*multiRowInsertionCommand, parameterNumber,
+                        records[i], firstIndex + i);
+    }
+    const auto bound = std::chrono::steady_clock::now();
+    stats.keyEncodingTime += bound - start;
 
-      insertionCommand->bindParameter(parameterNumber++, param);
+    try {
+      multiRowInsertionCommand->execute();
+    } catch (BtrieveException &ex) {
+      stats.insertTime += std::chrono::steady_clock::now() - bound;
+      // a bad record fails the whole statement, so insert them one by one to
+      // skip just the bad ones
+      for (size_t i = 0; i < records.size(); ++i) {
+        results[i] = insertRecord(records[i], firstIndex + i);
+      }
+      return;
     }
+    stats.insertTime += std::chrono::steady_clock::now() - bound;
+    stats.recordsStored += records.size();
+
+    std::fill(results.begin(), results.end(),
+              BtrieveDatabase::LoadRecordResult::COUNT);
+    sqliteDatabase.convertedRecords.insert(
+        sqliteDatabase.convertedRecords.end(), records.size(), true);
+  }
+
+  // Inserts record, which is the one at index in the records last encoded.
+  BtrieveDatabase::LoadRecordResult insertRecord(
+      std::basic_string_view<uint8_t> record, size_t index) {
+    insertionCommand->reset();
+
+    const auto start = std::chrono::steady_clock::now();
+    unsigned int parameterNumber = 1;
+    bindEncodedRecord(*insertionCommand, parameterNumber, record, index);
+    const auto bound = std::chrono::steady_clock::now();
+    stats.keyEncodingTime += bound - start;
 
     try {
       insertionCommand->execute();
     } catch (BtrieveException &ex) {
+      stats.insertTime += std::chrono::steady_clock::now() - bound;
       // silently ignore, some databases have bad data
+      sqliteDatabase.convertedRecords.push_back(false);
       return BtrieveDatabase::LoadRecordResult::SKIP_COUNT;
     }
+    stats.insertTime += std::chrono::steady_clock::now() - bound;
+    ++stats.recordsStored;
+    sqliteDatabase.convertedRecords.push_back(true);
     return BtrieveDatabase::LoadRecordResult::COUNT;
-  };
+  }
 
+  // Builds the indices and triggers that were deferred until after the bulk
+  // load, then commits everything as a single transaction. A database built
+  // in memory is then written out to its file.
   virtual void onRecordsComplete() {
+    const auto start = std::chrono::steady_clock::now();
+    auto indexed = start;
     try {
+      sqliteDatabase.createSqliteDataIndices(/* unique= */ false);
+      sqliteDatabase.createSqliteTriggers();
+      indexed = std::chrono::steady_clock::now();
       transaction->commit();
     } catch (const BtrieveException &ex) {
       transaction->rollback();
       throw ex;
     }
+
+    if (persistFileName.empty()) {
+      sqliteDatabase.executeSql(RUNTIME_PRAGMAS);
+    } else {
+      sqliteDatabase.persist(persistFileName);
+    }
+    stats.indexTime += indexed - start;
+    stats.commitTime += std::chrono::steady_clock::now() - indexed;
   }
 
+  virtual void addStats(ConversionStats &total) const { total += stats; }
+
+  SqliteDatabase &sqliteDatabase;
+  const std::string persistFileName;
   std::shared_ptr<sqlite3> database;
   std::unique_ptr<SqliteTransaction> transaction;
   std::unique_ptr<SqlitePreparedStatement> insertionCommand;
+  std::unique_ptr<SqlitePreparedStatement> multiRowInsertionCommand;
+  size_t rowsPerInsertion;
   std::vector<Key> keys;
+  KeyBatchEncoder keyEncoder;
+  // only the phases of storing records are filled in
+  ConversionStats stats;
 };
 
 // Opens a Btrieve database as a sql backed file. Will convert a legacy file
@@ -120,6 +322,7 @@ BtrieveError SqliteDatabase::open(const wchar_t *filename, OpenMode openMode) {
 
   loadSqliteMetadata(filename, openFlags);
   loadSqliteKeys();
+  prepareKeyStatements();
 
   if (openMode == OpenMode::ReadOnly) {
     errorCode = sqlite3_exec(database.get(), "PRAGMA query_only = 1;", nullptr,
@@ -156,6 +359,16 @@ void SqliteDatabase::loadSqliteMetadata(const wchar_t *filename,
   if (version != CURRENT_VERSION) {
     upgradeDatabaseFromVersion(version, filename, openFlags);
   }
+
+  SqlitePreparedStatement command(database,
+                                  "SELECT dat_fingerprint FROM metadata_t");
+  std::unique_ptr<SqliteReader> reader = command.executeReader();
+  sourceFingerprint = reader->read() ? reader->getString(0) : std::string();
+
+  SqlitePreparedStatement pagesCommand(
+      database, "SELECT EXISTS(SELECT 1 FROM dat_pages_t)");
+  reader = pagesCommand.executeReader();
+  convertedPagesSaved = reader->read() && reader->getBoolean(0);
 }
 
 void SqliteDatabase::upgradeDatabaseFromVersion(uint32_t currentVersion,
@@ -163,6 +376,18 @@ void SqliteDatabase::upgradeDatabaseFromVersion(uint32_t currentVersion,
                                                 unsigned int openFlags) {
   if (currentVersion == 2) {
     upgradeDatabaseFrom2To3();
+    currentVersion = 3;
+  }
+  if (currentVersion == 3) {
+    upgradeDatabaseFrom3To4();
+    currentVersion = 4;
+  }
+  if (currentVersion == 4) {
+    upgradeDatabaseFrom4To5();
+    currentVersion = 5;
+  }
+  if (currentVersion == 5) {
+    upgradeDatabaseFrom5To6();
   }
 }
 
@@ -214,6 +439,71 @@ void SqliteDatabase::upgradeDatabaseFrom2To3() {
       statement.execute();
     }
     // bump version
+    {
+      SqlitePreparedStatement statement(
+          database, "UPDATE metadata_t SET version = 3");
+      statement.execute();
+    }
+
+    transaction.commit();
+  } catch (const BtrieveException &ex) {
+    transaction.rollback();
+    throw ex;
+  }
+}
+
+void SqliteDatabase::upgradeDatabaseFrom3To4() {
+  SqliteTransaction transaction(database);
+  try {
+    // databases converted before fingerprints were recorded have none, so
+    // they're converted again the next time their DAT file looks modified
+    {
+      SqlitePreparedStatement statement(
+          database, "ALTER TABLE metadata_t ADD COLUMN dat_fingerprint TEXT");
+      statement.execute();
+    }
+    {
+      SqlitePreparedStatement statement(database,
+                                        "UPDATE metadata_t SET version = 4");
+      statement.execute();
+    }
+
+    transaction.commit();
+  } catch (const BtrieveException &ex) {
+    transaction.rollback();
+    throw ex;
+  }
+}
+
+void SqliteDatabase::upgradeDatabaseFrom4To5() {
+  SqliteTransaction transaction(database);
+  try {
+    // the pages of earlier conversions are unknown, so the table stays empty
+    // and they're fully converted again when their DAT file changes
+    createSqliteDatPagesTable();
+    {
+      SqlitePreparedStatement statement(database,
+                                        "UPDATE metadata_t SET version = 5");
+      statement.execute();
+    }
+
+    transaction.commit();
+  } catch (const BtrieveException &ex) {
+    transaction.rollback();
+    throw ex;
+  }
+}
+
+void SqliteDatabase::upgradeDatabaseFrom5To6() {
+  SqliteTransaction transaction(database);
+  try {
+    // the pages were saved without the offsets they were read from, so like
+    // the pages of earlier conversions they're forgotten
+    {
+      SqlitePreparedStatement statement(database, "DROP TABLE dat_pages_t");
+      statement.execute();
+    }
+    createSqliteDatPagesTable();
     {
       SqlitePreparedStatement statement(
           database, "UPDATE metadata_t SET version = %d", CURRENT_VERSION);
@@ -283,6 +573,53 @@ void SqliteDatabase::loadSqliteKeys() {
   }
 }
 
+void SqliteDatabase::prepareKeyStatements() {
+  keyStatements.clear();
+  keyStatements.reserve(keys.size() * static_cast<size_t>(KeyStatement::Count));
+
+  for (const auto &key : keys) {
+    const std::string keyName = key.getSqliteKeyName();
+    const std::string select =
+        "SELECT id, " + keyName + ", data FROM data_t ";
+    const std::string ascending = " ORDER BY " + keyName + " ASC";
+    const std::string descending = " ORDER BY " + keyName + " DESC";
+
+    for (size_t i = 0; i < static_cast<size_t>(KeyStatement::Count); ++i) {
+      std::string sql;
+      switch (static_cast<KeyStatement>(i)) {
+        case KeyStatement::Equal:
+          sql = select + "WHERE " + keyName + " = @value" + ascending;
+          break;
+        case KeyStatement::IsNull:
+          sql = select + "WHERE " + keyName + " IS NULL";
+          break;
+        case KeyStatement::First:
+          sql = select + ascending;
+          break;
+        case KeyStatement::Last:
+          sql = select + descending;
+          break;
+        case KeyStatement::Greater:
+          sql = select + "WHERE " + keyName + " > @value" + ascending;
+          break;
+        case KeyStatement::GreaterOrEqual:
+          sql = select + "WHERE " + keyName + " >= @value" + ascending;
+          break;
+        case KeyStatement::Less:
+          sql = select + "WHERE " + keyName + " < @value" + descending;
+          break;
+        case KeyStatement::LessOrEqual:
+          sql = select + "WHERE " + keyName + " <= @value" + descending;
+          break;
+        case KeyStatement::Count:
+          break;
+      }
+
+      keyStatements.emplace_back(database, sql);
+    }
+  }
+}
+
 #ifdef WIN32
 #define unlink _unlink
 #endif
@@ -292,6 +629,17 @@ std::unique_ptr<RecordLoader> SqliteDatabase::create(
   sqlite3 *db;
   int flags = SQLITE_OPEN_FULLMUTEX | SQLITE_OPEN_READWRITE | openFlags;
 
+  // small enough files are built in memory and copied to their file in one
+  // sequential pass once loaded
+  std::string persistFileName;
+  if (fileName != nullptr && !(openFlags & SQLITE_OPEN_MEMORY) &&
+      inMemoryConversionLimit > 0 &&
+      database.getFileLength() <= inMemoryConversionLimit) {
+    persistFileName = toStdString(fileName);
+    unlink(persistFileName.c_str());
+    fileName = nullptr;
+  }
+
   // remove the file if is exists since we're creating it anew
   if (fileName != nullptr) {
     unlink(toStdString(fileName).c_str());
@@ -309,6 +657,8 @@ std::unique_ptr<RecordLoader> SqliteDatabase::create(
 
   this->database = std::shared_ptr<sqlite3>(db, &sqlite3_close);
 
+  executeSql(BULK_LOAD_PRAGMAS);
+
   recordLength = database.getRecordLength();
   variableLengthRecords = database.isVariableLengthRecords();
   keys = database.getKeys();
@@ -316,21 +666,362 @@ std::unique_ptr<RecordLoader> SqliteDatabase::create(
   createSqliteMetadataTable(database);
   createSqliteKeysTable(database);
   createSqliteDataTable(database);
-  createSqliteDataIndices(database);
-  createSqliteTriggers(database);
+  createSqliteDatPagesTable();
+  convertedRecords.clear();
+  convertedPagesSaved = false;
+  // unique indices reject duplicate records as they're loaded, so they must
+  // exist up front. Everything else is built once the records are in, which
+  // is much cheaper than maintaining each b-tree row by row.
+  createSqliteDataIndices(/* unique= */ true);
+  prepareKeyStatements();
 
   auto recordLoader = std::unique_ptr<SqliteCreationRecordLoader>(
-      new SqliteCreationRecordLoader(this->database, database));
+      new SqliteCreationRecordLoader(*this, database, persistFileName));
   recordLoader->createSqliteInsertionCommand();
   return recordLoader;
 }
 
+void SqliteDatabase::persist(const std::string &fileName) {
+  sqlite3 *db;
+  int errorCode = sqlite3_open_v2(fileName.c_str(), &db,
+                                  SQLITE_OPEN_FULLMUTEX |
+                                      SQLITE_OPEN_READWRITE |
+                                      SQLITE_OPEN_CREATE | openFlags,
+                                  nullptr);
+  std::shared_ptr<sqlite3> fileDatabase(db, &sqlite3_close);
+  if (errorCode != SQLITE_OK) {
+    throwException(errorCode);
+  }
+
+  // the file is still new, so it's written without syncing like the rest of
+  // the conversion
+  errorCode = sqlite3_exec(db, "PRAGMA synchronous = OFF", nullptr, nullptr,
+                           nullptr);
+  if (errorCode != SQLITE_OK) {
+    throwException(errorCode);
+  }
+
+  // copies every page as is, in order, into the empty file
+  sqlite3_backup *backup =
+      sqlite3_backup_init(db, "main", this->database.get(), "main");
+  if (backup == nullptr) {
+    throwException(sqlite3_errcode(db));
+  }
+  sqlite3_backup_step(backup, -1);
+  errorCode = sqlite3_backup_finish(backup);
+  if (errorCode != SQLITE_OK) {
+    throwException(errorCode);
+  }
+
+  errorCode = sqlite3_exec(db, "PRAGMA synchronous = FULL", nullptr, nullptr,
+                           nullptr);
+  if (errorCode != SQLITE_OK) {
+    throwException(errorCode);
+  }
+
+  preparedStatements.clear();
+  this->database = fileDatabase;
+  prepareKeyStatements();
+}
+
+void SqliteDatabase::saveConvertedPages(
+    const std::vector<BtrieveDatabase::PageSummary> &pages) {
+  SqliteTransaction transaction(this->database);
+  try {
+    SqlitePreparedStatement command(
+        this->database,
+        "INSERT INTO dat_pages_t(page, physical_offset, usage_count, checksum, "
+        "first_id, last_id) VALUES(@page, @physical_offset, @usage_count, "
+        "@checksum, @first_id, @last_id)");
+
+    // data_t started out empty, so each stored record took the next id
+    size_t record = 0;
+    uint64_t nextId = 1;
+    for (const auto &page : pages) {
+      // the conversion stopped before this page
+      if (record + page.records > convertedRecords.size()) {
+        break;
+      }
+
+      const uint64_t firstId = nextId;
+      for (unsigned int i = 0; i < page.records; ++i) {
+        if (convertedRecords[record++]) {
+          ++nextId;
+        }
+      }
+
+      command.reset();
+      command.bindParameter(1, BindableValue(page.logicalPage));
+      command.bindParameter(2, BindableValue(page.physicalOffset));
+      command.bindParameter(
+          3, BindableValue(static_cast<uint32_t>(page.usageCount)));
+      command.bindParameter(4,
+                            BindableValue(static_cast<int64_t>(page.checksum)));
+      command.bindParameter(5, BindableValue(firstId));
+      command.bindParameter(6, BindableValue(nextId - 1));
+      command.execute();
+    }
+
+    transaction.commit();
+  } catch (const BtrieveException &ex) {
+    transaction.rollback();
+    throw ex;
+  }
+
+  convertedRecords.clear();
+  convertedRecords.shrink_to_fit();
+  convertedPagesSaved = true;
+}
+
+bool SqliteDatabase::update(const BtrieveDatabase &database) {
+  if (!convertedPagesSaved ||
+      database.getRecordLength() != recordLength ||
+      database.isVariableLengthRecords() != variableLengthRecords ||
+      database.getKeys().size() != keys.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (database.getKeys()[i].getSegments() != keys[i].getSegments()) {
+      return false;
+    }
+  }
+
+  struct ConvertedPage {
+    uint64_t physicalOffset;
+    uint16_t usageCount;
+    uint64_t checksum;
+    uint64_t firstId;
+    uint64_t lastId;
+
+    // Returns how many of the page's records were stored, under the ids
+    // firstId to lastId.
+    unsigned int getRecordsStored() const {
+      return lastId >= firstId ? static_cast<unsigned int>(lastId - firstId + 1)
+                               : 0;
+    }
+  };
+  std::unordered_map<unsigned int, ConvertedPage> convertedPages;
+  {
+    SqlitePreparedStatement command(
+        this->database,
+        "SELECT page, physical_offset, usage_count, checksum, first_id, "
+        "last_id FROM dat_pages_t");
+    auto reader = command.executeReader();
+    while (reader->read()) {
+      convertedPages[static_cast<unsigned int>(reader->getInt64(0))] = {
+          static_cast<uint64_t>(reader->getInt64(1)),
+          static_cast<uint16_t>(reader->getInt32(2)),
+          static_cast<uint64_t>(reader->getInt64(3)),
+          static_cast<uint64_t>(reader->getInt64(4)),
+          static_cast<uint64_t>(reader->getInt64(5))};
+    }
+  }
+
+  // v6 files are written through shadow pages, which moves a data page
+  // every time it's written and bumps its usage count. A page at the same
+  // offset with the same usage count as when it was converted hasn't been
+  // written since, and is kept without being read. The usage count alone
+  // isn't enough, since it wraps around every 32768 writes, and a replaced
+  // file's pages may well start out at the same counts. That doesn't hold
+  // for the records' variable length parts, which live on pages of their
+  // own.
+  std::function<std::optional<unsigned int>(unsigned int, uint64_t, uint16_t)>
+      skipPage;
+  if (database.isV6() && !database.isVariableLengthRecords()) {
+    skipPage = [&convertedPages](unsigned int logicalPage,
+                                 uint64_t physicalOffset, uint16_t usageCount)
+        -> std::optional<unsigned int> {
+      auto iter = convertedPages.find(logicalPage);
+      if (iter == convertedPages.end() ||
+          iter->second.physicalOffset != physicalOffset ||
+          iter->second.usageCount != usageCount) {
+        return std::nullopt;
+      }
+
+      // unchanged, so it's kept out of the pages removed below
+      const unsigned int recordsStored = iter->second.getRecordsStored();
+      convertedPages.erase(iter);
+      return recordsStored;
+    };
+  }
+
+  // the records of every page that changed or is new, stored back to back
+  struct ChangedPage {
+    unsigned int logicalPage;
+    uint64_t physicalOffset;
+    uint16_t usageCount;
+    uint64_t checksum;
+    std::vector<uint8_t> data;
+    std::vector<size_t> lengths;
+  };
+  std::vector<ChangedPage> changedPages;
+  // the pages whose records are unchanged even though they were written
+  struct RewrittenPage {
+    unsigned int logicalPage;
+    uint64_t physicalOffset;
+    uint16_t usageCount;
+  };
+  std::vector<RewrittenPage> rewrittenPages;
+  database.readPages(
+      [&](unsigned int logicalPage, uint64_t physicalOffset,
+          uint16_t usageCount,
+          std::span<const std::basic_string_view<uint8_t>> records,
+          std::span<BtrieveDatabase::LoadRecordResult> results) {
+        const uint64_t checksum = BtrieveDatabase::getPageChecksum(records);
+        auto iter = convertedPages.find(logicalPage);
+        if (iter != convertedPages.end() && iter->second.checksum == checksum) {
+          // unchanged, so it's kept out of the pages removed below, and only
+          // its offset and usage count are brought up to date
+          std::fill_n(results.begin(),
+                      std::min<size_t>(iter->second.getRecordsStored(),
+                                       results.size()),
+                      BtrieveDatabase::LoadRecordResult::COUNT);
+          if (iter->second.physicalOffset != physicalOffset ||
+              iter->second.usageCount != usageCount) {
+            rewrittenPages.push_back({logicalPage, physicalOffset, usageCount});
+          }
+          convertedPages.erase(iter);
+          return;
+        }
+
+        // every record is expected to be stored, which is checked once
+        // they're inserted
+        std::fill(results.begin(), results.end(),
+                  BtrieveDatabase::LoadRecordResult::COUNT);
+        ChangedPage page = {logicalPage, physicalOffset, usageCount, checksum,
+                            std::vector<uint8_t>(), std::vector<size_t>()};
+        for (const auto &record : records) {
+          page.data.insert(page.data.end(), record.begin(), record.end());
+          page.lengths.push_back(record.size());
+        }
+        changedPages.push_back(std::move(page));
+      },
+      skipPage);
+
+  SqliteTransaction transaction(this->database);
+  try {
+    // what's left are the pages that changed or are gone. Their records are
+    // all removed before any are added back, since a record may have moved
+    // between them.
+    for (const auto &[logicalPage, convertedPage] : convertedPages) {
+      SqlitePreparedStatement &deleteRecords = getPreparedStatement(
+          "DELETE FROM data_t WHERE id BETWEEN @first_id AND @last_id");
+      deleteRecords.reset();
+      deleteRecords.bindParameter(1, BindableValue(convertedPage.firstId));
+      deleteRecords.bindParameter(2, BindableValue(convertedPage.lastId));
+      deleteRecords.execute();
+
+      SqlitePreparedStatement &deletePage =
+          getPreparedStatement("DELETE FROM dat_pages_t WHERE page = @page");
+      deletePage.reset();
+      deletePage.bindParameter(1, BindableValue(logicalPage));
+      deletePage.execute();
+    }
+
+    SqlitePreparedStatement insertRecord(this->database,
+                                         getInsertionSql(keys, /* rows= */ 1));
+    SqlitePreparedStatement insertPage(
+        this->database,
+        "INSERT INTO dat_pages_t(page, physical_offset, usage_count, checksum, "
+        "first_id, last_id) VALUES(@page, @physical_offset, @usage_count, "
+        "@checksum, @first_id, @last_id)");
+    for (const auto &page : changedPages) {
+      // inserted records take the next ids in a row, so the page's ids stay
+      // one range
+      uint64_t firstId = 0;
+      uint64_t lastId = 0;
+      const uint8_t *data = page.data.data();
+      for (size_t length : page.lengths) {
+        insertRecord.reset();
+        unsigned int parameterNumber = 1;
+        bindRecord(insertRecord, parameterNumber, keys,
+                   std::basic_string_view<uint8_t>(data, length));
+        data += length;
+
+        if (!insertRecord.executeNoThrow()) {
+          // The page was read as if all of its records would be stored, so
+          // the DAT may end past where it was read up to. A full conversion
+          // sorts that out, skipping the record.
+          transaction.rollback();
+          return false;
+        }
+        lastId = static_cast<uint64_t>(
+            sqlite3_last_insert_rowid(this->database.get()));
+        if (firstId == 0) {
+          firstId = lastId;
+        }
+      }
+
+      insertPage.reset();
+      insertPage.bindParameter(1, BindableValue(page.logicalPage));
+      insertPage.bindParameter(2, BindableValue(page.physicalOffset));
+      insertPage.bindParameter(
+          3, BindableValue(static_cast<uint32_t>(page.usageCount)));
+      insertPage.bindParameter(
+          4, BindableValue(static_cast<int64_t>(page.checksum)));
+      insertPage.bindParameter(5, BindableValue(firstId == 0 ? 1 : firstId));
+      insertPage.bindParameter(6, BindableValue(lastId));
+      insertPage.execute();
+    }
+
+    SqlitePreparedStatement updatePage(
+        this->database,
+        "UPDATE dat_pages_t SET physical_offset = @physical_offset, "
+        "usage_count = @usage_count WHERE page = @page");
+    for (const auto &page : rewrittenPages) {
+      updatePage.reset();
+      updatePage.bindParameter(1, BindableValue(page.physicalOffset));
+      updatePage.bindParameter(
+          2, BindableValue(static_cast<uint32_t>(page.usageCount)));
+      updatePage.bindParameter(3, BindableValue(page.logicalPage));
+      updatePage.execute();
+    }
+
+    sourceFingerprint = database.getFingerprint();
+    SqlitePreparedStatement updateFingerprint(
+        this->database, "UPDATE metadata_t SET dat_fingerprint = @fingerprint");
+    updateFingerprint.bindParameter(1,
+                                    BindableValue(sourceFingerprint.c_str()));
+    updateFingerprint.execute();
+
+    transaction.commit();
+  } catch (const BtrieveException &ex) {
+    transaction.rollback();
+    throw ex;
+  }
+
+  cache.clear();
+  return true;
+}
+
+void SqliteDatabase::forgetConvertedPages() {
+  if (!convertedPagesSaved) {
+    return;
+  }
+
+  // the records no longer match the pages they were converted from. If this
+  // fails, so does the change that follows.
+  if (sqlite3_exec(database.get(), "DELETE FROM dat_pages_t", nullptr, nullptr,
+                   nullptr) == SQLITE_OK) {
+    convertedPagesSaved = false;
+  }
+}
+
+void SqliteDatabase::executeSql(const char *sql) {
+  int errorCode =
+      sqlite3_exec(database.get(), sql, nullptr, nullptr, nullptr);
+  if (errorCode != SQLITE_OK) {
+    throwException(errorCode);
+  }
+}
+
 void SqliteDatabase::createSqliteMetadataTable(
     const BtrieveDatabase &database) {
   const char *const createTableStatement =
       "CREATE TABLE metadata_t(record_length INTEGER NOT NULL, "
       "physical_record_length INTEGER NOT NULL, page_length INTEGER NOT NULL, "
-      "variable_length_records INTEGER NOT NULL, version INTEGER NOT NULL)";
+      "variable_length_records INTEGER NOT NULL, version INTEGER NOT NULL, "
+      "dat_fingerprint TEXT)";
 
   SqlitePreparedStatement createTableCommand(this->database,
                                              createTableStatement);
@@ -338,9 +1029,9 @@ void SqliteDatabase::createSqliteMetadataTable(
 
   const char *const insertIntoTableStatement =
       "INSERT INTO metadata_t(record_length, physical_record_length, "
-      "page_length, variable_length_records, version) "
+      "page_length, variable_length_records, version, dat_fingerprint) "
       "VALUES(@record_length, @physical_record_length, @page_length, "
-      "@variable_length_records, @version)";
+      "@variable_length_records, @version, @dat_fingerprint)";
 
   SqlitePreparedStatement command(this->database, insertIntoTableStatement);
   command.bindParameter(1, BindableValue(database.getRecordLength()));
@@ -348,6 +1039,11 @@ void SqliteDatabase::createSqliteMetadataTable(
   command.bindParameter(3, BindableValue(database.getPageLength()));
   command.bindParameter(4, BindableValue(database.isVariableLengthRecords()));
   command.bindParameter(5, BindableValue(CURRENT_VERSION));
+  // databases created from scratch have no DAT file to fingerprint
+  sourceFingerprint = database.getFingerprint();
+  command.bindParameter(6, sourceFingerprint.empty()
+                               ? BindableValue()
+                               : BindableValue(sourceFingerprint.c_str()));
 
   command.execute();
 }
@@ -406,6 +1102,15 @@ void SqliteDatabase::createSqliteKeysTable(const BtrieveDatabase &database) {
   }
 }
 
+void SqliteDatabase::createSqliteDatPagesTable() {
+  SqlitePreparedStatement command(
+      this->database,
+      "CREATE TABLE dat_pages_t(page INTEGER PRIMARY KEY, physical_offset "
+      "INTEGER NOT NULL, usage_count INTEGER NOT NULL, checksum INTEGER NOT "
+      "NULL, first_id INTEGER NOT NULL, last_id INTEGER NOT NULL)");
+  command.execute();
+}
+
 void SqliteDatabase::createSqliteDataTable(const BtrieveDatabase &database) {
   std::stringstream sb;
   sb << "CREATE TABLE data_t(id INTEGER PRIMARY KEY, data BLOB NOT NULL";
@@ -420,9 +1125,13 @@ void SqliteDatabase::createSqliteDataTable(const BtrieveDatabase &database) {
   createTableStatement.execute();
 }
 
-void SqliteDatabase::createSqliteDataIndices(const BtrieveDatabase &database) {
-  for (auto &key : database.getKeys()) {
-    const char *possiblyUnique = key.isUnique() ? "UNIQUE" : "";
+void SqliteDatabase::createSqliteDataIndices(bool unique) {
+  for (auto &key : keys) {
+    if (key.isUnique() != unique) {
+      continue;
+    }
+
+    const char *possiblyUnique = unique ? "UNIQUE" : "";
     auto sqliteKeyName = key.getSqliteKeyName();
     SqlitePreparedStatement command(
         this->database, "CREATE %s INDEX %s_index on data_t(%s)",
@@ -431,9 +1140,9 @@ void SqliteDatabase::createSqliteDataIndices(const BtrieveDatabase &database) {
   }
 }
 
-void SqliteDatabase::createSqliteTriggers(const BtrieveDatabase &database) {
+void SqliteDatabase::createSqliteTriggers() {
   std::vector<Key> nonModifiableKeys;
-  std::copy_if(database.getKeys().begin(), database.getKeys().end(),
+  std::copy_if(keys.begin(), keys.end(),
                std::back_inserter(nonModifiableKeys),
                [](const Key &key) { return !key.isModifiable(); });
 
@@ -462,10 +1171,14 @@ void SqliteDatabase::createSqliteTriggers(const BtrieveDatabase &database) {
 // Closes an opened database.
 void SqliteDatabase::close() {
   preparedStatements.clear();
+  keyStatements.clear();
   database.reset();
 
   keys.clear();
   cache.clear();
+  sourceFingerprint.clear();
+  convertedRecords.clear();
+  convertedPagesSaved = false;
 }
 
 SqlitePreparedStatement &SqliteDatabase::getPreparedStatement(
@@ -489,7 +1202,7 @@ BtrieveError SqliteDatabase::stepFirst() {
     return BtrieveError::EndOfFile;
   }
 
-  position = reader->getInt32(0);
+  position = reader->getInt64(0);
   cacheBtrieveRecord(position, *reader, 1);
   return BtrieveError::Success;
 }
@@ -502,7 +1215,7 @@ BtrieveError SqliteDatabase::stepLast() {
     return BtrieveError::EndOfFile;
   }
 
-  position = reader->getInt32(0);
+  position = reader->getInt64(0);
   cacheBtrieveRecord(position, *reader, 1);
   return BtrieveError::Success;
 }
@@ -518,7 +1231,7 @@ BtrieveError SqliteDatabase::stepNext() {
     return BtrieveError::EndOfFile;
   }
 
-  position = reader->getInt32(0);
+  position = reader->getInt64(0);
   cacheBtrieveRecord(position, *reader, 1);
   return BtrieveError::Success;
 }
@@ -535,19 +1248,19 @@ BtrieveError SqliteDatabase::stepPrevious() {
     return BtrieveError::EndOfFile;
   }
 
-  position = reader->getInt32(0);
+  position = reader->getInt64(0);
   cacheBtrieveRecord(position, *reader, 1);
   return BtrieveError::Success;
 }
 
-const Record &SqliteDatabase::cacheBtrieveRecord(unsigned int position,
+const Record &SqliteDatabase::cacheBtrieveRecord(uint64_t position,
                                                  const SqliteReader &reader,
                                                  unsigned int columnOrdinal) {
   const Record &record = readRecord(position, reader, columnOrdinal);
   return cache.cache(position, record);
 }
 
-std::pair<bool, Record> SqliteDatabase::selectRecord(unsigned int position) {
+std::pair<bool, Record> SqliteDatabase::selectRecord(uint64_t position) {
   this->position = position;
 
   SqlitePreparedStatement &command =
@@ -574,6 +1287,7 @@ unsigned int SqliteDatabase::getRecordCount() const {
 }
 
 BtrieveError SqliteDatabase::deleteAll() {
+  forgetConvertedPages();
   bool ret = getPreparedStatement("DELETE FROM data_t").executeNoThrow();
 
   if (ret) {
@@ -585,6 +1299,7 @@ BtrieveError SqliteDatabase::deleteAll() {
 }
 
 BtrieveError SqliteDatabase::deleteRecord() {
+  forgetConvertedPages();
   cache.remove(position);
 
   SqlitePreparedStatement &command =
@@ -624,8 +1339,10 @@ class SqliteErrorConverter {
   BtrieveError error;
 };
 
-std::pair<BtrieveError, unsigned int> SqliteDatabase::insertRecord(
+std::pair<BtrieveError, uint64_t> SqliteDatabase::insertRecord(
     std::basic_string_view<uint8_t> record) {
+  forgetConvertedPages();
+
   BtrieveError error;
   std::vector<uint8_t> data(record.size());
   memcpy(data.data(), record.data(), record.size());
@@ -686,8 +1403,8 @@ std::pair<BtrieveError, unsigned int> SqliteDatabase::insertRecord(
 
   int numRowsAffected = sqlite3_changes(database.get());
   error = BtrieveError::Success;
-  unsigned int lastInsertRowId =
-      static_cast<unsigned int>(sqlite3_last_insert_rowid(database.get()));
+  uint64_t lastInsertRowId =
+      static_cast<uint64_t>(sqlite3_last_insert_rowid(database.get()));
 
   try {
     transaction.commit();
@@ -775,7 +1492,9 @@ BtrieveError SqliteDatabase::insertAutoincrementValues(
 }
 
 BtrieveError SqliteDatabase::updateRecord(
-    unsigned int id, std::basic_string_view<uint8_t> record) {
+    uint64_t id, std::basic_string_view<uint8_t> record) {
+  forgetConvertedPages();
+
   std::vector<uint8_t> data(record.size());
   memcpy(data.data(), record.data(), record.size());
   BtrieveError error;
@@ -851,11 +1570,51 @@ BtrieveError SqliteDatabase::updateRecord(
 }
 
 std::unique_ptr<Query> SqliteDatabase::newQuery(
-    unsigned int position, const Key *key,
+    uint64_t position, const Key *key,
     std::basic_string_view<uint8_t> keyData) {
   return std::unique_ptr<Query>(new SqliteQuery(this, position, key, keyData));
 }
 
+void SqliteQuery::changeDirection(CursorDirection newDirection) {
+  if (!lastKey) {
+    return;
+  }
+
+  KeyStatement statement;
+  switch (newDirection) {
+    case CursorDirection::Forward:
+      statement = KeyStatement::GreaterOrEqual;
+      break;
+    case CursorDirection::Reverse:
+      statement = KeyStatement::LessOrEqual;
+      break;
+    default:
+      // could log an error here
+      return;
+  }
+
+  SqlitePreparedStatement *command = database->getKeyStatement(*key, statement);
+  if (command == nullptr) {
+    return;
+  }
+
+  BindableValue *value = lastKey.get();
+  command->bindParameter(1, *value);
+  setReader(command->executeReader());
+
+  this->cursorDirection = newDirection;
+
+  // due to duplicate keys, we need to seek past the current position since we
+  // might serve data already served.
+  //
+  // For example, if you have 4 identical keys with id 1,2,3,4 and are
+  // currently at id 2 and seek previous expecting id 1, sqlite might return a
+  // cursor counting from 4,3,2,1 and the cursor would point to 4, returning
+  // the wrong result. This next call skips 4,3,2 until the cursor is at the
+  // proper point.
+  seekTo(position);
+}
+
 BtrieveError SqliteDatabase::nextReader(Query *query,
                                         CursorDirection cursorDirection) {
   auto record = query->next(cursorDirection);
@@ -872,26 +1631,21 @@ BtrieveError SqliteDatabase::nextReader(Query *query,
 }
 
 BtrieveError SqliteDatabase::getByKeyEqual(Query *query) {
-  std::stringstream sql;
-
   auto sqliteObject =
       query->getKey()->keyDataToSqliteObject(query->getKeyData());
 
-  sql << "SELECT id, " << query->getKey()->getSqliteKeyName()
-      << ", data FROM data_t WHERE " << query->getKey()->getSqliteKeyName();
-  if (sqliteObject.isNull()) {
-    sql << " IS NULL";
-  } else {
-    sql << " = @value ORDER BY " << query->getKey()->getSqliteKeyName()
-        << " ASC";
+  SqlitePreparedStatement *command = getKeyStatement(
+      *query->getKey(),
+      sqliteObject.isNull() ? KeyStatement::IsNull : KeyStatement::Equal);
+  if (command == nullptr) {
+    return BtrieveError::InvalidKeyNumber;
   }
 
-  SqlitePreparedStatement &command = getPreparedStatement(sql.str().c_str());
   if (!sqliteObject.isNull()) {
-    command.bindParameter(1, sqliteObject);
+    command->bindParameter(1, sqliteObject);
   }
 
-  static_cast<SqliteQuery *>(query)->setReader(command.executeReader());
+  static_cast<SqliteQuery *>(query)->setReader(command->executeReader());
   query->setCursorDirection(CursorDirection::Seek);
   return nextReader(query, CursorDirection::Seek);
 }
@@ -905,27 +1659,25 @@ BtrieveError SqliteDatabase::getByKeyPrevious(Query *query) {
 }
 
 BtrieveError SqliteDatabase::getByKeyFirst(Query *query) {
-  std::stringstream sql;
-
-  sql << "SELECT id, " << query->getKey()->getSqliteKeyName()
-      << ", data FROM data_t ORDER BY " << query->getKey()->getSqliteKeyName()
-      << " ASC";
-  SqlitePreparedStatement &command = getPreparedStatement(sql.str().c_str());
+  SqlitePreparedStatement *command =
+      getKeyStatement(*query->getKey(), KeyStatement::First);
+  if (command == nullptr) {
+    return BtrieveError::InvalidKeyNumber;
+  }
 
-  static_cast<SqliteQuery *>(query)->setReader(command.executeReader());
+  static_cast<SqliteQuery *>(query)->setReader(command->executeReader());
   query->setCursorDirection(CursorDirection::Forward);
   return nextReader(query, CursorDirection::Forward);
 }
 
 BtrieveError SqliteDatabase::getByKeyLast(Query *query) {
-  std::stringstream sql;
-
-  sql << "SELECT id, " << query->getKey()->getSqliteKeyName()
-      << ", data FROM data_t ORDER BY " << query->getKey()->getSqliteKeyName()
-      << " DESC";
-  SqlitePreparedStatement &command = getPreparedStatement(sql.str().c_str());
+  SqlitePreparedStatement *command =
+      getKeyStatement(*query->getKey(), KeyStatement::Last);
+  if (command == nullptr) {
+    return BtrieveError::InvalidKeyNumber;
+  }
 
-  static_cast<SqliteQuery *>(query)->setReader(command.executeReader());
+  static_cast<SqliteQuery *>(query)->setReader(command->executeReader());
   query->setCursorDirection(CursorDirection::Reverse);
   return nextReader(query, CursorDirection::Reverse);
 }
@@ -937,14 +1689,7 @@ static bool shouldConvertSqliteObjectToEmptyStringForComparison(
 }
 
 BtrieveError SqliteDatabase::getByKeyGreater(Query *query,
-                                             const char *opurator) {
-  std::stringstream sql;
-
-  sql << "SELECT id, " << query->getKey()->getSqliteKeyName()
-      << ", data FROM data_t WHERE " << query->getKey()->getSqliteKeyName()
-      << " " << opurator << " @value ORDER BY "
-      << query->getKey()->getSqliteKeyName() << " ASC";
-
+                                          KeyStatement statement) {
   auto sqliteObject =
       query->getKey()->keyDataToSqliteObject(query->getKeyData());
 
@@ -953,22 +1698,21 @@ BtrieveError SqliteDatabase::getByKeyGreater(Query *query,
     sqliteObject = BindableValue("");
   }
 
-  SqlitePreparedStatement &command = getPreparedStatement(sql.str().c_str());
-  command.bindParameter(1, sqliteObject);
+  SqlitePreparedStatement *command =
+      getKeyStatement(*query->getKey(), statement);
+  if (command == nullptr) {
+    return BtrieveError::InvalidKeyNumber;
+  }
+
+  command->bindParameter(1, sqliteObject);
 
-  static_cast<SqliteQuery *>(query)->setReader(command.executeReader());
+  static_cast<SqliteQuery *>(query)->setReader(command->executeReader());
   query->setCursorDirection(CursorDirection::Forward);
   return nextReader(query, CursorDirection::Forward);
 }
 
-BtrieveError SqliteDatabase::getByKeyLess(Query *query, const char *opurator) {
-  std::stringstream sql;
-
-  sql << "SELECT id, " << query->getKey()->getSqliteKeyName()
-      << ", data FROM data_t WHERE " << query->getKey()->getSqliteKeyName()
-      << " " << opurator << " @value ORDER BY "
-      << query->getKey()->getSqliteKeyName() << " DESC";
-
+BtrieveError SqliteDatabase::getByKeyLess(Query *query,
+                                          KeyStatement statement) {
   auto sqliteObject =
       query->getKey()->keyDataToSqliteObject(query->getKeyData());
 
@@ -977,16 +1721,21 @@ BtrieveError SqliteDatabase::getByKeyLess(Query *query, const char *opurator) {
     sqliteObject = BindableValue("");
   }
 
-  SqlitePreparedStatement &command = getPreparedStatement(sql.str().c_str());
-  command.bindParameter(1, sqliteObject);
+  SqlitePreparedStatement *command =
+      getKeyStatement(*query->getKey(), statement);
+  if (command == nullptr) {
+    return BtrieveError::InvalidKeyNumber;
+  }
+
+  command->bindParameter(1, sqliteObject);
 
-  static_cast<SqliteQuery *>(query)->setReader(command.executeReader());
+  static_cast<SqliteQuery *>(query)->setReader(command->executeReader());
   query->setCursorDirection(CursorDirection::Reverse);
   return nextReader(query, CursorDirection::Reverse);
 }
 
 std::unique_ptr<Query> SqliteDatabase::logicalCurrencySeek(
-    int keyNumber, unsigned int position, BtrieveError &error) {
+    int keyNumber, uint64_t position, BtrieveError &error) {
   if (static_cast<unsigned int>(keyNumber) >= keys.size()) {
     error = BtrieveError::InvalidKeyNumber;
     return nullptr;
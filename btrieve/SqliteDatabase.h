@@ -1,7 +1,11 @@
 #ifndef __SQLITE_DATABASE_H_
 #define __SQLITE_DATABASE_H_
 
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "OperationCode.h"
 #include "Record.h"
@@ -17,6 +21,8 @@ class SqliteDatabase : public SqlDatabase {
   SqliteDatabase(unsigned int openFlags_ = 0)
       : SqlDatabase(/* maxCacheSize= */ 64),
         openFlags(openFlags_),
+        inMemoryConversionLimit(0),
+        convertedPagesSaved(false),
         database(nullptr, &sqlite3_close) {}
 
   virtual ~SqliteDatabase() { close(); }
@@ -29,8 +35,21 @@ class SqliteDatabase : public SqlDatabase {
   virtual std::unique_ptr<RecordLoader> create(
       const wchar_t *fileName, const BtrieveDatabase &database) override;
 
+  virtual void saveConvertedPages(
+      const std::vector<BtrieveDatabase::PageSummary> &pages) override;
+
+  virtual bool update(const BtrieveDatabase &database) override;
+
   virtual void close() override;
 
+  // Sets the largest DAT file, in bytes, that create builds in memory before
+  // copying it to its file in one sequential pass. Larger files are loaded in
+  // place, so they don't have to fit in memory. 0, the default, always loads
+  // in place, whose page cache already defers most writes to the commit.
+  void setInMemoryConversionLimit(uint64_t bytes) {
+    inMemoryConversionLimit = bytes;
+  }
+
   virtual BtrieveError stepFirst() override;
   virtual BtrieveError stepLast() override;
   virtual BtrieveError stepNext() override;
@@ -41,62 +60,90 @@ class SqliteDatabase : public SqlDatabase {
 
   virtual BtrieveError deleteAll() override;
 
-  virtual std::pair<BtrieveError, unsigned int> insertRecord(
+  virtual std::pair<BtrieveError, uint64_t> insertRecord(
       std::basic_string_view<uint8_t> record) override;
 
   virtual BtrieveError updateRecord(
-      unsigned int offset, std::basic_string_view<uint8_t> record) override;
+      uint64_t offset, std::basic_string_view<uint8_t> record) override;
 
   virtual BtrieveError getByKeyFirst(Query *query) override;
   virtual BtrieveError getByKeyLast(Query *query) override;
   virtual BtrieveError getByKeyEqual(Query *query) override;
 
   virtual std::unique_ptr<Query> logicalCurrencySeek(
-      int keyNumber, unsigned int position, BtrieveError &error) override;
+      int keyNumber, uint64_t position, BtrieveError &error) override;
 
  protected:
-  virtual std::pair<bool, Record> selectRecord(unsigned int position) override;
+  virtual std::pair<bool, Record> selectRecord(uint64_t position) override;
 
  private:
   SqlitePreparedStatement &getPreparedStatement(const char *sql) const;
 
-  Record readRecord(unsigned int position, const SqliteReader &reader,
+  // Returns key's prepared statement, reset and ready to bind and execute, or
+  // nullptr if key isn't one of this database's keys.
+  SqlitePreparedStatement *getKeyStatement(const Key &key,
+                                           KeyStatement statement) {
+    const size_t statementsPerKey = static_cast<size_t>(KeyStatement::Count);
+    if (key.getNumber() >= keyStatements.size() / statementsPerKey) {
+      return nullptr;
+    }
+
+    SqlitePreparedStatement &command =
+        keyStatements[key.getNumber() * statementsPerKey +
+                      static_cast<size_t>(statement)];
+    command.reset();
+    return &command;
+  }
+
+  // Prepares the statements of every key on the current connection.
+  void prepareKeyStatements();
+
+  Record readRecord(uint64_t position, const SqliteReader &reader,
                     unsigned int columnOrdinal) {
     return Record(position, reader.getBlob(columnOrdinal));
   }
 
-  const Record &cacheBtrieveRecord(unsigned int position,
+  const Record &cacheBtrieveRecord(uint64_t position,
                                    const SqliteReader &reader,
                                    unsigned int columnOrdinal);
 
+  // Executes one or more sql statements, discarding any results.
+  void executeSql(const char *sql);
+
+  // Copies the loaded in-memory database to the new file fileName, then
+  // switches over to it.
+  void persist(const std::string &fileName);
+
   void createSqliteMetadataTable(const BtrieveDatabase &database);
   void createSqliteKeysTable(const BtrieveDatabase &database);
   void createSqliteDataTable(const BtrieveDatabase &database);
-  void createSqliteDataIndices(const BtrieveDatabase &database);
-  void createSqliteTriggers(const BtrieveDatabase &database);
+  void createSqliteDatPagesTable();
+  // Creates the data_t index of every key whose uniqueness matches unique.
+  void createSqliteDataIndices(bool unique);
+  void createSqliteTriggers();
 
   void loadSqliteMetadata(const wchar_t *filename, unsigned int openFlags);
   void loadSqliteKeys();
 
-  BtrieveError getByKeyGreater(Query *query, const char *opurator);
+  BtrieveError getByKeyGreater(Query *query, KeyStatement statement);
   virtual BtrieveError getByKeyGreater(Query *query) override {
-    return getByKeyGreater(query, ">");
+    return getByKeyGreater(query, KeyStatement::Greater);
   };
   virtual BtrieveError getByKeyGreaterOrEqual(Query *query) override {
-    return getByKeyGreater(query, ">=");
+    return getByKeyGreater(query, KeyStatement::GreaterOrEqual);
   }
-  BtrieveError getByKeyLess(Query *query, const char *opurator);
+  BtrieveError getByKeyLess(Query *query, KeyStatement statement);
   virtual BtrieveError getByKeyLess(Query *query) override {
-    return getByKeyLess(query, "<");
+    return getByKeyLess(query, KeyStatement::Less);
   };
   virtual BtrieveError getByKeyLessOrEqual(Query *query) override {
-    return getByKeyLess(query, "<=");
+    return getByKeyLess(query, KeyStatement::LessOrEqual);
   }
   virtual BtrieveError getByKeyNext(Query *query) override;
   virtual BtrieveError getByKeyPrevious(Query *query) override;
 
   virtual std::unique_ptr<Query> newQuery(
-      unsigned int position, const Key *key,
+      uint64_t position, const Key *key,
       std::basic_string_view<uint8_t> keyData) override;
 
   BtrieveError insertAutoincrementValues(std::vector<uint8_t> &record);
@@ -109,11 +156,30 @@ class SqliteDatabase : public SqlDatabase {
 
   void upgradeDatabaseFrom2To3();
 
+  void upgradeDatabaseFrom3To4();
+
+  void upgradeDatabaseFrom4To5();
+
+  void upgradeDatabaseFrom5To6();
+
+  // Drops the saved pages before the records are first changed, since they
+  // no longer match the DAT file afterwards.
+  void forgetConvertedPages();
+
   unsigned int openFlags;
+  uint64_t inMemoryConversionLimit;
+  // whether each record handed to create's RecordLoader was stored, until
+  // saveConvertedPages matches them up with their pages
+  std::vector<bool> convertedRecords;
+  // whether dat_pages_t holds the pages the records were converted from
+  bool convertedPagesSaved;
   mutable std::unordered_map<std::string, SqlitePreparedStatement>
       preparedStatements;
+  // KeyStatement::Count statements per key, in key number order
+  std::vector<SqlitePreparedStatement> keyStatements;
   std::shared_ptr<sqlite3> database;
 
+  friend class SqliteCreationRecordLoader;
   friend class SqliteQuery;
 };
 
@@ -2,6 +2,8 @@
 #define __SQLITE_PREPARED_STATEMENT_H_
 
 #include <memory>
+#include <string>
+#include <string_view>
 
 #include "SqliteReader.h"
 #include "SqliteUtil.h"
@@ -12,6 +14,20 @@
 #endif
 
 namespace btrieve {
+// The statements every keyed read runs, which SqliteDatabase prepares for each
+// key up front so reads don't have to build and look up their sql.
+enum class KeyStatement {
+  Equal,
+  IsNull,
+  First,
+  Last,
+  Greater,
+  GreaterOrEqual,
+  Less,
+  LessOrEqual,
+  Count
+};
+
 class SqlitePreparedStatement {
  public:
   SqlitePreparedStatement(std::shared_ptr<sqlite3> database_,
@@ -39,6 +55,22 @@ class SqlitePreparedStatement {
     this->statement.reset(statement);
   }
 
+  // Prepares sql as is, for statements too long to be formatted.
+  SqlitePreparedStatement(std::shared_ptr<sqlite3> database_,
+                          const std::string &sql)
+      : database(database_), statement(nullptr, &sqlite3_finalize) {
+    sqlite3_stmt *statement;
+
+    int errorCode = sqlite3_prepare_v2(database.get(), sql.c_str(),
+                                       static_cast<int>(sql.length()),
+                                       &statement, nullptr);
+    if (errorCode != SQLITE_OK) {
+      throwException(errorCode);
+    }
+
+    this->statement.reset(statement);
+  }
+
   void reset() { sqlite3_reset(statement.get()); }
 
   void bindParameter(unsigned int parameter, const BindableValue &value) {
@@ -87,6 +119,35 @@ class SqlitePreparedStatement {
     }
   }
 
+  // Binds blob without copying it, so it has to stay valid until the
+  // statement's bindings are cleared or replaced.
+  void bindStaticBlob(unsigned int parameter,
+                      std::basic_string_view<uint8_t> blob) {
+    // a nullptr would bind NULL rather than an empty blob
+    static const uint8_t EMPTY = 0;
+    int errorCode = sqlite3_bind_blob(
+        statement.get(), parameter, blob.empty() ? &EMPTY : blob.data(),
+        static_cast<int>(blob.size()), SQLITE_STATIC);
+    if (errorCode != SQLITE_OK) {
+      throwException(errorCode);
+    }
+  }
+
+  // Binds text without copying it, like bindStaticBlob.
+  void bindStaticText(unsigned int parameter,
+                      std::basic_string_view<uint8_t> text) {
+    int errorCode = sqlite3_bind_text(
+        statement.get(), parameter,
+        text.empty() ? "" : reinterpret_cast<const char *>(text.data()),
+        static_cast<int>(text.size()), SQLITE_STATIC);
+    if (errorCode != SQLITE_OK) {
+      throwException(errorCode);
+    }
+  }
+
+  // Sets every parameter back to NULL, releasing what was bound to them.
+  void clearBindings() { sqlite3_clear_bindings(statement.get()); }
+
   bool executeNoThrow() {
     int errorCode = sqlite3_step(statement.get());
     // SQLITE_DONE is expected, meaning the statement has finished
@@ -198,3 +198,54 @@ void TempPath::deleteAllFiles(const char *filePath) {
 #endif
   }
 }
+
+CollectingRecordLoader::~CollectingRecordLoader() {
+  if (onDestroyed) {
+    onDestroyed(*this);
+  }
+}
+
+btrieve::BtrieveDatabase::LoadRecordResult
+CollectingRecordLoader::onRecordLoaded(std::basic_string_view<uint8_t> record) {
+  loading = true;
+  ++calls;
+  loaderThread = std::this_thread::get_id();
+  if (records.size() == throwAt) {
+    loading = false;
+    throw btrieve::BtrieveException(btrieve::BtrieveError::IOError,
+                                    "write failed");
+  }
+  if (records.size() == cancelAt) {
+    loading = false;
+    return btrieve::BtrieveDatabase::LoadRecordResult::CANCEL_ENUMERATION;
+  }
+
+  records.emplace_back(record.begin(), record.end());
+  loading = false;
+  return skipEveryOther && records.size() % 2 == 0
+             ? btrieve::BtrieveDatabase::LoadRecordResult::SKIP_COUNT
+             : btrieve::BtrieveDatabase::LoadRecordResult::COUNT;
+}
+
+void CollectingRecordLoader::onRecordsComplete() {
+  ++completions;
+  completionThread = std::this_thread::get_id();
+}
+
+std::vector<std::vector<uint8_t>> readAllRecords(
+    const btrieve::BtrieveDatabase &database) {
+  std::vector<std::vector<uint8_t>> records;
+  database.readRecords([&records](std::basic_string_view<uint8_t> record) {
+    records.emplace_back(record.begin(), record.end());
+    return btrieve::BtrieveDatabase::LoadRecordResult::COUNT;
+  });
+  return records;
+}
+
+std::vector<std::vector<uint8_t>> readAllRecords(const wchar_t *fileName,
+                                                 unsigned int decodeThreads) {
+  btrieve::BtrieveDatabase database;
+  database.setDecodeThreads(decodeThreads);
+  EXPECT_EQ(database.open(fileName), btrieve::BtrieveError::Success);
+  return readAllRecords(database);
+}
@@ -1,8 +1,14 @@
 #ifndef __TEST_BASE_H_
 #define __TEST_BASE_H_
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "SqlDatabase.h"
 #include "Text.h"
 #include "gtest/gtest.h"
 
@@ -24,6 +30,44 @@ class TempPath {
   std::string tempFolder;
 };
 
+// Keeps a copy of every record it's given, along with the threads it ran on.
+class CollectingRecordLoader : public btrieve::RecordLoader {
+ public:
+  virtual ~CollectingRecordLoader();
+
+  // Throws at record throwAt and cancels at record cancelAt, otherwise
+  // collects the record and reports it as COUNT, or as SKIP_COUNT for every
+  // other record when skipEveryOther is set.
+  virtual btrieve::BtrieveDatabase::LoadRecordResult onRecordLoaded(
+      std::basic_string_view<uint8_t> record) override;
+
+  virtual void onRecordsComplete() override;
+
+  std::vector<std::basic_string<uint8_t>> records;
+  size_t throwAt = SIZE_MAX;
+  size_t cancelAt = SIZE_MAX;
+  bool skipEveryOther = false;
+  size_t calls = 0;
+  int completions = 0;
+  // whether onRecordLoaded is running right now
+  std::atomic<bool> loading = false;
+  std::thread::id loaderThread;
+  std::thread::id completionThread;
+  // called with the loader as it's destroyed, for loaders owned by the loader
+  // under test
+  std::function<void(const CollectingRecordLoader &)> onDestroyed;
+};
+
+// Returns a copy of every record of database, in the order readRecords reads
+// them.
+std::vector<std::vector<uint8_t>> readAllRecords(
+    const btrieve::BtrieveDatabase &database);
+
+// Opens the DAT file fileName, decoding it with decodeThreads threads, and
+// returns a copy of every record in it, see readAllRecords.
+std::vector<std::vector<uint8_t>> readAllRecords(
+    const wchar_t *fileName, unsigned int decodeThreads = 1);
+
 class TestBase : public ::testing::Test {
  protected:
   TempPath *tempPath;
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "btrieve/BtrieveDatabase.h"
+#include "btrieve/BtrieveException.h"
+#include "btrieve/RecordCursor.h"
+#include "btrieve/Text.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Drops fileName from the OS page cache, so the next scan has to read it from
+// disk. Only supported where posix_fadvise is.
+static bool evictFromPageCache(const char *fileName) {
+#if defined(_WIN32) || defined(__APPLE__)
+  return false;
+#else
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(fd);
+  return evicted;
+#endif
+}
+
+// Times how long it takes to scan every record of each file, to track the
+// per record cost of decoding.
+//
+// Usage: database_benchmark [-i iterations] [-t threads] [-r] [-c] files...
+//   -r  prefetches data pages on a read-ahead thread
+//   -c  evicts the file from the page cache and reopens it before each scan,
+//       to measure scans that have to wait on the disk
+int main(int argc, const char **argv) {
+  unsigned int iterations = 100;
+  unsigned int threads = 1;
+  bool readAhead = false;
+  bool cold = false;
+
+  int i = 1;
+  for (; i < argc; ++i) {
+    if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+      iterations = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      threads = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-r")) {
+      readAhead = true;
+    } else if (!strcmp(argv[i], "-c")) {
+      cold = true;
+    } else {
+      break;
+    }
+  }
+
+  if (iterations == 0) {
+    iterations = 1;
+  }
+
+  for (; i < argc; ++i) {
+    btrieve::BtrieveDatabase database;
+    database.setDecodeThreads(threads);
+    database.setReadAhead(readAhead);
+    const std::wstring fileName = btrieve::toWideString(argv[i]);
+
+    try {
+      uint64_t recordCount = 0;
+      // touches every record so the scan can't be optimized away
+      uint64_t checksum = 0;
+      std::chrono::steady_clock::duration elapsed{};
+      for (unsigned int iteration = 0; iteration < iterations; ++iteration) {
+        if (cold && !evictFromPageCache(argv[i])) {
+          fprintf(stderr, "Can't evict %s from the page cache\n", argv[i]);
+          cold = false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if ((cold || iteration == 0) &&
+            database.open(fileName.c_str()) != btrieve::BtrieveError::Success) {
+          break;
+        }
+
+        btrieve::RecordCursor cursor = database.openCursor();
+        while (cursor.next()) {
+          auto record = cursor.getRecord();
+          checksum += record.size() + record.front() + record.back();
+          ++recordCount;
+        }
+        elapsed += std::chrono::steady_clock::now() - start;
+
+        if (cold) {
+          database.close();
+        }
+      }
+      database.close();
+
+      double ns = static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+              .count());
+      printf("%s: %llu records, %.3f ms/scan, %.1f ns/record (checksum %llx)\n",
+             argv[i],
+             static_cast<unsigned long long>(recordCount / iterations),
+             ns / iterations / 1000000.0,
+             recordCount > 0 ? ns / recordCount : 0.0,
+             static_cast<unsigned long long>(checksum));
+    } catch (btrieve::BtrieveException &ex) {
+      fprintf(stderr, "Error while scanning %s: %s\n", argv[i],
+              ex.getErrorMessage().c_str());
+    }
+  }
+}
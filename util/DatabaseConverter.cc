@@ -1,19 +1,253 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cwctype>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "btrieve/BtrieveDriver.h"
 #include "btrieve/BtrieveException.h"
 #include "btrieve/SqliteDatabase.h"
 #include "btrieve/Text.h"
 
+// Returns whether name matches pattern, where * matches any run of characters
+// and ? any single character. Case insensitive, like DOS file names.
+static bool matchesWildcard(const std::wstring &name,
+                            const std::wstring &pattern) {
+  size_t n = 0;
+  size_t p = 0;
+  // where to resume after the last *, if the rest fails to match
+  size_t starPattern = std::wstring::npos;
+  size_t starName = 0;
+
+  while (n < name.size()) {
+    if (p < pattern.size() &&
+        (pattern[p] == L'?' ||
+         std::towupper(pattern[p]) == std::towupper(name[n]))) {
+      ++n;
+      ++p;
+    } else if (p < pattern.size() && pattern[p] == L'*') {
+      starPattern = p++;
+      starName = n;
+    } else if (starPattern != std::wstring::npos) {
+      p = starPattern + 1;
+      n = ++starName;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == L'*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+// Adds the DAT files that argument names to files. argument is either a file,
+// a directory whose DAT files are all added, or a wildcard pattern in its last
+// component.
+static void addFiles(const char *argument,
+                     std::vector<std::filesystem::path> &files) {
+  std::filesystem::path path(argument);
+  std::wstring pattern;
+  std::filesystem::path directory;
+
+  const std::wstring fileName = path.filename().wstring();
+  std::error_code error;
+  if (fileName.find_first_of(L"*?") != std::wstring::npos) {
+    pattern = fileName;
+    directory = path.has_parent_path() ? path.parent_path() : ".";
+  } else if (std::filesystem::is_directory(path, error)) {
+    pattern = L"*.dat";
+    directory = path;
+  } else {
+    files.push_back(path);
+    return;
+  }
+
+  for (const auto &entry :
+       std::filesystem::directory_iterator(directory, error)) {
+    if (entry.is_regular_file(error) &&
+        matchesWildcard(entry.path().filename().wstring(), pattern)) {
+      files.push_back(entry.path());
+    }
+  }
+
+  if (error) {
+    fprintf(stderr, "Can't list %s: %s\n", argument, error.message().c_str());
+  }
+}
+
+static double toMilliseconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Converts DAT files to sql databases ahead of time, so that opening them
+// later doesn't have to. Files whose database is already up to date are
+// skipped, by the same rules BtrieveDriver::open uses.
+//
+// Usage: database_converter [-j jobs] [-r] [-p] [-m MiB] [-s key] [-t]
+//                            files/directories/patterns...
+//   -j  converts this many files at once, one per core by default
+//   -r  prefetches data pages on a read-ahead thread while converting
+//   -p  stores records on a writer thread while parsing, showing progress
+//       when converting one file at a time
+//   -m  builds databases of DAT files up to this size in memory, then copies
+//       them to their file once loaded
+//   -s  stores records in the order of this key, or key 0 for files without
+//       it, so scans through the key read fewer and fuller pages
+//   -t  reports the time spent in each phase of every conversion, and of all
+//       of them together, see btrieve::ConversionStats
 int main(int argc, const char **argv) {
-  for (int i = 1; i < argc; ++i) {
-    printf("Opening %s\n", argv[i]);
-
-    btrieve::BtrieveDriver driver(new btrieve::SqliteDatabase());
-    try {
-      driver.open(btrieve::toWideString(argv[i]).c_str());
-      printf("Successfully opened %s\n", argv[i]);
-    } catch (btrieve::BtrieveException &ex) {
-      fprintf(stderr, "Error while parsing %s: %s\n", argv[i],
-              ex.getErrorMessage().c_str());
+  unsigned int jobs = std::max(std::thread::hardware_concurrency(), 1u);
+  bool readAhead = false;
+  bool pipelined = false;
+  uint64_t inMemoryConversionLimit = 0;
+  int sortKey = -1;
+  bool reportStats = false;
+
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i) {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      jobs = std::max(atoi(argv[++i]), 1);
+    } else if (!strcmp(argv[i], "-r")) {
+      readAhead = true;
+    } else if (!strcmp(argv[i], "-p")) {
+      pipelined = true;
+    } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      inMemoryConversionLimit = strtoull(argv[++i], nullptr, 10) << 20;
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      sortKey = std::max(atoi(argv[++i]), 0);
+    } else if (!strcmp(argv[i], "-t")) {
+      reportStats = true;
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
     }
   }
-}
\ No newline at end of file
+
+  std::vector<std::filesystem::path> files;
+  for (; i < argc; ++i) {
+    addFiles(argv[i], files);
+  }
+  std::sort(files.begin(), files.end());
+  files.erase(std::unique(files.begin(), files.end()), files.end());
+
+  jobs = static_cast<unsigned int>(
+      std::min<size_t>(jobs, std::max<size_t>(files.size(), 1)));
+  const bool showProgress = pipelined && jobs == 1;
+
+  std::mutex outputMutex;
+  std::atomic<size_t> nextFile(0);
+  std::atomic<unsigned int> converted(0);
+  std::atomic<unsigned int> upToDate(0);
+  std::atomic<unsigned int> failed(0);
+  std::atomic<uint64_t> totalRecords(0);
+  std::atomic<uint64_t> totalBytes(0);
+  // the phases of every conversion, only touched with outputMutex held
+  btrieve::ConversionStats totalStats;
+
+  const auto convertFiles = [&]() {
+    for (size_t index = nextFile++; index < files.size(); index = nextFile++) {
+      const std::filesystem::path &file = files[index];
+      const std::string name = btrieve::toStdString(file);
+      const std::wstring wideName = btrieve::toWideString(file);
+
+      auto sqliteDatabase = new btrieve::SqliteDatabase();
+      sqliteDatabase->setInMemoryConversionLimit(inMemoryConversionLimit);
+      btrieve::BtrieveDriver driver(sqliteDatabase);
+      // a single file gets every core to decode it, otherwise the files
+      // themselves keep the cores busy
+      driver.setDecodeThreads(jobs == 1 ? 0 : 1);
+      driver.setReadAhead(readAhead);
+      driver.setPipelinedConversion(pipelined);
+      driver.setConversionSortKey(sortKey);
+      if (showProgress) {
+        driver.setConversionProgress(
+            [](unsigned int recordsConverted, unsigned int recordCount) {
+              printf("\r%u/%u records", recordsConverted, recordCount);
+              fflush(stdout);
+            });
+      }
+
+      try {
+        if (!driver.isConversionRequired(wideName.c_str(),
+                                         /* refreshUnchanged= */ true)) {
+          ++upToDate;
+          std::lock_guard<std::mutex> lock(outputMutex);
+          printf("%s is up to date\n", name.c_str());
+          continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (driver.open(wideName.c_str()) != btrieve::BtrieveError::Success) {
+          ++failed;
+          std::lock_guard<std::mutex> lock(outputMutex);
+          fprintf(stderr, "Can't open %s\n", name.c_str());
+          continue;
+        }
+        double ms = toMilliseconds(std::chrono::steady_clock::now() - start);
+
+        unsigned int recordCount = driver.getRecordCount();
+        std::error_code error;
+        uint64_t bytes = std::filesystem::file_size(file, error);
+        if (error) {
+          bytes = 0;
+        }
+        ++converted;
+        totalRecords += recordCount;
+        totalBytes += bytes;
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if (showProgress) {
+          printf("\n");
+        }
+        printf(
+            "Converted %s: %u records in %.1f ms, %.0f records/s, %.1f MB/s\n",
+            name.c_str(), recordCount, ms,
+            ms > 0 ? recordCount * 1000.0 / ms : 0.0,
+            ms > 0 ? bytes / 1000.0 / ms : 0.0);
+        if (reportStats) {
+          totalStats += driver.getConversionStats();
+          printf("  %s\n", driver.getConversionStats().toString().c_str());
+        }
+      } catch (btrieve::BtrieveException &ex) {
+        ++failed;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        fprintf(stderr, "Error while converting %s: %s\n", name.c_str(),
+                ex.getErrorMessage().c_str());
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned int job = 1; job < jobs; ++job) {
+    workers.emplace_back(convertFiles);
+  }
+  convertFiles();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  double ms = toMilliseconds(std::chrono::steady_clock::now() - start);
+
+  printf(
+      "Converted %u of %zu files (%u up to date, %u failed) with %u jobs: "
+      "%llu records in %.1f ms, %.0f records/s, %.1f MB/s\n",
+      converted.load(), files.size(), upToDate.load(), failed.load(), jobs,
+      static_cast<unsigned long long>(totalRecords.load()), ms,
+      ms > 0 ? totalRecords.load() * 1000.0 / ms : 0.0,
+      ms > 0 ? totalBytes.load() / 1000.0 / ms : 0.0);
+  if (reportStats) {
+    // phases of conversions running at once add up to more than the time
+    // taken
+    printf("  %s\n", totalStats.toString().c_str());
+  }
+
+  return failed > 0 ? 1 : 0;
+}
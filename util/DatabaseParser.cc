@@ -1,21 +1,54 @@
+#include <cstring>
+
 #include "btrieve/BtrieveDatabase.h"
 #include "btrieve/BtrieveException.h"
 #include "btrieve/Text.h"
 
+// Usage: database_parser [-m] files...
+//   -m  only probes the metadata of each file, without reading its records
 int main(int argc, const char **argv) {
   btrieve::BtrieveDatabase database;
+  bool metadataOnly = false;
+
+  int i = 1;
+  if (i < argc && !strcmp(argv[i], "-m")) {
+    metadataOnly = true;
+    ++i;
+  }
 
-  for (int i = 1; i < argc; ++i) {
+  for (; i < argc; ++i) {
     printf("Opening %s\n", argv[i]);
 
     try {
-      uint recordCount = 0;
-      database.parseDatabase(
-          btrieve::toWideString(argv[i]).c_str(), []() { return true; },
-          [&recordCount](const std::basic_string_view<uint8_t> record) {
-            ++recordCount;
-            return btrieve::BtrieveDatabase::LoadRecordResult::COUNT;
-          });
+      if (metadataOnly) {
+        if (database.probe(btrieve::toWideString(argv[i]).c_str()) !=
+            btrieve::BtrieveError::Success) {
+          continue;
+        }
+
+        printf(
+            "%s: %d records of %d bytes (%s), %d pages of %d bytes, %d keys\n",
+            argv[i], database.getRecordCount(), database.getRecordLength(),
+            database.isVariableLengthRecords() ? "variable" : "fixed",
+            database.getPageCount(), database.getPageLength(),
+            static_cast<int>(database.getKeys().size()));
+        continue;
+      }
+
+      unsigned int recordCount = 0;
+      if (database.open(btrieve::toWideString(argv[i]).c_str()) !=
+          btrieve::BtrieveError::Success) {
+        continue;
+      }
+
+      if (database.getRecordCount() > 0) {
+        database.readRecords(
+            [&recordCount](const std::basic_string_view<uint8_t> record) {
+              ++recordCount;
+              return btrieve::BtrieveDatabase::LoadRecordResult::COUNT;
+            });
+      }
+      database.close();
 
       printf("Successfully read all %d records from %s\n", recordCount,
              argv[i]);
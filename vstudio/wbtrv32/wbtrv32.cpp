@@ -20,6 +20,17 @@
 // Define this to log errors to wbtrv32.log
 #define LOG_TO_FILE
 
+// The build defines these to turn on optional behavior, see the
+// LogConversionStats and BackgroundConversion properties in wbtrv32.vcxproj
+// and the configs of the same names in .bazelrc.
+//
+// LOG_CONVERSION_STATS logs where the time went whenever opening a file
+// converts it.
+//
+// BACKGROUND_CONVERSION has Open return without waiting for a file to be
+// converted, serving physical steps and direct reads from the DAT file
+// meanwhile.
+
 #ifdef DEBUG_ATTACH
 #include "Psapi.h"
 #endif
@@ -106,7 +117,7 @@ struct BtrieveCommand {
 
 static void debug(const BtrieveCommand &command, const char *format, ...) {
   BtrieveDriver *driver = getOpenDatabase(command.lpPositionBlock);
-  char buf[256];
+  char buf[512];
   int len;
 
   if (driver != nullptr) {
@@ -129,6 +140,8 @@ static void debug(const BtrieveCommand &command, const char *format, ...) {
   va_start(args, format);
   len = vsnprintf(buf, sizeof(buf) - 2, format, args);
   va_end(args);
+  // truncated messages still need room for the cr/lf
+  len = std::clamp(len, 0, static_cast<int>(sizeof(buf)) - 3);
 
   // append cr/lf
   buf[len] = '\r';
@@ -189,6 +202,9 @@ static BtrieveError Open(BtrieveCommand &command) {
 
   std::shared_ptr<BtrieveDriver> driver =
       std::make_shared<BtrieveDriver>(new SqliteDatabase());
+#ifdef BACKGROUND_CONVERSION
+  driver->setBackgroundConversion(true);
+#endif
 
   BtrieveError error = driver->open(fullPathFileName, openMode);
   if (error != BtrieveError::Success) {
@@ -197,6 +213,13 @@ static BtrieveError Open(BtrieveCommand &command) {
 
   AddToOpenFiles(command, driver);
 
+#ifdef LOG_CONVERSION_STATS
+  if (driver->getConversionStats().totalTime.count() > 0) {
+    debug(command, "Converted: %s",
+          driver->getConversionStats().toString().c_str());
+  }
+#endif
+
   return BtrieveError::Success;
 }
 
@@ -337,9 +360,16 @@ static BtrieveError GetPosition(BtrieveCommand &command) {
     return BtrieveError::DataBufferLengthOverrun;
   }
 
+  // Btrieve positions are 4 bytes wide, so there's no way to hand back a row
+  // id past that
+  const uint64_t position = btrieveDriver->getPosition();
+  if (position > UINT32_MAX) {
+    return BtrieveError::InvalidRecordAddress;
+  }
+
   *command.lpdwDataBufferLength = sizeof(uint32_t);
   *reinterpret_cast<uint32_t *>(command.lpDataBuffer) =
-      btrieveDriver->getPosition();
+      static_cast<uint32_t>(position);
 
   return BtrieveError::Success;
 }
@@ -459,7 +489,7 @@ static BtrieveError Query(BtrieveCommand &command) {
 
 static BtrieveError Upsert(
     BtrieveCommand &command,
-    std::function<std::pair<BtrieveError, unsigned int>(
+    std::function<std::pair<BtrieveError, uint64_t>(
         BtrieveDriver *, std::basic_string_view<uint8_t> record)>
         upsertFunction) {
   auto btrieveDriver = getOpenDatabase(command.lpPositionBlock);
@@ -619,8 +649,13 @@ static BtrieveError Create(BtrieveCommand &command) {
                            lpFileSpec->logicalFixedRecordLength, 0, 0,
                            recordType, true, 0);
 
+  // create() leaves a transaction open (via createSqliteInsertionCommand)
+  // for callers that are about to bulk load records, and defers building the
+  // non-unique indices and triggers until the load finishes. Since we have no
+  // records to load, complete it right away so the schema is whole and later
+  // Insert/Update/etc. calls aren't stuck behind an unclosed transaction.
   if (!inMemory) {
-    sql.create(toWideString(dbPath).c_str(), database);
+    sql.create(toWideString(dbPath).c_str(), database)->onRecordsComplete();
     return BtrieveError::Success;
   }
 
@@ -628,10 +663,6 @@ static BtrieveError Create(BtrieveCommand &command) {
   SqliteDatabase *sqliteDatabase = new SqliteDatabase();
   std::unique_ptr<RecordLoader> recordLoader =
       sqliteDatabase->create(nullptr, database);
-  // create() leaves a transaction open (via createSqliteInsertionCommand)
-  // for callers that are about to bulk load records; since we have none to
-  // load, commit it now so later Insert/Update/etc. calls on this in-memory
-  // database aren't stuck behind an unclosed transaction.
   recordLoader->onRecordsComplete();
 
   AddToOpenFiles(command, std::make_shared<BtrieveDriver>(sqliteDatabase));